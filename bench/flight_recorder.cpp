@@ -0,0 +1,34 @@
+#include <urn/flight_recorder.hpp>
+#include <benchmark/benchmark.h>
+#include <memory>
+
+
+namespace {
+
+
+void tsc_now (benchmark::State &state)
+{
+  for (auto _: state)
+  {
+    benchmark::DoNotOptimize(urn::tsc_now());
+  }
+}
+BENCHMARK(tsc_now);
+
+
+void flight_recorder_record (benchmark::State &state)
+{
+  // per-thread recorders, checks there is no hidden sharing
+  auto recorder = std::make_unique<urn::flight_recorder<>>();
+  uint32_t value = 0;
+
+  for (auto _: state)
+  {
+    recorder->record(urn::trace_event::send_submit, value++);
+    benchmark::ClobberMemory();
+  }
+}
+BENCHMARK(flight_recorder_record)->ThreadRange(1, 8);
+
+
+} // namespace
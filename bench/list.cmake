@@ -1,4 +1,9 @@
 list(APPEND urn_benchmarks_sources
   bench/main.cpp
+  bench/flight_recorder.cpp
   bench/invoke.cpp
+  bench/relay.cpp
+  bench/session_store.cpp
+  bench/token_bucket.cpp
+  bench/udp_send.cpp
 )
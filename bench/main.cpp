@@ -1,2 +1,7 @@
+#if __urn_alloc_tracking
+  #define __urn_alloc_tracking_operators
+  #include <urn/alloc_tracking.hpp>
+#endif
+
 #include <benchmark/benchmark.h>
 BENCHMARK_MAIN();
@@ -0,0 +1,485 @@
+#include <urn/relay.hpp>
+#include <urn/alloc_tracking.hpp>
+#include <benchmark/benchmark.h>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <random>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+
+namespace {
+
+
+struct bench_lib
+{
+  using endpoint = uint64_t;
+
+  static uint64_t address_key (const endpoint &src) noexcept
+  {
+    return src;
+  }
+
+  static size_t endpoint_hash (const endpoint &endpoint, uint64_t seed) noexcept
+  {
+    return urn::mix(endpoint, seed);
+  }
+
+  struct packet
+  {
+    const std::byte *ptr;
+    size_t len;
+
+    const std::byte *data () const noexcept
+    {
+      return ptr;
+    }
+
+    size_t size () const noexcept
+    {
+      return len;
+    }
+  };
+
+  struct client
+  {
+    void start_receive () noexcept
+    { }
+  };
+
+  struct peer
+  {
+    void start_receive () noexcept
+    { }
+
+    void start_send (const endpoint &, const packet &, size_t) noexcept
+    { }
+  };
+
+  struct session
+  {
+    const endpoint client_endpoint;
+
+    session (const endpoint &client_endpoint, size_t) noexcept
+      : client_endpoint{client_endpoint}
+    { }
+
+    void start_send (const packet &) noexcept
+    { }
+
+    static void start_fan_out (session *const [], size_t,
+      const packet &) noexcept
+    { }
+  };
+};
+
+
+// with urn_alloc_tracking: heap allocations per iteration of measured loop
+void report_allocations (benchmark::State &state,
+  const urn::alloc_tracking::scope &allocs)
+{
+  if constexpr (urn::alloc_tracking::enabled)
+  {
+    state.counters["allocs/packet"] = benchmark::Counter(
+      static_cast<double>(allocs.allocations()),
+      benchmark::Counter::kAvgIterations
+    );
+  }
+}
+
+
+using pmr_allocator = std::pmr::polymorphic_allocator<std::byte>;
+
+
+// default allocator or pool resource shared by all relays
+template <typename Allocator>
+Allocator bench_allocator ()
+{
+  if constexpr (std::is_same_v<Allocator, pmr_allocator>)
+  {
+    static std::pmr::synchronized_pool_resource pool{};
+    return &pool;
+  }
+  else
+  {
+    return {};
+  }
+}
+
+
+template <bool MultiThreaded, typename Allocator = std::allocator<std::byte>>
+struct relay_fixture
+{
+  static constexpr uint64_t session_count = 1000;
+
+  bench_lib::client client{};
+  bench_lib::peer peer{};
+  urn::relay<bench_lib, MultiThreaded, Allocator> relay;
+  uint64_t session_id{};
+  std::array<uint64_t, 16> data{};
+
+  // client ChannelData: channel 0x4000 with payload of data size
+  std::array<std::byte, 4 + sizeof(data)> channel_data{
+    std::byte{0x40}, std::byte{0x00}, std::byte{0x00}, std::byte{sizeof(data)}
+  };
+
+  relay_fixture (uint32_t rate_limit,
+      uint16_t thread_count = 1,
+      size_t channels = 0)
+    : relay{thread_count, client, peer, 1, bench_allocator<Allocator>()}
+  {
+    relay.on_thread_start(0);
+    relay.set_session_rate_limit(rate_limit, rate_limit);
+    relay.set_channel_data(channels);
+    for (uint64_t id = 0;  id != session_count;  ++id)
+    {
+      relay.on_client_received(id, bench_lib::packet{
+        reinterpret_cast<const std::byte *>(&id), sizeof(id)
+      });
+    }
+
+    // let sessions learn peer endpoint for client to peer path
+    for (uint64_t id = 0;  id != session_count;  ++id)
+    {
+      data[0] = id;
+      auto packet = bench_lib::packet{
+        reinterpret_cast<const std::byte *>(data.data()), sizeof(data)
+      };
+      if (relay.on_peer_received(0, packet))
+      {
+        relay.on_session_sent(*relay.find_session(id), packet);
+      }
+    }
+  }
+
+  // peer packet (session id prefix may be rewritten by relay)
+  bench_lib::packet next_packet () noexcept
+  {
+    session_id = (session_id + 1) % session_count;
+    data[0] = session_id;
+    return {reinterpret_cast<const std::byte *>(data.data()), sizeof(data)};
+  }
+
+  // client packet, session_id is used as client endpoint
+  bench_lib::packet next_client_packet (bool use_channel_data) noexcept
+  {
+    if (use_channel_data)
+    {
+      session_id = (session_id + 1) % session_count;
+      return {channel_data.data(), channel_data.size()};
+    }
+    return next_packet();
+  }
+};
+
+
+template <bool MultiThreaded, typename Allocator = std::allocator<std::byte>>
+void relay_on_peer_received (benchmark::State &state)
+{
+  // range(0): session rate limit (bytes/sec, 0 = unlimited), set high
+  // enough to never drop, so only limiter overhead is measured
+  // range(1): ChannelData framing towards client (0 = session id prefix)
+  relay_fixture<MultiThreaded, Allocator> fixture{
+    static_cast<uint32_t>(state.range(0)),
+    1,
+    static_cast<size_t>(state.range(1))
+  };
+
+  std::chrono::milliseconds now{0};
+  urn::alloc_tracking::scope allocs;
+  for (auto _: state)
+  {
+    fixture.relay.on_clock_tick(++now);
+    auto packet = fixture.next_packet();
+    if (fixture.relay.on_peer_received(0, packet))
+    {
+      fixture.relay.on_session_sent(
+        *fixture.relay.find_session(fixture.session_id),
+        packet
+      );
+    }
+  }
+  report_allocations(state, allocs);
+}
+BENCHMARK_TEMPLATE(relay_on_peer_received, false)
+  ->Args({0, 0})
+  ->Args({4'000'000'000, 0})
+  ->Args({0, 1});
+BENCHMARK_TEMPLATE(relay_on_peer_received, true)
+  ->Args({0, 0})
+  ->Args({4'000'000'000, 0})
+  ->Args({0, 1});
+BENCHMARK_TEMPLATE(relay_on_peer_received, true, pmr_allocator)
+  ->Args({0, 0})
+  ->Args({0, 1});
+
+
+
+template <bool MultiThreaded>
+void relay_on_client_received (benchmark::State &state)
+{
+  // client to peer path: session is looked up by client endpoint (same as
+  // session id in this fixture), compare with relay_on_peer_received/0
+  // range(0): ChannelData framing (0 = data forwarded as is)
+  const bool use_channel_data = state.range(0) != 0;
+  relay_fixture<MultiThreaded> fixture{0, 1, use_channel_data ? 1u : 0u};
+
+  std::chrono::milliseconds now{0};
+  urn::alloc_tracking::scope allocs;
+  for (auto _: state)
+  {
+    fixture.relay.on_clock_tick(++now);
+    auto packet = fixture.next_client_packet(use_channel_data);
+    if (fixture.relay.on_client_received(fixture.session_id, packet))
+    {
+      fixture.relay.on_peer_sent(packet);
+    }
+  }
+  report_allocations(state, allocs);
+}
+BENCHMARK_TEMPLATE(relay_on_client_received, false)->Arg(0)->Arg(1);
+BENCHMARK_TEMPLATE(relay_on_client_received, true)->Arg(0)->Arg(1);
+
+
+template <typename Allocator>
+void relay_session_churn (benchmark::State &state)
+{
+  // full session budget: each registration evicts session (map and client
+  // index nodes, fan-out members are freed and allocated again)
+  // range(0): fan-out endpoints per session
+  using relay_type = urn::relay<bench_lib, false, Allocator>;
+  bench_lib::client client{};
+  bench_lib::peer peer{};
+
+  // single-threaded relay does not need synchronized pool
+  std::pmr::unsynchronized_pool_resource pool{};
+  auto alloc = [&pool]() -> Allocator
+  {
+    if constexpr (std::is_same_v<Allocator, pmr_allocator>)
+    {
+      return &pool;
+    }
+    else
+    {
+      return {};
+    }
+  };
+  relay_type relay{1, client, peer, 1, alloc()};
+  relay.on_thread_start(0);
+  relay.set_session_budget(relay_fixture<false>::session_count);
+  relay.set_fan_out(state.range(0));
+
+  uint64_t id = 0;
+  for (auto _: state)
+  {
+    ++id;
+    for (uint64_t endpoint = 0;  endpoint != uint64_t(state.range(0));  ++endpoint)
+    {
+      relay.on_client_received(id << 8 | endpoint, bench_lib::packet{
+        reinterpret_cast<const std::byte *>(&id), sizeof(id)
+      });
+    }
+  }
+}
+BENCHMARK_TEMPLATE(relay_session_churn, std::allocator<std::byte>)->Arg(1)->Arg(2);
+BENCHMARK_TEMPLATE(relay_session_churn, pmr_allocator)->Arg(1)->Arg(2);
+
+
+template <typename SessionIdHash>
+void relay_find_session (benchmark::State &state)
+{
+  // range(0): session ids
+  //  0: random
+  //  1: adversarial, multiples of session table bucket count (with identity
+  //     hash all land in same bucket)
+  using relay_type = urn::relay<bench_lib,
+    false,
+    std::allocator<std::byte>,
+    SessionIdHash
+  >;
+  constexpr size_t session_count = relay_fixture<false>::session_count;
+
+  bench_lib::client client{};
+  bench_lib::peer peer{};
+  relay_type relay{1, client, peer};
+  relay.on_thread_start(0);
+
+  // reserves table same way as std::unordered_set::reserve()
+  relay.set_session_budget(session_count);
+  std::unordered_set<uint64_t> probe;
+  probe.reserve(session_count);
+  const uint64_t bucket_count = probe.bucket_count();
+
+  std::mt19937_64 random{1};
+  std::vector<uint64_t> ids;
+  for (uint64_t i = 1;  i <= session_count;  ++i)
+  {
+    ids.push_back(state.range(0) ? i * bucket_count : random());
+    relay.on_client_received(i, bench_lib::packet{
+      reinterpret_cast<const std::byte *>(&ids.back()), sizeof(uint64_t)
+    });
+  }
+
+  size_t index = 0;
+  for (auto _: state)
+  {
+    benchmark::DoNotOptimize(relay.find_session(ids[index]));
+    index = (index + 1) % ids.size();
+  }
+}
+BENCHMARK_TEMPLATE(relay_find_session, urn::seeded_session_id_hash)
+  ->Arg(0)
+  ->Arg(1);
+BENCHMARK_TEMPLATE(relay_find_session, urn::identity_session_id_hash)
+  ->Arg(0)
+  ->Arg(1);
+
+
+void relay_on_peer_received_during_flood (benchmark::State &state)
+{
+  // background thread floods client port with random ids from single
+  // source, range(0): flood protection enabled
+  relay_fixture<true> fixture{0, 2};
+  if (state.range(0))
+  {
+    fixture.relay.set_registration_limit(100, 0);
+  }
+
+  std::atomic<bool> done{false};
+  std::thread flood{
+    [&]
+    {
+      fixture.relay.on_thread_start(1);
+      uint64_t id = fixture.session_count;
+      while (!done.load(std::memory_order_relaxed))
+      {
+        // bounded id space to keep memory in check without protection
+        id = fixture.session_count + (id * 6364136223846793005ull + 1) % 1'000'000;
+        fixture.relay.on_client_received(1, bench_lib::packet{
+          reinterpret_cast<const std::byte *>(&id), sizeof(id)
+        });
+      }
+    }
+  };
+
+  for (auto _: state)
+  {
+    auto packet = fixture.next_packet();
+    if (fixture.relay.on_peer_received(0, packet))
+    {
+      fixture.relay.on_session_sent(
+        *fixture.relay.find_session(fixture.session_id),
+        packet
+      );
+    }
+  }
+
+  done = true;
+  flood.join();
+}
+BENCHMARK(relay_on_peer_received_during_flood)->Arg(0)->Arg(1)->UseRealTime();
+
+
+// --threads vs --workers (libuv): peer path with one relay shared by all
+// threads vs relay per worker process with sessions in shared session store
+// (benchmark threads stand in for processes, store memory is shared same way
+// as MAP_SHARED mapping)
+
+std::unique_ptr<relay_fixture<true>> shared_relay{};
+
+
+void relay_on_peer_received_threads (benchmark::State &state)
+{
+  if (state.thread_index() == 0)
+  {
+    shared_relay = std::make_unique<relay_fixture<true>>(0, state.threads());
+  }
+  // fixture exists only once all threads have entered loop
+  urn::relay<bench_lib, true> *relay = nullptr;
+  std::array<uint64_t, 16> data{};
+  uint64_t session_id = state.thread_index();
+  urn::alloc_tracking::scope allocs;
+  for (auto _: state)
+  {
+    if (!relay)
+    {
+      relay = &shared_relay->relay;
+      relay->on_thread_start(static_cast<uint16_t>(state.thread_index()));
+    }
+    session_id = (session_id + 1) % relay_fixture<true>::session_count;
+    data[0] = session_id;
+    bench_lib::packet packet{
+      reinterpret_cast<const std::byte *>(data.data()), sizeof(data)
+    };
+    if (relay->on_peer_received(0, packet))
+    {
+      relay->on_session_sent(*relay->find_session(session_id), packet);
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+  report_allocations(state, allocs);
+
+  if (state.thread_index() == 0)
+  {
+    shared_relay.reset();
+  }
+}
+BENCHMARK(relay_on_peer_received_threads)->ThreadRange(1, 4)->UseRealTime();
+
+
+using bench_store = urn::relay<bench_lib, false>::session_store_type;
+std::vector<uint64_t> shared_store_memory{};
+std::optional<bench_store> shared_store{};
+
+
+void relay_on_peer_received_workers (benchmark::State &state)
+{
+  constexpr uint64_t session_count = relay_fixture<false>::session_count;
+  if (state.thread_index() == 0)
+  {
+    // sessions registered by some worker
+    shared_store_memory.resize(bench_store::memory_size(4096) / sizeof(uint64_t));
+    shared_store = bench_store::create(shared_store_memory.data(), 4096, 1);
+    for (uint64_t id = 0;  id != session_count;  ++id)
+    {
+      shared_store->insert(id, {id, 0});
+    }
+  }
+
+  bench_lib::client client{};
+  bench_lib::peer peer{};
+  std::optional<urn::relay<bench_lib, false>> relay{};
+
+  std::array<uint64_t, 16> data{};
+  uint64_t session_id = state.thread_index();
+  urn::alloc_tracking::scope allocs;
+  for (auto _: state)
+  {
+    if (!relay)
+    {
+      // worker's own relay (store exists only once all threads have
+      // entered loop), sessions restored by their first packets
+      relay.emplace(1, client, peer);
+      relay->on_thread_start(0);
+      relay->set_session_store(&*shared_store);
+    }
+    session_id = (session_id + 1) % session_count;
+    data[0] = session_id;
+    bench_lib::packet packet{
+      reinterpret_cast<const std::byte *>(data.data()), sizeof(data)
+    };
+    if (relay->on_peer_received(0, packet))
+    {
+      relay->on_session_sent(*relay->find_session(session_id), packet);
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+  report_allocations(state, allocs);
+}
+BENCHMARK(relay_on_peer_received_workers)->ThreadRange(1, 4)->UseRealTime();
+
+} // namespace
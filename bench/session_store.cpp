@@ -0,0 +1,155 @@
+#include <urn/session_store.hpp>
+#include <urn/__bits/lib.hpp>
+#include <benchmark/benchmark.h>
+
+#if !__urn_os_windows // {{{1
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <map>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+namespace {
+
+
+using store_type = urn::session_store<uint64_t>;
+
+// lookups after attach, i.e. first packets of restarted relay
+constexpr size_t first_lookups = 1000;
+
+
+uint64_t session_id (size_t index) noexcept
+{
+  return index * 0x9e37'79b9'7f4a'7c15ull;
+}
+
+
+// Store file with \a sessions sessions at half load, created once per size
+// and removed at exit
+const std::string &store_file (size_t sessions)
+{
+  static std::map<size_t, std::string> files;
+  auto &path = files[sessions];
+  if (!path.empty())
+  {
+    return path;
+  }
+
+  path = "/tmp/urn_bench_session_store_" + std::to_string(sessions);
+  std::atexit([]{
+    for (auto &[_, path]: files)
+    {
+      ::unlink(path.c_str());
+    }
+  });
+
+  size_t capacity = 1;
+  while (capacity < 2 * sessions)
+  {
+    capacity *= 2;
+  }
+  auto size = store_type::memory_size(capacity);
+
+  // filled in memory and written sequentially: faulting in sparse file
+  // mapping page at time is slow on some filesystems
+  std::vector<uint64_t> memory(size / sizeof(uint64_t));
+  auto store = store_type::create(memory.data(), capacity, 1);
+  for (size_t i = 0;  i != sessions;  ++i)
+  {
+    store.insert(session_id(i), i);
+  }
+
+  auto fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  auto data = reinterpret_cast<const char *>(memory.data());
+  for (size_t offset = 0;  offset < size;  )
+  {
+    auto written = ::write(fd, data + offset, size - offset);
+    if (written <= 0)
+    {
+      break;
+    }
+    offset += written;
+  }
+  ::close(fd);
+  return path;
+}
+
+
+void session_store_cold_start (benchmark::State &state)
+{
+  // restart: map existing file, attach and serve first lookups
+  const size_t sessions = state.range(0);
+  const auto &path = store_file(sessions);
+  std::mt19937_64 random{1};
+
+  for (auto _: state)
+  {
+    auto fd = ::open(path.c_str(), O_RDWR);
+    struct stat st{};
+    ::fstat(fd, &st);
+    auto memory = ::mmap(nullptr, st.st_size,
+      PROT_READ | PROT_WRITE,
+      MAP_SHARED,
+      fd,
+      0
+    );
+    ::close(fd);
+    if (memory == MAP_FAILED)
+    {
+      state.SkipWithError("mmap");
+      return;
+    }
+
+    auto store = store_type::open(memory, st.st_size);
+    uint64_t endpoint{};
+    for (size_t i = 0;  i != first_lookups;  ++i)
+    {
+      benchmark::DoNotOptimize(
+        store.find(session_id(random() % sessions), endpoint)
+      );
+    }
+
+    ::munmap(memory, st.st_size);
+  }
+  state.counters["sessions"] = static_cast<double>(sessions);
+}
+BENCHMARK(session_store_cold_start)
+  ->Arg(1 << 20)
+  ->Arg(10'000'000)
+  ->Unit(benchmark::kMicrosecond);
+
+
+void session_table_rebuild (benchmark::State &state)
+{
+  // baseline: relay without store learns sessions again, here at best
+  // case of all registrations arriving at once
+  const size_t sessions = state.range(0);
+
+  for (auto _: state)
+  {
+    std::unordered_map<uint64_t, uint64_t> table;
+    table.reserve(sessions);
+    for (size_t i = 0;  i != sessions;  ++i)
+    {
+      table.try_emplace(session_id(i), i);
+    }
+    benchmark::DoNotOptimize(table.size());
+  }
+  state.counters["sessions"] = static_cast<double>(sessions);
+}
+BENCHMARK(session_table_rebuild)
+  ->Arg(1 << 20)
+  ->Arg(10'000'000)
+  ->Unit(benchmark::kMillisecond);
+
+
+} // namespace
+
+#endif // }}}1
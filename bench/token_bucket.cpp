@@ -0,0 +1,40 @@
+#include <urn/token_bucket.hpp>
+#include <benchmark/benchmark.h>
+
+
+namespace {
+
+
+void token_bucket_try_consume (benchmark::State &state)
+{
+  // refill on every call (new millisecond) vs within same millisecond
+  const auto refill = state.range(0) != 0;
+  const urn::token_bucket::limit limit{1'000'000'000, 1'000'000'000};
+  uint32_t now = 0;
+  urn::token_bucket bucket{limit, now};
+
+  for (auto _: state)
+  {
+    now += refill;
+    benchmark::DoNotOptimize(bucket.try_consume(limit, now, 100));
+  }
+}
+BENCHMARK(token_bucket_try_consume)->Arg(0)->Arg(1);
+
+
+void token_bucket_try_consume_shared (benchmark::State &state)
+{
+  // worst case: all threads hammering same session
+  static const urn::token_bucket::limit limit{1'000'000'000, 1'000'000'000};
+  static urn::token_bucket bucket{limit, 0};
+
+  uint32_t now = 0;
+  for (auto _: state)
+  {
+    benchmark::DoNotOptimize(bucket.try_consume(limit, ++now, 100));
+  }
+}
+BENCHMARK(token_bucket_try_consume_shared)->ThreadRange(1, 8);
+
+
+} // namespace
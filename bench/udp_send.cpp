@@ -0,0 +1,102 @@
+#include <urn/__bits/lib.hpp>
+#include <benchmark/benchmark.h>
+
+#if !__urn_os_windows // {{{1
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+
+namespace {
+
+
+// Sender and receiver UDP sockets on loopback. Receiver is never drained,
+// once its (small) queue is full, kernel drops packets after routing, so
+// each send costs the same.
+struct udp_pair
+{
+  int sender = -1, receiver = -1;
+  sockaddr_in receiver_address{};
+
+  udp_pair ()
+  {
+    receiver = ::socket(AF_INET, SOCK_DGRAM, 0);
+    int size = 4096;
+    ::setsockopt(receiver, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+    receiver_address.sin_family = AF_INET;
+    receiver_address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ::bind(receiver,
+      reinterpret_cast<const sockaddr *>(&receiver_address),
+      sizeof(receiver_address)
+    );
+    socklen_t address_size = sizeof(receiver_address);
+    ::getsockname(receiver,
+      reinterpret_cast<sockaddr *>(&receiver_address),
+      &address_size
+    );
+
+    sender = ::socket(AF_INET, SOCK_DGRAM, 0);
+  }
+
+  ~udp_pair ()
+  {
+    ::close(sender);
+    ::close(receiver);
+  }
+
+  udp_pair (const udp_pair &) = delete;
+  udp_pair &operator= (const udp_pair &) = delete;
+};
+
+
+void udp_sendto (benchmark::State &state)
+{
+  // unconnected (relay listener): route and neighbour lookup per send
+  udp_pair sockets;
+  std::vector<char> data(state.range(0));
+
+  for (auto _: state)
+  {
+    benchmark::DoNotOptimize(
+      ::sendto(sockets.sender, data.data(), data.size(), 0,
+        reinterpret_cast<const sockaddr *>(&sockets.receiver_address),
+        sizeof(sockets.receiver_address)
+      )
+    );
+  }
+  state.SetBytesProcessed(state.iterations() * data.size());
+}
+BENCHMARK(udp_sendto)->Arg(64)->Arg(1200);
+
+
+void udp_send_connected (benchmark::State &state)
+{
+  // connect()-ed (--session.connect): route cached on socket
+  udp_pair sockets;
+  std::vector<char> data(state.range(0));
+  if (::connect(sockets.sender,
+      reinterpret_cast<const sockaddr *>(&sockets.receiver_address),
+      sizeof(sockets.receiver_address)) == -1)
+  {
+    state.SkipWithError("connect");
+    return;
+  }
+
+  for (auto _: state)
+  {
+    benchmark::DoNotOptimize(
+      ::send(sockets.sender, data.data(), data.size(), 0)
+    );
+  }
+  state.SetBytesProcessed(state.iterations() * data.size());
+}
+BENCHMARK(udp_send_connected)->Arg(64)->Arg(1200);
+
+
+} // namespace
+
+#endif // }}}1
@@ -0,0 +1,355 @@
+#include <libuv/cpu_layout.hpp>
+#include <libuv/relay.hpp>
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+#if __urn_os_linux
+  #include <filesystem>
+  #include <pthread.h>
+  #include <sched.h>
+#endif
+
+
+namespace urn_libuv {
+
+
+cpu_list parse_cpu_list (const std::string &list)
+{
+  cpu_list result;
+
+  std::istringstream iss{list};
+  for (std::string item;  std::getline(iss, item, ',');  /**/)
+  {
+    try
+    {
+      size_t end = 0;
+      auto first = std::stoi(item, &end);
+      auto last = first;
+      if (end < item.size() && item[end] == '-')
+      {
+        item.erase(0, end + 1);
+        last = std::stoi(item, &end);
+      }
+      if (end != item.size() || first < 0 || last < first)
+      {
+        throw std::invalid_argument(item);
+      }
+      for (auto cpu = first;  cpu <= last;  ++cpu)
+      {
+        result.push_back(cpu);
+      }
+    }
+    catch (const std::logic_error &)
+    {
+      throw std::runtime_error("cpu-list: invalid argument (" + list + ')');
+    }
+  }
+
+  if (result.empty())
+  {
+    throw std::runtime_error("cpu-list: invalid argument (" + list + ')');
+  }
+
+  return result;
+}
+
+
+#if __urn_os_linux // {{{1
+
+
+namespace {
+
+
+namespace fs = std::filesystem;
+
+
+std::string read_line (const fs::path &path)
+{
+  std::string line;
+  std::ifstream file{path};
+  std::getline(file, line);
+  return line;
+}
+
+
+cpu_list numa_node_cpus (int node)
+{
+  auto path = "/sys/devices/system/node/node" + std::to_string(node) + "/cpulist";
+  auto list = read_line(path);
+  if (list.empty())
+  {
+    throw std::runtime_error("numa: no node " + std::to_string(node));
+  }
+  return parse_cpu_list(list);
+}
+
+
+int irq_cpu (int irq)
+{
+  auto dir = fs::path{"/proc/irq"} / std::to_string(irq);
+  auto list = read_line(dir / "effective_affinity_list");
+  if (list.empty())
+  {
+    list = read_line(dir / "smp_affinity_list");
+  }
+  return list.empty() ? -1 : parse_cpu_list(list).front();
+}
+
+
+struct rx_queue
+{
+  std::string name;
+  int irq = -1, cpu = -1;
+};
+
+
+bool is_rx_irq_name (const std::string &action, const std::string &owner)
+{
+  // driver naming varies: eth0-TxRx-0, eth0-rx-0, eth0-0, virtio3-input.0, ...
+  if (action.compare(0, owner.size(), owner) != 0
+    || action.size() == owner.size()
+    || (action[owner.size()] != '-' && action[owner.size()] != '_'))
+  {
+    return false;
+  }
+
+  auto lower = action;
+  std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+  if (lower.find("config") != lower.npos || lower.find("output") != lower.npos)
+  {
+    return false;
+  }
+  return lower.find("tx") == lower.npos || lower.find("rx") != lower.npos;
+}
+
+
+std::vector<int> interface_rx_irqs (const std::string &interface)
+{
+  // IRQ names use either interface or (virtio) device name
+  std::vector<std::string> owners{interface};
+  std::error_code ec;
+  auto device = fs::read_symlink(fs::path{"/sys/class/net"} / interface / "device", ec);
+  if (!ec)
+  {
+    owners.push_back(device.filename().string());
+  }
+
+  std::vector<int> irqs;
+  std::ifstream interrupts{"/proc/interrupts"};
+  for (std::string line;  std::getline(interrupts, line);  /**/)
+  {
+    std::istringstream iss{line};
+    std::string irq, action;
+    iss >> irq;
+    if (irq.empty() || irq.back() != ':' || !std::isdigit(irq.front()))
+    {
+      continue;
+    }
+    for (std::string token;  iss >> token;  /**/)
+    {
+      action = token;
+    }
+    for (auto &owner: owners)
+    {
+      if (is_rx_irq_name(action, owner))
+      {
+        irqs.push_back(std::stoi(irq));
+        break;
+      }
+    }
+  }
+  return irqs;
+}
+
+
+std::vector<rx_queue> rx_queues (const std::string &interface_filter)
+{
+  std::vector<rx_queue> result;
+
+  std::error_code ec;
+  std::vector<std::string> interfaces;
+  for (auto &entry: fs::directory_iterator{"/sys/class/net", ec})
+  {
+    auto name = entry.path().filename().string();
+    if ((interface_filter.empty() && name != "lo") || name == interface_filter)
+    {
+      interfaces.push_back(name);
+    }
+  }
+  std::sort(interfaces.begin(), interfaces.end());
+
+  for (auto &interface: interfaces)
+  {
+    size_t queue_count = 0;
+    auto queues = fs::path{"/sys/class/net"} / interface / "queues";
+    for (auto &entry: fs::directory_iterator{queues, ec})
+    {
+      if (entry.path().filename().string().compare(0, 3, "rx-") == 0)
+      {
+        queue_count++;
+      }
+    }
+
+    auto irqs = interface_rx_irqs(interface);
+    for (size_t i = 0;  i < queue_count && i < irqs.size();  ++i)
+    {
+      result.push_back({
+        interface + " rx-" + std::to_string(i),
+        irqs[i],
+        irq_cpu(irqs[i])
+      });
+    }
+  }
+
+  return result;
+}
+
+
+} // namespace
+
+
+std::vector<thread_placement> make_thread_layout (const config &conf)
+{
+  std::vector<thread_placement> layout(conf.threads);
+
+  cpu_list allowed = conf.cpu.list;
+  if (conf.cpu.numa_node > -1)
+  {
+    auto node_cpus = numa_node_cpus(conf.cpu.numa_node);
+    if (allowed.empty())
+    {
+      allowed = node_cpus;
+    }
+    else
+    {
+      cpu_list intersection;
+      for (auto cpu: allowed)
+      {
+        if (std::find(node_cpus.begin(), node_cpus.end(), cpu) != node_cpus.end())
+        {
+          intersection.push_back(cpu);
+        }
+      }
+      if (intersection.empty())
+      {
+        throw std::runtime_error("cpu-list: no CPUs on NUMA node "
+          + std::to_string(conf.cpu.numa_node)
+        );
+      }
+      allowed.swap(intersection);
+    }
+  }
+
+  if (conf.cpu.irq_affinity)
+  {
+    auto queues = rx_queues(conf.cpu.interface);
+    if (!allowed.empty())
+    {
+      // prefer queues handled by allowed CPUs (NUMA-local)
+      queues.erase(
+        std::remove_if(queues.begin(), queues.end(),
+          [&](const rx_queue &q)
+          {
+            return std::find(allowed.begin(), allowed.end(), q.cpu) == allowed.end();
+          }
+        ),
+        queues.end()
+      );
+    }
+
+    if (!queues.empty())
+    {
+      for (size_t i = 0;  i != layout.size();  ++i)
+      {
+        auto &queue = queues[i % queues.size()];
+        layout[i].cpu = queue.cpu;
+        layout[i].reason = queue.name + ", irq " + std::to_string(queue.irq);
+      }
+      return layout;
+    }
+
+    std::cout << "cpu-list: no RX queue IRQs found, falling back\n";
+  }
+
+  for (size_t i = 0;  !allowed.empty() && i != layout.size();  ++i)
+  {
+    layout[i].cpu = allowed[i % allowed.size()];
+    layout[i].reason = conf.cpu.numa_node > -1
+      ? "numa " + std::to_string(conf.cpu.numa_node)
+      : "cpu-list";
+  }
+
+  return layout;
+}
+
+
+bool pin_this_thread (int cpu) noexcept
+{
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+
+#else // {{{1
+
+
+std::vector<thread_placement> make_thread_layout (const config &conf)
+{
+  std::vector<thread_placement> layout(conf.threads);
+  if (conf.cpu.irq_affinity || conf.cpu.numa_node > -1)
+  {
+    std::cout << "cpu-list: auto/numa placement requires Linux\n";
+  }
+  else if (urn::is_windows_build)
+  {
+    for (size_t i = 0;  !conf.cpu.list.empty() && i != layout.size();  ++i)
+    {
+      layout[i].cpu = conf.cpu.list[i % conf.cpu.list.size()];
+      layout[i].reason = "cpu-list";
+    }
+  }
+  else if (!conf.cpu.list.empty())
+  {
+    std::cout << "cpu-list: thread pinning not supported\n";
+  }
+  return layout;
+}
+
+
+bool pin_this_thread (int cpu) noexcept
+{
+  #if __urn_os_windows
+    return cpu < 64 && SetThreadAffinityMask(GetCurrentThread(), 1ull << cpu) != 0;
+  #else
+    (void)cpu;
+    return false;
+  #endif
+}
+
+
+#endif // }}}1
+
+
+void print_thread_layout (std::ostream &os,
+  const std::vector<thread_placement> &layout)
+{
+  for (size_t i = 0;  i != layout.size();  ++i)
+  {
+    if (layout[i].cpu > -1)
+    {
+      os
+        << "thread " << i
+        << ": cpu " << layout[i].cpu
+        << " (" << layout[i].reason << ")\n";
+    }
+  }
+}
+
+
+} // namespace urn_libuv
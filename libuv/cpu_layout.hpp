@@ -0,0 +1,65 @@
+#pragma once
+
+/**
+ * \file libuv/cpu_layout.hpp
+ * I/O thread CPU placement
+ *
+ * Threads can be pinned using:
+ *  - explicit CPU list (--cpu-list 0-3,8)
+ *  - CPUs of NUMA node (--numa 1), combined with explicit list as intersection
+ *  - RX queue IRQ affinity (--cpu-list auto [--interface eth0]): thread N is
+ *    placed on CPU that handles interrupts of RX queue N (Linux only)
+ */
+
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+
+namespace urn_libuv {
+
+
+struct config;
+
+
+using cpu_list = std::vector<int>;
+
+
+/**
+ * Parse comma-separated list of CPU numbers or ranges ("0-3,8,10-11").
+ * Throws std::runtime_error on invalid input.
+ */
+cpu_list parse_cpu_list (const std::string &list);
+
+
+struct thread_placement
+{
+  // -1 if not pinned
+  int cpu = -1;
+
+  // human-readable explanation of choice (for startup report)
+  std::string reason{};
+};
+
+
+/**
+ * Return per I/O thread placement according to \a conf. On unsupported
+ * platforms or missing system information, threads are left unpinned.
+ */
+std::vector<thread_placement> make_thread_layout (const config &conf);
+
+
+/**
+ * Print startup report of \a layout
+ */
+void print_thread_layout (std::ostream &os,
+  const std::vector<thread_placement> &layout);
+
+
+/**
+ * Pin calling thread to \a cpu. Returns false if not supported or failed.
+ */
+bool pin_this_thread (int cpu) noexcept;
+
+
+} // namespace urn_libuv
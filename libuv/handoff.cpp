@@ -0,0 +1,240 @@
+#include <libuv/handoff.hpp>
+#include <urn/__bits/lib.hpp>
+#include <uv.h>
+#include <algorithm>
+#include <cstring>
+
+#if !__urn_os_windows
+  #include <sys/socket.h>
+  #include <sys/un.h>
+  #include <unistd.h>
+  #include <cerrno>
+#endif
+
+
+namespace urn_libuv {
+
+
+#if !__urn_os_windows // {{{1
+
+
+namespace {
+
+
+// descriptors per SCM_RIGHTS message (kernel limit is 253)
+constexpr size_t sockets_per_message = 64;
+
+
+} // namespace
+
+
+handoff_channel::~handoff_channel () noexcept
+{
+  if (fd_ != -1)
+  {
+    ::close(fd_);
+  }
+}
+
+
+int handoff_channel::connect (const std::string &path) noexcept
+{
+  sockaddr_un addr{};
+  if (path.size() >= sizeof(addr.sun_path))
+  {
+    return UV_ENAMETOOLONG;
+  }
+  addr.sun_family = AF_UNIX;
+  std::memcpy(addr.sun_path, path.c_str(), path.size());
+
+  fd_ = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd_ == -1)
+  {
+    return -errno;
+  }
+  if (::connect(fd_, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) == -1)
+  {
+    auto status = -errno;
+    ::close(fd_);
+    fd_ = -1;
+    return status;
+  }
+  return 0;
+}
+
+
+int handoff_channel::send_sockets (const header &h, const std::vector<int> &sockets)
+  noexcept
+{
+  if (auto status = send(&h, sizeof(h)))
+  {
+    return status;
+  }
+
+  // each message is 4-byte descriptor count with descriptors attached,
+  // receiver reads exactly that many bytes to keep ancillary data aligned
+  for (size_t first = 0;  first < sockets.size();  first += sockets_per_message)
+  {
+    auto count = static_cast<uint32_t>(
+      (std::min)(sockets_per_message, sockets.size() - first)
+    );
+
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * sockets_per_message)]{};
+    iovec iov{&count, sizeof(count)};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+
+    auto cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+    std::memcpy(CMSG_DATA(cmsg), sockets.data() + first, sizeof(int) * count);
+
+    if (::sendmsg(fd_, &msg, MSG_NOSIGNAL) != sizeof(count))
+    {
+      return -errno;
+    }
+  }
+  return 0;
+}
+
+
+int handoff_channel::recv_sockets (header &h, std::vector<int> &sockets) noexcept
+{
+  if (auto status = recv(&h, sizeof(h)))
+  {
+    return status;
+  }
+  if (h.magic != header{}.magic || h.version != header{}.version)
+  {
+    return UV_EPROTO;
+  }
+
+  const size_t total = size_t{h.threads} * h.sockets_per_thread;
+  while (sockets.size() < total)
+  {
+    uint32_t count{};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * sockets_per_message)]{};
+    iovec iov{&count, sizeof(count)};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    auto size = ::recvmsg(fd_, &msg, 0);
+    if (size == 0)
+    {
+      return UV_EOF;
+    }
+    else if (size != sizeof(count))
+    {
+      return size == -1 ? -errno : UV_EPROTO;
+    }
+
+    auto cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg
+      || cmsg->cmsg_level != SOL_SOCKET
+      || cmsg->cmsg_type != SCM_RIGHTS
+      || cmsg->cmsg_len != CMSG_LEN(sizeof(int) * count))
+    {
+      return UV_EPROTO;
+    }
+
+    auto first = sockets.size();
+    sockets.resize(first + count);
+    std::memcpy(sockets.data() + first, CMSG_DATA(cmsg), sizeof(int) * count);
+  }
+  return 0;
+}
+
+
+int handoff_channel::send (const void *data, size_t size) noexcept
+{
+  auto p = static_cast<const char *>(data);
+  while (size)
+  {
+    auto sent = ::send(fd_, p, size, MSG_NOSIGNAL);
+    if (sent == -1)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      return -errno;
+    }
+    p += sent;
+    size -= sent;
+  }
+  return 0;
+}
+
+
+int handoff_channel::recv (void *data, size_t size) noexcept
+{
+  auto p = static_cast<char *>(data);
+  while (size)
+  {
+    auto received = ::recv(fd_, p, size, 0);
+    if (received == 0)
+    {
+      return UV_EOF;
+    }
+    else if (received == -1)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      return -errno;
+    }
+    p += received;
+    size -= received;
+  }
+  return 0;
+}
+
+
+#else // }}}1 {{{1
+
+
+handoff_channel::~handoff_channel () noexcept = default;
+
+
+int handoff_channel::connect (const std::string &) noexcept
+{
+  return UV_ENOTSUP;
+}
+
+
+int handoff_channel::send_sockets (const header &, const std::vector<int> &) noexcept
+{
+  return UV_ENOTSUP;
+}
+
+
+int handoff_channel::recv_sockets (header &, std::vector<int> &) noexcept
+{
+  return UV_ENOTSUP;
+}
+
+
+int handoff_channel::send (const void *, size_t) noexcept
+{
+  return UV_ENOTSUP;
+}
+
+
+int handoff_channel::recv (void *, size_t) noexcept
+{
+  return UV_ENOTSUP;
+}
+
+
+#endif // }}}1
+
+
+} // namespace urn_libuv
@@ -0,0 +1,99 @@
+#pragma once
+
+/**
+ * \file libuv/handoff.hpp
+ * Hot upgrade (--handoff <path>)
+ *
+ * Running relay listens on UNIX socket \a path. New process started with
+ * same flag connects to it before binding its own listeners and receives:
+ *  1. header: thread count and listener sockets per thread
+ *  2. bound listener sockets of each thread (SCM_RIGHTS), client listeners
+ *     first, in thread order
+ *  3. session stream: batches of (id, client socket index, client endpoint)
+ *     records, terminated by empty batch
+ *
+ * New process binds nothing itself: it refuses sockets whose family or port
+ * differs from listener it would bind at same index (i.e. other --family,
+ * --client.port or --peer.port), and skips records whose socket index or
+ * endpoint family doesn't fit its client listeners.
+ *
+ * Old process stops receiving once sockets are sent, streams sessions and
+ * exits after its in-flight sends are flushed. New process takes sockets
+ * over with their queued packets, i.e. nothing is dropped unless receive
+ * buffers overflow while stream is in progress. POSIX only.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+namespace urn_libuv {
+
+
+class handoff_channel
+{
+public:
+
+  struct header
+  {
+    uint64_t magic = 0x6666'6f68'2d6e'7275; // "urn-hoff"
+    uint32_t version = 1;
+    uint32_t threads = 0;
+    uint32_t sockets_per_thread = 0;
+    uint32_t endpoint_size = 0;
+  };
+
+
+  // not connected
+  handoff_channel () noexcept = default;
+
+  // takes ownership of connected UNIX stream socket \a fd
+  explicit handoff_channel (int fd) noexcept
+    : fd_{fd}
+  { }
+
+  ~handoff_channel () noexcept;
+
+  handoff_channel (const handoff_channel &) = delete;
+  handoff_channel &operator= (const handoff_channel &) = delete;
+
+
+  /**
+   * Connect to process listening on \a path. Returns 0 on success or libuv
+   * error code (UV_ENOENT or UV_ECONNREFUSED if nobody is listening).
+   */
+  int connect (const std::string &path) noexcept;
+
+
+  /**
+   * Send \a h and \a sockets (h.threads * h.sockets_per_thread descriptors).
+   * Descriptors stay open in sender. Returns 0 or libuv error code.
+   */
+  int send_sockets (const header &h, const std::vector<int> &sockets) noexcept;
+
+
+  /**
+   * Receive header and sockets sent by send_sockets(). Returns 0 or libuv
+   * error code (UV_EPROTO on version mismatch). On error, \a sockets holds
+   * descriptors received so far (caller closes them).
+   */
+  int recv_sockets (header &h, std::vector<int> &sockets) noexcept;
+
+
+  /**
+   * Blocking send/receive of exactly \a size bytes. Returns 0 or libuv error
+   * code (UV_EOF if peer closed channel).
+   */
+  int send (const void *data, size_t size) noexcept;
+  int recv (void *data, size_t size) noexcept;
+
+
+private:
+
+  int fd_ = -1;
+};
+
+
+} // namespace urn_libuv
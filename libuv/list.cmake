@@ -26,8 +26,16 @@ list(APPEND urn_experiments libuv)
 
 list(APPEND urn_libuv_sources
   libuv/main.cpp
+  libuv/cpu_layout.hpp
+  libuv/cpu_layout.cpp
+  libuv/handoff.hpp
+  libuv/handoff.cpp
   libuv/relay.hpp
   libuv/relay.cpp
+  libuv/reuseport_steering.hpp
+  libuv/reuseport_steering.cpp
+  libuv/workers.hpp
+  libuv/workers.cpp
 )
 
 list(APPEND urn_libuv_libs ${libuv_LIBRARY})
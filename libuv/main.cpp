@@ -1,4 +1,10 @@
+#if __urn_alloc_tracking
+  #define __urn_alloc_tracking_operators
+  #include <urn/alloc_tracking.hpp>
+#endif
+
 #include <libuv/relay.hpp>
+#include <libuv/workers.hpp>
 #include <exception>
 #include <iostream>
 
@@ -8,6 +14,10 @@ int main (int argc, const char *argv[])
   try
   {
     urn_libuv::config config{argc, argv};
+    if (config.workers > 1)
+    {
+      return urn_libuv::run_workers(config);
+    }
     urn_libuv::relay relay{config};
     return relay.run();
   }
@@ -1,8 +1,38 @@
 #include <libuv/relay.hpp>
+#include <libuv/cpu_layout.hpp>
+#include <urn/alloc_tracking.hpp>
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <cstring>
 #include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <random>
 #include <string>
 #include <thread>
+#include <vector>
+
+#if __urn_os_linux
+  #include <linux/sock_diag.h>
+  #include <sys/socket.h>
+#endif
+
+#if __urn_os_macos
+  #include <mach/mach.h>
+#endif
+
+#if !__urn_os_windows
+  #include <fcntl.h>
+  #include <pthread.h>
+  #include <sys/mman.h>
+  #include <sys/socket.h>
+  #include <sys/stat.h>
+  #include <time.h>
+  #include <unistd.h>
+#endif
 
 
 namespace urn_libuv {
@@ -33,6 +63,71 @@ void parse_numeric_argument (const std::string &name,
 }
 
 
+void parse_port_range_argument (const std::string &name,
+  const std::string &value,
+  config::port_range &result)
+{
+  // <port> or <first>-<last>
+  auto dash = value.find('-');
+  parse_numeric_argument(name, value.substr(0, dash), result.first);
+  result.last = result.first;
+  if (dash != value.npos)
+  {
+    parse_numeric_argument(name, value.substr(dash + 1), result.last);
+  }
+  if (result.last < result.first)
+  {
+    throw std::runtime_error(name + ": invalid range (" + value + ')');
+  }
+}
+
+
+std::ostream &operator<< (std::ostream &os, const config::port_range &range)
+{
+  os << range.first;
+  if (range.last != range.first)
+  {
+    os << '-' << range.last;
+  }
+  return os;
+}
+
+
+void parse_address_family_argument (const std::string &name,
+  const std::string &value,
+  config::address_family &result)
+{
+  if (value == "ip4")
+  {
+    result = config::address_family::ip4;
+  }
+  else if (value == "ip6")
+  {
+    result = config::address_family::ip6;
+  }
+  else if (value == "dual")
+  {
+    result = config::address_family::dual;
+  }
+  else
+  {
+    throw std::runtime_error(name + ": invalid argument (" + value + ')');
+  }
+}
+
+
+const char *to_string (config::address_family family) noexcept
+{
+  switch (family)
+  {
+    case config::address_family::ip4: return "ip4";
+    case config::address_family::ip6: return "ip6";
+    case config::address_family::dual: return "dual";
+  }
+  return "?";
+}
+
+
 } // namespace
 
 
@@ -48,11 +143,115 @@ config::config (int argc, const char *argv[])
     }
     else if (args[i] == "--client.port")
     {
-      parse_numeric_argument("client.port", args.at(++i), client.port);
+      parse_port_range_argument("client.port", args.at(++i), client.port);
     }
     else if (args[i] == "--peer.port")
     {
-      parse_numeric_argument("peer.port", args.at(++i), peer.port);
+      parse_port_range_argument("peer.port", args.at(++i), peer.port);
+    }
+    else if (args[i] == "--family")
+    {
+      parse_address_family_argument("family", args.at(++i), family);
+    }
+    else if (args[i] == "--cpu-list")
+    {
+      auto &value = args.at(++i);
+      cpu.irq_affinity = (value == "auto");
+      cpu.list = cpu.irq_affinity ? std::vector<int>{} : parse_cpu_list(value);
+    }
+    else if (args[i] == "--interface")
+    {
+      cpu.interface = args.at(++i);
+    }
+    else if (args[i] == "--busy-poll")
+    {
+      uint32_t usec{};
+      parse_numeric_argument("busy-poll", args.at(++i), usec);
+      busy_poll = std::chrono::microseconds{usec};
+    }
+    else if (args[i] == "--trace")
+    {
+      trace = true;
+    }
+    else if (args[i] == "--session.rate")
+    {
+      parse_numeric_argument("session.rate", args.at(++i), session_limit.rate);
+    }
+    else if (args[i] == "--session.burst")
+    {
+      parse_numeric_argument("session.burst", args.at(++i), session_limit.burst);
+    }
+    else if (args[i] == "--registration.rate")
+    {
+      parse_numeric_argument("registration.rate",
+        args.at(++i),
+        registration_limit.rate
+      );
+    }
+    else if (args[i] == "--session.budget")
+    {
+      parse_numeric_argument("session.budget", args.at(++i), session_budget.count);
+    }
+    else if (args[i] == "--session.memory")
+    {
+      parse_numeric_argument("session.memory", args.at(++i), session_budget.memory);
+    }
+    else if (args[i] == "--session.store")
+    {
+      session_store = args.at(++i);
+    }
+    else if (args[i] == "--fan-out")
+    {
+      parse_numeric_argument("fan-out", args.at(++i), fan_out);
+      if (!fan_out || fan_out > max_fan_out)
+      {
+        throw std::runtime_error("fan-out: out of range (" + args[i] + ')');
+      }
+    }
+    else if (args[i] == "--channel-data")
+    {
+      parse_numeric_argument("channel-data", args.at(++i), channel_data);
+    }
+    else if (args[i] == "--session.connect")
+    {
+      parse_numeric_argument("session.connect", args.at(++i), session_connect);
+    }
+    else if (args[i] == "--socket.recv-buffer")
+    {
+      parse_numeric_argument("socket.recv-buffer", args.at(++i), socket_buffer.recv);
+    }
+    else if (args[i] == "--socket.send-buffer")
+    {
+      parse_numeric_argument("socket.send-buffer", args.at(++i), socket_buffer.send);
+    }
+    else if (args[i] == "--max-threads")
+    {
+      parse_numeric_argument("max-threads", args.at(++i), max_threads);
+    }
+    else if (args[i] == "--rebalance")
+    {
+      rebalance = true;
+    }
+    else if (args[i] == "--handoff")
+    {
+      handoff = args.at(++i);
+    }
+    else if (args[i] == "--workers")
+    {
+      parse_numeric_argument("workers", args.at(++i), workers);
+    }
+    else if (args[i] == "--max-sessions")
+    {
+      parse_numeric_argument("max-sessions",
+        args.at(++i),
+        registration_limit.max_sessions
+      );
+    }
+    else if (args[i] == "--numa")
+    {
+      uint16_t node{};
+      parse_numeric_argument("numa", args.at(++i), node);
+      cpu.numa_node = node;
     }
     else
     {
@@ -64,18 +263,112 @@ config::config (int argc, const char *argv[])
   {
     threads = 1;
   }
+  max_threads = (std::max)(max_threads, threads);
+
+  if (!workers)
+  {
+    workers = 1;
+  }
+  else if (workers > 1 && (rebalance || !handoff.empty()))
+  {
+    // both act on reuseport group as owned by single process
+    throw std::runtime_error("workers: not supported with rebalance or handoff");
+  }
 
   std::cout
     << "threads = " << threads
     << "\nclient.port = " << client.port
     << "\npeer.port = " << peer.port
+    << "\nfamily = " << to_string(family)
     << '\n';
+
+  if (cpu.irq_affinity)
+  {
+    std::cout
+      << "cpu-list = auto"
+      << (cpu.interface.empty() ? "" : " (" + cpu.interface + ')')
+      << '\n';
+  }
+  if (cpu.numa_node > -1)
+  {
+    std::cout << "numa = " << cpu.numa_node << '\n';
+  }
+  if (busy_poll.count())
+  {
+    std::cout << "busy-poll = " << busy_poll.count() << "us\n";
+  }
+  if (session_limit.rate)
+  {
+    if (!session_limit.burst)
+    {
+      session_limit.burst = (std::max)(session_limit.rate / 10, 64u * 1024);
+    }
+    std::cout
+      << "session.rate = " << session_limit.rate << "B/s"
+      << "\nsession.burst = " << session_limit.burst << "B\n";
+  }
+  if (registration_limit.rate)
+  {
+    std::cout << "registration.rate = " << registration_limit.rate << "/s\n";
+  }
+  if (fan_out > 1)
+  {
+    std::cout << "fan-out = " << fan_out << '\n';
+  }
+  if (session_connect)
+  {
+    std::cout << "session.connect = " << session_connect << "pps\n";
+  }
+  if (channel_data)
+  {
+    std::cout << "channel-data = " << channel_data << '\n';
+  }
+  if (max_threads > threads)
+  {
+    std::cout << "max-threads = " << max_threads << '\n';
+  }
+  if (rebalance)
+  {
+    std::cout << "rebalance = on\n";
+  }
+  if (!handoff.empty())
+  {
+    std::cout << "handoff = " << handoff << '\n';
+  }
+  if (workers > 1)
+  {
+    std::cout << "workers = " << workers << '\n';
+  }
+  if (socket_buffer.recv)
+  {
+    std::cout << "socket.recv-buffer = " << socket_buffer.recv << "B\n";
+  }
+  if (socket_buffer.send)
+  {
+    std::cout << "socket.send-buffer = " << socket_buffer.send << "B\n";
+  }
+  if (!session_store.empty())
+  {
+    std::cout << "session.store = " << session_store << '\n';
+  }
+  if (registration_limit.max_sessions)
+  {
+    std::cout << "max-sessions = " << registration_limit.max_sessions << '\n';
+  }
+  if (trace)
+  {
+    std::cout << "trace = on (dump with signal " << trace_dump_signal << ")\n";
+  }
 }
 
 
 namespace {
 
 
+struct io_buf_pool;
+
+
+// Header followed by runtime-sized send request chunks and data
 struct io_buf
 {
   urn::intrusive_stack_hook<io_buf> next{};
@@ -86,326 +379,2346 @@ struct io_buf
     {
       uv_udp_send_t request{};
       libuv::packet packet{};
-      libuv::session *session{};
+      libuv::session *session{};  // null for client to peer send
     } send{};
   };
-  std::array<chunk, have_mmsg ? 32 : 1> chunks{};
+
+  io_buf_pool &pool;
+
+  // send per fanned out endpoint of each packet held in data
+  const size_t chunk_count;
+  const size_t data_size;
   size_t ref_count{};
 
-  static constexpr size_t data_size = have_mmsg ? 2 * 64 * 1024 : 64 * 1024;
-  char data[data_size];
+  io_buf (io_buf_pool &pool, size_t chunk_count, size_t data_size) noexcept
+    : pool{pool}
+    , chunk_count{chunk_count}
+    , data_size{data_size}
+  { }
+
+  io_buf (const io_buf &) = delete;
+  io_buf &operator= (const io_buf &) = delete;
+
+  chunk *chunks () noexcept
+  {
+    return reinterpret_cast<chunk *>(this + 1);
+  }
+
+  char *data () noexcept
+  {
+    return reinterpret_cast<char *>(chunks() + chunk_count);
+  }
+
+  static size_t memory_size (size_t chunk_count, size_t data_size) noexcept
+  {
+    return sizeof(io_buf) + chunk_count * sizeof(chunk) + data_size;
+  }
+
+  size_t memory_size () const noexcept
+  {
+    return memory_size(chunk_count, data_size);
+  }
+
+  void release () noexcept;
 };
+static_assert(alignof(io_buf::chunk) <= alignof(io_buf));
+static_assert(sizeof(io_buf) % alignof(io_buf::chunk) == 0);
 
 
+// Buffers of single shape, resize() drops pooled buffers of previous shape
+// and outstanding ones are freed when released
 struct io_buf_pool
 {
   urn::intrusive_stack<&io_buf::next> pool{};
-  io_buf *last_alloc{};
+  size_t chunk_count{}, data_size{};
+
+  // bytes allocated (pooled and in use), written by owner thread only
+  std::atomic<size_t> allocated{};
+
+  io_buf_pool () = default;
+  io_buf_pool (const io_buf_pool &) = delete;
+  io_buf_pool &operator= (const io_buf_pool &) = delete;
+
+  ~io_buf_pool () noexcept
+  {
+    clear();
+  }
+
+  void resize (size_t new_chunk_count, size_t new_data_size) noexcept
+  {
+    if (chunk_count != new_chunk_count || data_size != new_data_size)
+    {
+      chunk_count = new_chunk_count;
+      data_size = new_data_size;
+      clear();
+    }
+  }
 
   io_buf *alloc () noexcept
   {
     auto b = pool.try_pop();
     if (!b)
     {
-      b = new io_buf;
-      if (!b)
+      auto size = io_buf::memory_size(chunk_count, data_size);
+      auto p = ::operator new(size, std::nothrow);
+      if (!p)
       {
         die_on_error(UV_ENOMEM, "io_buf_pool::alloc", __FILE__, __LINE__);
       }
+      b = new(p) io_buf{*this, chunk_count, data_size};
+      std::uninitialized_value_construct_n(b->chunks(), chunk_count);
+      allocated.fetch_add(size, std::memory_order_relaxed);
     }
     b->ref_count = 0;
-    last_alloc = b;
     return b;
   }
 
   void release (io_buf *b) noexcept
   {
-    pool.push(b);
+    if (b->chunk_count == chunk_count && b->data_size == data_size)
+    {
+      pool.push(b);
+    }
+    else
+    {
+      destroy(b);
+    }
+  }
+
+private:
+
+  void clear () noexcept
+  {
+    while (auto b = pool.try_pop())
+    {
+      destroy(b);
+    }
+  }
+
+  void destroy (io_buf *b) noexcept
+  {
+    allocated.fetch_sub(b->memory_size(), std::memory_order_relaxed);
+    b->~io_buf();
+    ::operator delete(b);
   }
 };
 
 
-struct thread
+void io_buf::release () noexcept
 {
-  const uint16_t id;
-  relay &owner;
-  uv_loop_t loop{};
-  uv_udp_t client{}, peer{};
-  io_buf_pool io_bufs{};
-  std::thread sys_thread{};
+  pool.release(this);
+}
 
-  thread (uint16_t id, relay &owner) noexcept
-    : id{id}
-    , owner{owner}
-  {}
 
-  ~thread ()
+// Receive buffers are sized for libuv: recvmmsg() reads each datagram into
+// 64KB slot (buffer smaller than that is not read at all), i.e. buffer with
+// batch slots. Holding it until sends complete would pin 64KB per small
+// packet, so packets that fit small_size are copied into small buffers and
+// only larger ones are sent from receive buffer.
+//
+// Packet sizes and receive batch fills are sampled per thread and every
+// retune_interval packets small_size is set to cover 99% of packets and
+// batch grows while batches keep filling up (shrinks to 90th percentile
+// otherwise).
+struct io_buf_sizing
+{
+  static constexpr size_t slot_size = 64 * 1024;
+  static constexpr size_t max_batch = have_mmsg ? 16 : 1;
+  static constexpr size_t retune_interval = 16 * 1024;
+  static constexpr std::array<size_t, 5> small_sizes{256, 512, 1024, 2048, 4096};
+
+  size_t small_size = 2048;
+  size_t batch = have_mmsg ? 2 : 1;
+
+  // last bucket: larger than any small size
+  std::array<uint32_t, small_sizes.size() + 1> packet_sizes{};
+  std::array<uint32_t, max_batch + 1> batch_fills{};
+  size_t packets{};
+
+  // returns true if packets since last call warrant retune()
+  bool on_packet (size_t size) noexcept
   {
-    if (sys_thread.joinable())
+    size_t bucket = 0;
+    while (bucket != small_sizes.size() && size > small_sizes[bucket])
     {
-      sys_thread.join();
+      bucket++;
     }
+    packet_sizes[bucket]++;
+    return ++packets == retune_interval;
   }
 
-  void start ();
+  void on_batch (size_t fill) noexcept
+  {
+    batch_fills[(std::min)(fill, max_batch)]++;
+  }
+
+  void retune () noexcept
+  {
+    size_t covered = 0, bucket = 0;
+    while (bucket != small_sizes.size() - 1)
+    {
+      covered += packet_sizes[bucket];
+      if (covered * 100 >= packets * 99)
+      {
+        break;
+      }
+      bucket++;
+    }
+    small_size = small_sizes[bucket];
+
+    size_t batches = 0;
+    for (auto fills: batch_fills)
+    {
+      batches += fills;
+    }
+    if (batch < max_batch && batch_fills[batch] * 4 >= batches)
+    {
+      batch = (std::min)(2 * batch, max_batch);
+    }
+    else
+    {
+      size_t fill = 0;
+      for (covered = 0;  fill != batch && covered * 10 < batches * 9;  )
+      {
+        covered += batch_fills[++fill];
+      }
+      while (fill * 2 <= batch && batch > 1)
+      {
+        batch /= 2;
+      }
+    }
+
+    packet_sizes.fill(0);
+    batch_fills.fill(0);
+    packets = 0;
+  }
 };
 
 
-thread_local thread *this_thread = nullptr;
+} // namespace
 
 
-sockaddr make_ip4_addr_any_with_port (uint16_t port)
+// Per-session connect()-ed socket bound to same local address as client
+// listener (SO_REUSEPORT). Kernel skips route lookup on send and delivers
+// client's packets to it instead of listener (received with same callback)
+struct connected_socket
 {
-  sockaddr a;
-  libuv_call(uv_ip4_addr, "0.0.0.0", port, (sockaddr_in *)&a);
-  return a;
-}
+  uv_udp_t handle{};
 
+  // listener index (libuv::session::client_socket) this socket shadows
+  const size_t client_socket;
 
-//
-// SO_REUSEADDR && (SO_REUSEPORT || SO_REUSEPORT_LB)
-// https://stackoverflow.com/questions/14388706/how-do-so-reuseaddr-and-so-reuseport-differ
-//
+  connected_socket (size_t client_socket) noexcept
+    : client_socket{client_socket}
+  { }
+};
 
 
-void enable_reuse_port (uv_udp_t &socket, uint16_t thread_id)
+struct thread
 {
-  (void)thread_id;
+  const uint16_t id;
+  relay &owner;
+  const int cpu;
+  uv_loop_t loop{};
 
-  uv_os_fd_t fd;
-  libuv_call(uv_fileno, reinterpret_cast<uv_handle_t *>(&socket), &fd);
+  // per address family, socket per port (IPv4 ports first)
+  // client is indexed by libuv::session::client_socket
+  std::vector<uv_udp_t> client{}, peer{};
 
-  #if defined(SO_REUSEPORT_LB)
+  // receive buffers (see io_buf_sizing) and small packet copies
+  io_buf_pool recv_bufs{}, small_bufs{};
+  io_buf_sizing io_buf_sizes{};
 
-    // XXX not tested
+  // last buffer allocated for receive and buffer holding packet currently
+  // being handled (its sends reference it)
+  io_buf *recv_buf{}, *packet_buf{};
+  bool recv_buf_holds_packet{};
 
-    int enable = 1;
-    die_on_error(
-      setsockopt(fd, SOL_SOCKET, SO_REUSEPORT_LB, &enable, sizeof(enable)),
-      "setsockopt",
-      __FILE__,
-      __LINE__
-    );
+  // received packets and buffer memory held by them, current sizing; written
+  // by I/O thread and collected by statistics tick
+  std::atomic<uint64_t> received_packets{}, received_buffer_bytes{};
+  std::atomic<size_t> small_size{}, batch{};
 
-  #elif defined(SO_REUSEPORT)
+  // urn_alloc_tracking: heap allocations by I/O thread since start, written
+  // by I/O thread and collected by statistics tick
+  std::atomic<uint64_t> allocations{};
+  uint64_t tick_allocations{};
 
-    int enable = 1;
-    die_on_error(
-      setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)),
-      "setsockopt",
-      __FILE__,
-      __LINE__
-    );
+  // listener kernel drops, loop idle and thread CPU time (ns) at last
+  // statistics tick (used by tick only)
+  uint64_t kernel_drops{}, idle_time{}, cpu_time{};
 
-  #elif __urn_os_windows
+  // --rebalance: peer packets received per steering bucket, written by I/O
+  // thread and collected by statistics tick
+  std::array<std::atomic<uint64_t>, reuseport_steering::bucket_count> bucket_packets{};
 
-    #if !defined(SIO_SET_PORT_SHARING_PER_PROC_SOCKET)
-      constexpr auto SIO_SET_PORT_SHARING_PER_PROC_SOCKET = _WSAIOW(IOC_VENDOR, 21);
-    #endif
+  // relay::drain_thread(): stop receiving, close sockets once their send
+  // queues are flushed and let loop exit
+  uv_async_t drain_async{};
+  uv_timer_t drain_timer{};
+  std::atomic<bool> recv_stopped{}, exited{};
 
-    DWORD bytes{};
-    auto rv = WSAIoctl(
-      reinterpret_cast<uv_os_sock_t>(fd),
-      SIO_SET_PORT_SHARING_PER_PROC_SOCKET,
-      &thread_id,
-      sizeof(thread_id),
-      nullptr,
-      0,
+  // --handoff: bound listeners taken over from previous process (client
+  // then peer, same order as created), new ones are bound if empty
+  std::vector<int> inherited_sockets{};
+
+  std::thread sys_thread{};
+
+  // completed receives and sends, busy-poll uses it to detect progress
+  size_t io_events{};
+
+  // hot-path event trace (--trace), null if disabled
+  std::unique_ptr<urn::flight_recorder<>> trace{};
+  uint32_t recv_batch{};
+
+  // time spent spinning without progress and blocked in poll (ns), written
+  // by I/O thread and collected by statistics tick
+  // sleep_start is non-zero while blocked, tick moves it forward to account
+  // ongoing sleep in current interval
+  std::atomic<uint64_t> spin_time{}, sleep_time{}, sleep_start{};
+
+  // --session.connect: sockets of sessions promoted by this thread.
+  // Session may be destroyed (evicted) on any thread, its socket is then
+  // queued here and closed by this thread on retire_async
+  std::atomic<size_t> connected_sessions{};
+  uv_async_t retire_async{};
+  std::mutex retired_mutex{};
+  std::vector<connected_socket *> retired{};
+
+  thread (uint16_t id, relay &owner, int cpu) noexcept
+    : id{id}
+    , owner{owner}
+    , cpu{cpu}
+  {}
+
+  thread (const thread &) = delete;
+  thread &operator= (const thread &) = delete;
+
+  ~thread ()
+  {
+    if (sys_thread.joinable())
+    {
+      sys_thread.join();
+    }
+  }
+
+  void start ();
+  void run_busy_poll ();
+  void drain () noexcept;
+  void close_when_flushed () noexcept;
+
+  void connect_session (libuv::session &session) noexcept;
+  void retire (connected_socket *socket) noexcept;
+  void close_retired () noexcept;
+
+  void record (urn::trace_event event, uint32_t value = 0) noexcept
+  {
+    if (trace)
+    {
+      trace->record(event, value);
+    }
+  }
+
+  void resize_io_bufs () noexcept
+  {
+    const auto fan_out = owner.config().fan_out;
+    recv_bufs.resize(io_buf_sizes.batch * fan_out,
+      io_buf_sizes.batch * io_buf_sizing::slot_size
+    );
+    small_bufs.resize(fan_out, io_buf_sizes.small_size);
+    small_size.store(io_buf_sizes.small_size, std::memory_order_relaxed);
+    batch.store(io_buf_sizes.batch, std::memory_order_relaxed);
+  }
+
+  // received packet, copied into small buffer if it fits
+  libuv::packet on_recv (const uv_buf_t &buf, size_t size) noexcept
+  {
+    io_events++;
+    recv_batch++;
+    if (io_buf_sizes.on_packet(size))
+    {
+      io_buf_sizes.retune();
+      resize_io_bufs();
+    }
+
+    if (size <= io_buf_sizes.small_size)
+    {
+      packet_buf = small_bufs.alloc();
+      std::memcpy(packet_buf->data(), buf.base, size);
+      received_buffer_bytes.fetch_add(packet_buf->memory_size(),
+        std::memory_order_relaxed
+      );
+      return {reinterpret_cast<const std::byte *>(packet_buf->data()), size};
+    }
+
+    packet_buf = recv_buf;
+    recv_buf_holds_packet = true;
+    return {buf, size};
+  }
+
+  void on_packet_done () noexcept
+  {
+    if (packet_buf != recv_buf && packet_buf->ref_count == 0)
+    {
+      packet_buf->release();
+    }
+    packet_buf = nullptr;
+  }
+
+  // receive buffer is kept until sends of packets it holds complete
+  void on_recv_done () noexcept
+  {
+    if (recv_batch)
+    {
+      io_buf_sizes.on_batch(recv_batch);
+      received_packets.fetch_add(recv_batch, std::memory_order_relaxed);
+      record(urn::trace_event::recv_batch, std::exchange(recv_batch, 0));
+      if constexpr (urn::alloc_tracking::enabled)
+      {
+        allocations.store(urn::alloc_tracking::this_thread.allocations,
+          std::memory_order_relaxed
+        );
+      }
+    }
+    if (std::exchange(recv_buf_holds_packet, false))
+    {
+      received_buffer_bytes.fetch_add(recv_buf->memory_size(),
+        std::memory_order_relaxed
+      );
+    }
+    if (recv_buf->ref_count == 0)
+    {
+      recv_buf->release();
+    }
+  }
+};
+
+
+namespace {
+
+
+thread_local thread *this_thread = nullptr;
+
+
+libuv::endpoint make_ip4_addr_any_with_port (uint16_t port)
+{
+  libuv::endpoint a{};
+  libuv_call(uv_ip4_addr, "0.0.0.0", port, &a.v4);
+  return a;
+}
+
+
+libuv::endpoint make_ip6_addr_any_with_port (uint16_t port)
+{
+  libuv::endpoint a{};
+  libuv_call(uv_ip6_addr, "::", port, &a.v6);
+  return a;
+}
+
+
+bool has_ip4 (config::address_family family) noexcept
+{
+  return family != config::address_family::ip6;
+}
+
+
+bool has_ip6 (config::address_family family) noexcept
+{
+  return family != config::address_family::ip4;
+}
+
+
+size_t listener_count (config::address_family family,
+  const config::port_range &ports) noexcept
+{
+  return (has_ip4(family) + has_ip6(family)) * ports.size();
+}
+
+
+//
+// SO_REUSEADDR && (SO_REUSEPORT || SO_REUSEPORT_LB)
+// https://stackoverflow.com/questions/14388706/how-do-so-reuseaddr-and-so-reuseport-differ
+//
+
+
+void enable_reuse_port (uv_udp_t &socket, uint16_t thread_id)
+{
+  (void)thread_id;
+
+  uv_os_fd_t fd;
+  libuv_call(uv_fileno, reinterpret_cast<uv_handle_t *>(&socket), &fd);
+
+  #if defined(SO_REUSEPORT_LB)
+
+    // XXX not tested
+
+    int enable = 1;
+    die_on_error(
+      setsockopt(fd, SOL_SOCKET, SO_REUSEPORT_LB, &enable, sizeof(enable)),
+      "setsockopt",
+      __FILE__,
+      __LINE__
+    );
+
+  #elif defined(SO_REUSEPORT)
+
+    int enable = 1;
+    die_on_error(
+      setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)),
+      "setsockopt",
+      __FILE__,
+      __LINE__
+    );
+
+  #elif __urn_os_windows
+
+    #if !defined(SIO_SET_PORT_SHARING_PER_PROC_SOCKET)
+      constexpr auto SIO_SET_PORT_SHARING_PER_PROC_SOCKET = _WSAIOW(IOC_VENDOR, 21);
+    #endif
+
+    DWORD bytes{};
+    auto rv = WSAIoctl(
+      reinterpret_cast<uv_os_sock_t>(fd),
+      SIO_SET_PORT_SHARING_PER_PROC_SOCKET,
+      &thread_id,
+      sizeof(thread_id),
+      nullptr,
+      0,
       &bytes,
       nullptr,
       nullptr
     );
     if (rv != NO_ERROR)
     {
-      throw std::system_error(
-        WSAGetLastError(),
-        std::system_category(),
-        "WSAIoctl(SIO_SET_PORT_SHARING_PER_PROC_SOCKET)"
-      );
+      throw std::system_error(
+        WSAGetLastError(),
+        std::system_category(),
+        "WSAIoctl(SIO_SET_PORT_SHARING_PER_PROC_SOCKET)"
+      );
+    }
+
+  #endif
+}
+
+
+//
+// With pinned threads, prefer reuseport socket whose thread runs on CPU that
+// received packet (Linux 6.2+, ignored by older kernels)
+//
+
+void set_incoming_cpu (uv_udp_t &socket, int cpu)
+{
+  #if defined(SO_INCOMING_CPU)
+
+    if (cpu < 0)
+    {
+      return;
+    }
+
+    uv_os_fd_t fd;
+    libuv_call(uv_fileno, reinterpret_cast<uv_handle_t *>(&socket), &fd);
+    die_on_error(
+      setsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu)),
+      "setsockopt",
+      __FILE__,
+      __LINE__
+    );
+
+  #else
+
+    (void)socket;
+    (void)cpu;
+
+  #endif
+}
+
+
+//
+// Busy-poll device queue from recv syscalls instead of waiting for interrupt
+// (Linux, raising above net.core.busy_read requires CAP_NET_ADMIN)
+//
+
+void set_busy_poll (uv_udp_t &socket, const std::chrono::microseconds &budget)
+{
+  #if defined(SO_BUSY_POLL)
+
+    if (budget.count() == 0)
+    {
+      return;
+    }
+
+    uv_os_fd_t fd;
+    libuv_call(uv_fileno, reinterpret_cast<uv_handle_t *>(&socket), &fd);
+
+    int usec = static_cast<int>(budget.count());
+    if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec)) == -1)
+    {
+      static bool once = (std::cout << "setsockopt(SO_BUSY_POLL) failed\n", true);
+      (void)once;
+    }
+
+    #if defined(SO_PREFER_BUSY_POLL)
+      int enable = 1;
+      (void)setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &enable, sizeof(enable));
+    #endif
+
+  #else
+
+    (void)socket;
+    (void)budget;
+
+  #endif
+}
+
+
+// CPU time consumed by thread (ns), CLOCK_THREAD_CPUTIME_ID of other thread
+uint64_t thread_cpu_time (std::thread &thread) noexcept
+{
+  #if __urn_os_windows
+
+    FILETIME creation, exit, kernel, user;
+    if (GetThreadTimes(thread.native_handle(), &creation, &exit, &kernel, &user))
+    {
+      auto to_ns = [](const FILETIME &time)
+      {
+        return ((uint64_t{time.dwHighDateTime} << 32) | time.dwLowDateTime) * 100;
+      };
+      return to_ns(kernel) + to_ns(user);
+    }
+
+  #elif __urn_os_macos
+
+    auto port = pthread_mach_thread_np(thread.native_handle());
+    thread_basic_info_data_t info;
+    mach_msg_type_number_t count = THREAD_BASIC_INFO_COUNT;
+    if (thread_info(port, THREAD_BASIC_INFO, reinterpret_cast<thread_info_t>(&info), &count) == KERN_SUCCESS)
+    {
+      auto to_ns = [](const time_value_t &time)
+      {
+        return uint64_t(time.seconds) * 1'000'000'000 + uint64_t(time.microseconds) * 1'000;
+      };
+      return to_ns(info.user_time) + to_ns(info.system_time);
+    }
+
+  #else
+
+    clockid_t clock;
+    timespec time;
+    if (pthread_getcpuclockid(thread.native_handle(), &clock) == 0
+      && clock_gettime(clock, &time) == 0)
+    {
+      return uint64_t(time.tv_sec) * 1'000'000'000 + time.tv_nsec;
+    }
+
+  #endif
+
+  return 0;
+}
+
+
+void set_socket_buffers (uv_udp_t &socket, const config &conf)
+{
+  auto handle = reinterpret_cast<uv_handle_t *>(&socket);
+  if (auto size = conf.socket_buffer.recv)
+  {
+    libuv_call(uv_recv_buffer_size, handle, &size);
+  }
+  if (auto size = conf.socket_buffer.send)
+  {
+    libuv_call(uv_send_buffer_size, handle, &size);
+  }
+}
+
+
+//
+// Kernel side of socket: packets dropped on full receive queue (same
+// counter SO_RXQ_OVFL reports per packet) and bytes queued for receive and
+// send, including kernel overhead (Linux)
+//
+
+struct socket_pressure
+{
+  uint64_t drops = 0, recv_queue = 0, send_queue = 0;
+
+  socket_pressure &operator+= (const socket_pressure &that) noexcept
+  {
+    drops += that.drops;
+    recv_queue += that.recv_queue;
+    send_queue += that.send_queue;
+    return *this;
+  }
+};
+
+
+socket_pressure get_socket_pressure (const uv_udp_t &socket) noexcept
+{
+  #if defined(SO_MEMINFO)
+
+    uv_os_fd_t fd;
+    if (uv_fileno(reinterpret_cast<const uv_handle_t *>(&socket), &fd) == 0)
+    {
+      uint32_t meminfo[SK_MEMINFO_VARS]{};
+      socklen_t size = sizeof(meminfo);
+      if (getsockopt(fd, SOL_SOCKET, SO_MEMINFO, meminfo, &size) == 0)
+      {
+        return {
+          meminfo[SK_MEMINFO_DROPS],
+          meminfo[SK_MEMINFO_RMEM_ALLOC],
+          meminfo[SK_MEMINFO_WMEM_ALLOC],
+        };
+      }
+    }
+
+  #else
+
+    (void)socket;
+
+  #endif
+
+  return {};
+}
+
+
+constexpr auto bind_flags =
+  urn::is_windows_build ?
+    uv_udp_flags{}
+  :
+    UV_UDP_REUSEADDR
+;
+
+
+void start_udp_listener (uv_loop_t &loop,
+  uv_udp_t &socket,
+  const libuv::endpoint &addr,
+  uv_udp_recv_cb cb,
+  const int *inherited) noexcept
+{
+  // inherited socket is already bound and in reuseport group, with its
+  // queued packets (handle must not create own socket)
+  const auto family = addr.addr.sa_family;
+  const auto udp_flags = (inherited ? AF_UNSPEC : family)
+    | (have_mmsg ? UV_UDP_RECVMMSG : 0);
+  libuv_call(uv_udp_init_ex, &loop, &socket, udp_flags);
+  if (inherited)
+  {
+    libuv_call(uv_udp_open, &socket, *inherited);
+  }
+
+  auto owner = static_cast<thread *>(loop.data);
+  enable_reuse_port(socket, owner->id);
+  set_incoming_cpu(socket, owner->cpu);
+  set_busy_poll(socket, owner->owner.config().busy_poll);
+  set_socket_buffers(socket, owner->owner.config());
+
+  if (!inherited)
+  {
+    // dual-stack uses separate IPv4 and IPv6 sockets instead of IPv4-mapped
+    // addresses, so IPv6 socket is always IPv6-only
+    libuv_call(uv_udp_bind, &socket,
+      &addr.addr,
+      bind_flags | (family == AF_INET6 ? UV_UDP_IPV6ONLY : 0)
+    );
+  }
+
+  libuv_call(uv_udp_recv_start, &socket, &relay::alloc_buffer, cb);
+}
+
+
+void start_udp_listeners (uv_loop_t &loop,
+  std::vector<uv_udp_t> &sockets,
+  config::address_family family,
+  const config::port_range &ports,
+  uv_udp_recv_cb cb,
+  const int *inherited) noexcept
+{
+  // sized once, libuv handles must not move after init
+  sockets.resize(listener_count(family, ports));
+  auto socket = sockets.begin();
+
+  if (has_ip4(family))
+  {
+    for (uint32_t port = ports.first;  port <= ports.last;  ++port)
+    {
+      start_udp_listener(loop, *socket++,
+        make_ip4_addr_any_with_port(static_cast<uint16_t>(port)),
+        cb,
+        inherited ? inherited++ : nullptr
+      );
+    }
+  }
+
+  if (has_ip6(family))
+  {
+    for (uint32_t port = ports.first;  port <= ports.last;  ++port)
+    {
+      start_udp_listener(loop, *socket++,
+        make_ip6_addr_any_with_port(static_cast<uint16_t>(port)),
+        cb,
+        inherited ? inherited++ : nullptr
+      );
+    }
+  }
+}
+
+
+void on_client_recv (uv_udp_t *handle,
+  ssize_t nread,
+  const uv_buf_t *buf,
+  const sockaddr *src,
+  unsigned flags) noexcept
+{
+  die_on_error((int)nread, "client: uv_udp_recv_start", __FILE__, __LINE__);
+
+  auto self = static_cast<thread *>(handle->loop->data);
+  if (nread > 0)
+  {
+    const size_t client_socket = handle->data
+      ? static_cast<connected_socket *>(handle->data)->client_socket
+      : handle - self->client.data();
+    self->owner.on_clock_tick(handle->loop);
+    auto packet = self->on_recv(*buf, static_cast<size_t>(nread));
+    self->owner.on_client_received(
+      *reinterpret_cast<const libuv::endpoint *>(src),
+      packet,
+      client_socket
+    );
+    self->on_packet_done();
+  }
+
+  // client data forwarded to peer keeps buffer until send completes
+  if (!(flags & UV_UDP_MMSG_CHUNK))
+  {
+    self->on_recv_done();
+  }
+}
+
+
+} // namespace
+
+
+void thread::start ()
+{
+  libuv_call(uv_loop_init, &loop);
+  libuv_call(uv_loop_configure, &loop, UV_METRICS_IDLE_TIME);
+  loop.data = this;
+
+  const auto &conf = owner.config();
+  resize_io_bufs();
+
+  const int *inherited = inherited_sockets.empty() ? nullptr : inherited_sockets.data();
+  start_udp_listeners(loop, client, conf.family, conf.client.port,
+    &on_client_recv,
+    inherited
+  );
+
+  libuv_call(uv_async_init, &loop, &drain_async,
+    [](uv_async_t *handle) noexcept
+    {
+      static_cast<thread *>(handle->loop->data)->drain();
+    }
+  );
+
+  if (conf.session_connect)
+  {
+    libuv_call(uv_async_init, &loop, &retire_async,
+      [](uv_async_t *handle) noexcept
+      {
+        static_cast<thread *>(handle->loop->data)->close_retired();
+      }
+    );
+  }
+
+  start_udp_listeners(loop, peer, conf.family, conf.peer.port,
+    [](uv_udp_t *handle,
+      ssize_t nread,
+      const uv_buf_t *buf,
+      const sockaddr *src,
+      unsigned flags) noexcept
+    {
+      die_on_error((int)nread, "peer: uv_udp_recv_start", __FILE__, __LINE__);
+
+      auto self = static_cast<thread *>(handle->loop->data);
+      if (nread > 0)
+      {
+        self->owner.on_clock_tick(handle->loop);
+        auto packet = self->on_recv(*buf, static_cast<size_t>(nread));
+        if (self->owner.config().rebalance)
+        {
+          self->bucket_packets[reuseport_steering::bucket(packet.data(), packet.size())]
+            .fetch_add(1, std::memory_order_relaxed);
+        }
+        auto packet_reused = self->owner.on_peer_received(
+          *reinterpret_cast<const libuv::endpoint *>(src),
+          packet,
+          self->client.size() + (handle - self->peer.data())
+        );
+        if (!packet_reused)
+        {
+          self->record(urn::trace_event::lookup_miss, packet.size());
+        }
+
+        // buffer is still referenced by asynchronous sends (fan-out may
+        // complete reused packet synchronously)
+        self->on_packet_done();
+      }
+
+      if (!(flags & UV_UDP_MMSG_CHUNK))
+      {
+        self->on_recv_done();
+      }
+    },
+    inherited ? inherited + client.size() : nullptr
+  );
+
+  sys_thread = std::thread(
+    [this]()
+    {
+      if (cpu > -1 && !pin_this_thread(cpu))
+      {
+        std::cout << "thread " << id << ": failed to pin to cpu " << cpu << '\n';
+      }
+      if (owner.config().trace)
+      {
+        trace = std::make_unique<urn::flight_recorder<>>();
+      }
+      this_thread = this;
+      this->owner.on_thread_start(id);
+      if (owner.config().busy_poll.count())
+      {
+        run_busy_poll();
+      }
+      else
+      {
+        uv_run(&loop, UV_RUN_DEFAULT);
+      }
+      libuv_call(uv_loop_close, &loop);
+      exited = true;
+      owner.on_thread_exit();
+    }
+  );
+}
+
+
+void thread::drain () noexcept
+{
+  for (auto *sockets: {&client, &peer})
+  {
+    for (auto &socket: *sockets)
+    {
+      libuv_call(uv_udp_recv_stop, &socket);
+    }
+  }
+  recv_stopped = true;
+
+  // closing socket would cancel its pending sends
+  libuv_call(uv_timer_init, &loop, &drain_timer);
+  libuv_call(uv_timer_start, &drain_timer,
+    [](uv_timer_t *timer) noexcept
+    {
+      static_cast<thread *>(timer->loop->data)->close_when_flushed();
+    },
+    0,
+    10
+  );
+}
+
+
+void thread::close_when_flushed () noexcept
+{
+  for (auto *sockets: {&client, &peer})
+  {
+    for (auto &socket: *sockets)
+    {
+      if (uv_udp_get_send_queue_count(&socket))
+      {
+        return;
+      }
+    }
+  }
+
+  for (auto *sockets: {&client, &peer})
+  {
+    for (auto &socket: *sockets)
+    {
+      uv_close(reinterpret_cast<uv_handle_t *>(&socket), nullptr);
+    }
+  }
+  uv_close(reinterpret_cast<uv_handle_t *>(&drain_timer), nullptr);
+  uv_close(reinterpret_cast<uv_handle_t *>(&drain_async), nullptr);
+}
+
+
+void thread::connect_session (libuv::session &session) noexcept
+{
+  const auto &dst = session.client_endpoint;
+  auto socket = new connected_socket{session.client_socket};
+  libuv_call(uv_udp_init_ex, &loop, &socket->handle, dst.addr.sa_family);
+  socket->handle.data = socket;
+  enable_reuse_port(socket->handle, id);
+  set_socket_buffers(socket->handle, owner.config());
+
+  // listener's local address keeps client seeing same relay endpoint
+  libuv::endpoint local{};
+  int local_size = sizeof(local);
+  libuv_call(uv_udp_getsockname, &client[session.client_socket],
+    &local.addr,
+    &local_size
+  );
+
+  auto status = uv_udp_bind(&socket->handle,
+    &local.addr,
+    bind_flags | (dst.addr.sa_family == AF_INET6 ? UV_UDP_IPV6ONLY : 0)
+  );
+  if (!status)
+  {
+    status = uv_udp_connect(&socket->handle, &dst.addr);
+  }
+  if (!status)
+  {
+    status = uv_udp_recv_start(&socket->handle,
+      &relay::alloc_buffer,
+      &on_client_recv
+    );
+  }
+  if (status)
+  {
+    // session stays on listener
+    std::cout << "thread " << id << ": session.connect: " << uv_strerror(status) << '\n';
+    uv_close(reinterpret_cast<uv_handle_t *>(&socket->handle),
+      [](uv_handle_t *handle) noexcept
+      {
+        delete static_cast<connected_socket *>(handle->data);
+      }
+    );
+    return;
+  }
+
+  session.connected = socket;
+  connected_sessions.fetch_add(1, std::memory_order_relaxed);
+}
+
+
+void thread::retire (connected_socket *socket) noexcept
+{
+  {
+    std::lock_guard lock{retired_mutex};
+    retired.push_back(socket);
+  }
+  uv_async_send(&retire_async);
+}
+
+
+void thread::close_retired () noexcept
+{
+  std::vector<connected_socket *> sockets;
+  {
+    std::lock_guard lock{retired_mutex};
+    sockets.swap(retired);
+  }
+
+  // sessions are evicted only without sends in flight, so close cancels
+  // nothing but receive
+  for (auto socket: sockets)
+  {
+    uv_close(reinterpret_cast<uv_handle_t *>(&socket->handle),
+      [](uv_handle_t *handle) noexcept
+      {
+        delete static_cast<connected_socket *>(handle->data);
+      }
+    );
+  }
+  connected_sessions.fetch_sub(sockets.size(), std::memory_order_relaxed);
+}
+
+
+void thread::run_busy_poll ()
+{
+  // Spin with UV_RUN_NOWAIT while I/O keeps arriving. After spin window
+  // without progress, block in UV_RUN_ONCE. Window adapts to observed gaps:
+  // if blocking wait was shorter than budget, spinning would have caught it
+  // (grow window), otherwise spinning is wasted CPU (shrink window).
+  const uint64_t budget = std::chrono::nanoseconds{owner.config().busy_poll}.count();
+  const uint64_t min_window = budget / 16;
+  uint64_t window = budget;
+
+  auto idle_since = uv_hrtime();
+  for (;;)
+  {
+    auto events = io_events;
+    auto start = uv_hrtime();
+    if (!uv_run(&loop, UV_RUN_NOWAIT))
+    {
+      return;
+    }
+    auto now = uv_hrtime();
+
+    if (io_events != events)
+    {
+      idle_since = now;
+      continue;
+    }
+    spin_time.fetch_add(now - start, std::memory_order_relaxed);
+
+    if (now - idle_since < window)
+    {
+      continue;
+    }
+
+    sleep_start.store(now, std::memory_order_relaxed);
+    uv_run(&loop, UV_RUN_ONCE);
+    idle_since = uv_hrtime();
+
+    auto slept = idle_since - now;
+    sleep_time.fetch_add(
+      idle_since - sleep_start.exchange(0, std::memory_order_relaxed),
+      std::memory_order_relaxed
+    );
+    if (slept < budget)
+    {
+      window = (std::min)(budget, 2 * window);
+    }
+    else
+    {
+      window = (std::max)(min_window, window / 2);
+    }
+  }
+}
+
+
+relay::~relay () noexcept = default;
+
+
+relay::relay (const urn_libuv::config &conf,
+    session_store_type *shared_sessions) noexcept
+  : config_{conf}
+  , alloc_address_{
+      has_ip4(config_.family)
+        ? make_ip4_addr_any_with_port(config_.client.port.first)
+        : make_ip6_addr_any_with_port(config_.client.port.first)
+    }
+  , logic_{
+      config_.max_threads,
+      client_,
+      peer_,
+      listener_count(config_.family, config_.client.port)
+        + listener_count(config_.family, config_.peer.port)
+    }
+{
+  logic_.set_session_rate_limit(config_.session_limit.rate,
+    config_.session_limit.burst
+  );
+  logic_.set_registration_limit(config_.registration_limit.rate,
+    config_.registration_limit.max_sessions
+  );
+  logic_.set_fan_out(config_.fan_out);
+  logic_.set_channel_data(config_.channel_data);
+
+  auto budget = config_.session_budget.count;
+  if (config_.session_budget.memory)
+  {
+    auto by_memory = config_.session_budget.memory / logic_.session_memory_size();
+    budget = budget ? (std::min)(budget, by_memory) : by_memory;
+    if (!budget)
+    {
+      budget = 1;
+    }
+  }
+  if (budget)
+  {
+    std::cout
+      << "session.budget = " << budget
+      << " (" << logic_.session_memory_size() << "B/session)\n";
+    logic_.set_session_budget(budget);
+  }
+
+  if (shared_sessions)
+  {
+    // --workers: mapped by parent process
+    logic_.set_session_store(shared_sessions);
+  }
+  else if (!config_.session_store.empty())
+  {
+    session_store_ = map_session_store(config_,
+      budget ? budget : config_.registration_limit.max_sessions
+    );
+    if (session_store_)
+    {
+      logic_.set_session_store(&*session_store_);
+    }
+  }
+}
+
+
+std::optional<session_store_type> map_session_store (const config &conf,
+  size_t sessions) noexcept
+{
+  const auto &path = conf.session_store;
+
+  // client socket layout (see start_udp_listeners()) record indexes refer to
+  const auto tag = (uint64_t{static_cast<uint32_t>(conf.family)} << 32)
+    | (uint64_t{conf.client.port.first} << 16)
+    | conf.client.port.last;
+
+  // sessions are bounded only by budget or cap, otherwise guess; at half
+  // load probe sequences stay short
+  if (!sessions)
+  {
+    sessions = 1 << 20;
+  }
+  size_t capacity = 1;
+  while (capacity < 2 * sessions)
+  {
+    capacity *= 2;
+  }
+
+#if __urn_os_windows
+
+  (void)path;
+  (void)tag;
+  (void)capacity;
+  std::cout << "session.store: not supported, sessions are not kept\n";
+  return {};
+
+#else
+
+  auto fail = [&path](const char *fn)
+  {
+    std::cout
+      << "session.store: " << fn << ": " << (path.empty() ? "(shared)" : path) << ": "
+      << uv_strerror(uv_translate_sys_error(errno))
+      << ", sessions are not kept\n";
+  };
+
+  std::random_device seed;
+  auto size = session_store_type::memory_size(capacity);
+
+  if (path.empty())
+  {
+    // inherited by forked workers
+    auto memory = ::mmap(nullptr, size,
+      PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_ANONYMOUS,
+      -1,
+      0
+    );
+    if (memory == MAP_FAILED)
+    {
+      fail("mmap");
+      return {};
+    }
+    return session_store_type::create(memory,
+      capacity,
+      (uint64_t{seed()} << 32) | seed(),
+      tag
+    );
+  }
+
+  auto fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0600);
+  if (fd == -1)
+  {
+    fail("open");
+    return {};
+  }
+
+  // existing file: attach as is (O(1), slots are paged in on lookup)
+  struct stat st{};
+  if (::fstat(fd, &st) == 0 && st.st_size > 0)
+  {
+    auto file_size = static_cast<size_t>(st.st_size);
+    auto memory = ::mmap(nullptr, file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (memory != MAP_FAILED)
+    {
+      try
+      {
+        auto store = session_store_type::open(memory, file_size, tag);
+        ::close(fd);
+        std::cout
+          << "session.store: restored "
+          << store.size() << '/' << store.capacity()
+          << " sessions\n";
+        return store;
+      }
+      catch (const std::exception &e)
+      {
+        std::cout << e.what() << ", recreating " << path << '\n';
+      }
+      ::munmap(memory, file_size);
+    }
+  }
+
+  // new or incompatible: truncating zero-fills
+  if (::ftruncate(fd, 0) == -1 || ::ftruncate(fd, size) == -1)
+  {
+    fail("ftruncate");
+    ::close(fd);
+    return {};
+  }
+  auto memory = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (memory == MAP_FAILED)
+  {
+    fail("mmap");
+    ::close(fd);
+    return {};
+  }
+  ::close(fd);
+
+  std::cout << "session.store: created " << capacity << " sessions\n";
+  return session_store_type::create(memory,
+    capacity,
+    (uint64_t{seed()} << 32) | seed(),
+    tag
+  );
+
+#endif
+}
+
+
+int relay::run () noexcept
+{
+  auto loop = uv_default_loop();
+  loop->data = this;
+
+  uv_timer_t statistics_timer;
+  libuv_call(uv_timer_init, loop, &statistics_timer);
+  statistics_timer.data = this;
+  libuv_call(uv_timer_start, &statistics_timer,
+    [](uv_timer_t *timer)
+    {
+      static_cast<relay *>(timer->data)->on_statistics_tick();
+    },
+    0,
+    std::chrono::milliseconds{config_.statistics_print_interval}.count()
+  );
+
+  uv_signal_t trace_signal;
+  if (config_.trace)
+  {
+    libuv_call(uv_signal_init, loop, &trace_signal);
+    trace_signal.data = this;
+    libuv_call(uv_signal_start, &trace_signal,
+      [](uv_signal_t *signal, int)
+      {
+        static_cast<relay *>(signal->data)->on_trace_signal();
+      },
+      trace_dump_signal
+    );
+  }
+
+  // placement of threads that may be added later is reported upfront
+  auto layout_config = config_;
+  layout_config.threads = config_.max_threads;
+  std::vector<thread_placement> layout;
+  try
+  {
+    layout = make_thread_layout(layout_config);
+  }
+  catch (const std::exception &e)
+  {
+    std::cout << e.what() << ", threads not pinned\n";
+    layout.assign(layout_config.threads, {});
+  }
+  print_thread_layout(std::cout, layout);
+  for (auto &placement: layout)
+  {
+    thread_cpus_.push_back(placement.cpu);
+  }
+
+  libuv_call(uv_async_init, loop, &thread_exit_,
+    [](uv_async_t *handle) noexcept
+    {
+      static_cast<relay *>(handle->loop->data)->join_drained_threads();
+    }
+  );
+
+  #if defined(SIGTTIN) && defined(SIGTTOU)
+
+    // grow/shrink thread pool (same signals as other pre-forking servers)
+    uv_signal_t add_signal, drain_signal;
+    if (config_.max_threads > 1)
+    {
+      libuv_call(uv_signal_init, loop, &add_signal);
+      libuv_call(uv_signal_start, &add_signal,
+        [](uv_signal_t *signal, int)
+        {
+          static_cast<relay *>(signal->loop->data)->add_thread();
+        },
+        SIGTTIN
+      );
+      libuv_call(uv_signal_init, loop, &drain_signal);
+      libuv_call(uv_signal_start, &drain_signal,
+        [](uv_signal_t *signal, int)
+        {
+          static_cast<relay *>(signal->loop->data)->drain_thread();
+        },
+        SIGTTOU
+      );
+    }
+
+  #endif
+
+  // --handoff: thread count follows previous process
+  auto thread_count = config_.handoff.empty() ? config_.threads : take_over();
+  const auto sockets_per_thread = inherited_sockets_.size() / thread_count;
+  for (uint16_t id = 0;  id < thread_count;  ++id)
+  {
+    threads_.emplace_back(std::make_unique<thread>(id, *this, thread_cpus_[id]));
+    if (sockets_per_thread)
+    {
+      auto first = inherited_sockets_.begin() + id * sockets_per_thread;
+      threads_.back()->inherited_sockets.assign(first, first + sockets_per_thread);
+    }
+    threads_.back()->start();
+  }
+  inherited_sockets_.clear();
+
+  if (config_.rebalance)
+  {
+    start_steering();
+  }
+  if (!config_.handoff.empty())
+  {
+    listen_for_handoff();
+  }
+
+  auto result = uv_run(loop, UV_RUN_DEFAULT);
+  return handed_off_ ? EXIT_SUCCESS : result;
+}
+
+
+#if !__urn_os_windows // {{{1
+
+
+namespace {
+
+
+// session id, client socket index and client endpoint
+constexpr size_t handoff_record_size =
+  2 * sizeof(uint64_t) + sizeof(libuv::endpoint);
+constexpr uint32_t handoff_batch_records = 64 * 1024 / handoff_record_size;
+
+
+// whether each taken over socket has family and port of listener that
+// start_udp_listeners() binds at its index (per thread: client listeners,
+// then peer listeners)
+bool is_listener_layout (const config &conf, const std::vector<int> &sockets)
+  noexcept
+{
+  std::vector<libuv::endpoint> layout;
+  for (auto *ports: {&conf.client.port, &conf.peer.port})
+  {
+    for (uint32_t port = ports->first;  has_ip4(conf.family) && port <= ports->last;  ++port)
+    {
+      layout.push_back(make_ip4_addr_any_with_port(static_cast<uint16_t>(port)));
+    }
+    for (uint32_t port = ports->first;  has_ip6(conf.family) && port <= ports->last;  ++port)
+    {
+      layout.push_back(make_ip6_addr_any_with_port(static_cast<uint16_t>(port)));
+    }
+  }
+
+  for (size_t i = 0;  i != sockets.size();  ++i)
+  {
+    const auto &expected = layout[i % layout.size()];
+    libuv::endpoint bound{};
+    socklen_t size = sizeof(bound);
+    if (::getsockname(sockets[i], &bound.addr, &size) == -1
+      || bound.addr.sa_family != expected.addr.sa_family
+      || (expected.addr.sa_family == AF_INET
+        ? bound.v4.sin_port != expected.v4.sin_port
+        : bound.v6.sin6_port != expected.v6.sin6_port))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+// family of client listener at \a index (IPv4 ports first)
+int client_socket_family (const config &conf, size_t index) noexcept
+{
+  return has_ip4(conf.family) && index < conf.client.port.size()
+    ? AF_INET
+    : AF_INET6;
+}
+
+
+} // namespace
+
+
+uint16_t relay::take_over () noexcept
+{
+  handoff_channel channel;
+  if (auto status = channel.connect(config_.handoff))
+  {
+    if (status != UV_ENOENT && status != UV_ECONNREFUSED)
+    {
+      std::cout << "handoff: " << uv_strerror(status) << '\n';
+    }
+    return config_.threads;
+  }
+
+  handoff_channel::header h;
+  std::vector<int> sockets;
+  auto status = channel.recv_sockets(h, sockets);
+  const auto sockets_per_thread =
+    listener_count(config_.family, config_.client.port)
+    + listener_count(config_.family, config_.peer.port);
+  if (!status
+    && (!h.threads
+      || h.sockets_per_thread != sockets_per_thread
+      || h.endpoint_size != sizeof(libuv::endpoint)
+      || !is_listener_layout(config_, sockets)))
+  {
+    status = UV_EPROTO;
+  }
+  if (status)
+  {
+    std::cout << "handoff: " << uv_strerror(status) << ", binding new listeners\n";
+    for (auto fd: sockets)
+    {
+      ::close(fd);
+    }
+    return config_.threads;
+  }
+
+  // reuseport groups are taken over as is (with their queued packets), i.e.
+  // thread count follows previous process (up to max-threads, per-thread
+  // state is sized by it)
+  auto threads = static_cast<uint16_t>(
+    (std::min)(h.threads, uint32_t{config_.max_threads})
+  );
+  if (threads < h.threads)
+  {
+    std::cout
+      << "handoff: previous process ran " << h.threads
+      << " threads, packets queued to threads above max-threads are lost\n";
+    for (auto i = threads * sockets_per_thread;  i < sockets.size();  ++i)
+    {
+      ::close(sockets[i]);
+    }
+    sockets.resize(threads * sockets_per_thread);
+  }
+  inherited_sockets_ = std::move(sockets);
+
+  // previous process stopped receiving before streaming: table is final.
+  // Sessions are registered as if received by thread 0
+  thread importer{0, *this, -1};
+  this_thread = &importer;
+  logic_.on_thread_start(0);
+  const auto client_sockets = listener_count(config_.family, config_.client.port);
+  size_t received = 0, imported = 0;
+  std::vector<std::byte> batch;
+  for (;;)
+  {
+    uint32_t count{};
+    if ((status = channel.recv(&count, sizeof(count))) || !count)
+    {
+      break;
+    }
+    batch.resize(count * handoff_record_size);
+    if ((status = channel.recv(batch.data(), batch.size())))
+    {
+      break;
+    }
+
+    for (auto record = batch.data();  record != batch.data() + batch.size();  )
+    {
+      uint64_t id, client_socket;
+      libuv::endpoint endpoint;
+      std::memcpy(&id, record, sizeof(id));
+      record += sizeof(id);
+      std::memcpy(&client_socket, record, sizeof(client_socket));
+      record += sizeof(client_socket);
+      std::memcpy(&endpoint, record, sizeof(endpoint));
+      record += sizeof(endpoint);
+
+      // replies to it would be sent from socket of other family
+      if (client_socket >= client_sockets
+        || endpoint.addr.sa_family != client_socket_family(config_, client_socket))
+      {
+        continue;
+      }
+      imported += logic_.import_session(id, endpoint, client_socket);
+    }
+    received += count;
+  }
+  this_thread = nullptr;
+
+  std::cout
+    << "handoff: took over " << threads << " threads, "
+    << imported << '/' << received << " sessions";
+  if (status)
+  {
+    std::cout << " (" << uv_strerror(status) << ')';
+  }
+  std::cout << '\n';
+  return threads;
+}
+
+
+void relay::listen_for_handoff () noexcept
+{
+  // left by previous (handed off or crashed) process
+  ::unlink(config_.handoff.c_str());
+
+  auto loop = uv_default_loop();
+  libuv_call(uv_pipe_init, loop, &handoff_listener_, 0);
+  auto listener = reinterpret_cast<uv_stream_t *>(&handoff_listener_);
+  auto status = uv_pipe_bind(&handoff_listener_, config_.handoff.c_str());
+  if (!status)
+  {
+    status = uv_listen(listener, 1,
+      [](uv_stream_t *listener, int status) noexcept
+      {
+        if (status < 0)
+        {
+          return;
+        }
+
+        // channel is used blocking, take descriptor out of loop
+        auto client = new uv_pipe_t{};
+        libuv_call(uv_pipe_init, listener->loop, client, 0);
+        uv_os_fd_t fd = -1;
+        if (!uv_accept(listener, reinterpret_cast<uv_stream_t *>(client)))
+        {
+          libuv_call(uv_fileno, reinterpret_cast<uv_handle_t *>(client), &fd);
+          fd = ::dup(fd);
+        }
+        uv_close(reinterpret_cast<uv_handle_t *>(client),
+          [](uv_handle_t *handle) noexcept
+          {
+            delete reinterpret_cast<uv_pipe_t *>(handle);
+          }
+        );
+        if (fd == -1)
+        {
+          return;
+        }
+
+        ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+        handoff_channel channel{fd};
+        static_cast<relay *>(listener->loop->data)->hand_off(channel);
+      }
+    );
+  }
+  if (status)
+  {
+    std::cout << "handoff: " << config_.handoff << ": " << uv_strerror(status) << '\n';
+  }
+}
+
+
+void relay::hand_off (handoff_channel &channel) noexcept
+{
+  if (config_.session_connect)
+  {
+    // sessions keep pointers to connected sockets owned by thread's loop
+    std::cout << "handoff: refused with session.connect\n";
+    return;
+  }
+
+  handoff_channel::header h;
+  h.threads = static_cast<uint32_t>(threads_.size());
+  h.sockets_per_thread = static_cast<uint32_t>(
+    threads_[0]->client.size() + threads_[0]->peer.size()
+  );
+  h.endpoint_size = sizeof(libuv::endpoint);
+
+  std::vector<int> sockets;
+  for (auto &thread: threads_)
+  {
+    for (auto *list: {&thread->client, &thread->peer})
+    {
+      for (auto &socket: *list)
+      {
+        uv_os_fd_t fd;
+        libuv_call(uv_fileno, reinterpret_cast<uv_handle_t *>(&socket), &fd);
+        sockets.push_back(fd);
+      }
+    }
+  }
+  if (auto status = channel.send_sockets(h, sockets))
+  {
+    std::cout << "handoff: " << uv_strerror(status) << ", still serving\n";
+    return;
+  }
+
+  // new process owns sockets: stop receiving, in-flight sends complete
+  // while sessions are streamed
+  handed_off_ = true;
+  uv_close(reinterpret_cast<uv_handle_t *>(&handoff_listener_), nullptr);
+  steering_.reset();
+  for (auto &thread: threads_)
+  {
+    uv_async_send(&thread->drain_async);
+    draining_.push_back(std::move(thread));
+  }
+  threads_.clear();
+  for (auto &thread: draining_)
+  {
+    while (!thread->recv_stopped)
+    {
+      std::this_thread::yield();
+    }
+  }
+
+  int status = 0;
+  size_t sent = 0;
+  uint32_t count = 0;
+  std::vector<std::byte> batch;
+  batch.reserve(handoff_batch_records * handoff_record_size);
+  auto flush = [&]()
+  {
+    if (!status)
+    {
+      status = channel.send(&count, sizeof(count));
+    }
+    if (!status)
+    {
+      status = channel.send(batch.data(), batch.size());
+    }
+    sent += count;
+    count = 0;
+    batch.clear();
+  };
+
+  logic_.for_each_session(
+    [&](uint64_t id, const libuv::session &session)
+    {
+      auto append = [&batch](const auto &field)
+      {
+        auto data = reinterpret_cast<const std::byte *>(&field);
+        batch.insert(batch.end(), data, data + sizeof(field));
+      };
+      append(id);
+      append(uint64_t{session.client_socket});
+      append(session.client_endpoint);
+      if (++count == handoff_batch_records)
+      {
+        flush();
+      }
+    }
+  );
+  if (count)
+  {
+    flush();
+  }
+  flush();
+
+  std::cout
+    << "handoff: sent " << sockets.size() << " sockets, " << sent << " sessions";
+  if (status)
+  {
+    std::cout << " (" << uv_strerror(status) << ')';
+  }
+  std::cout << ", draining\n";
+}
+
+
+#else // }}}1 {{{1
+
+
+uint16_t relay::take_over () noexcept
+{
+  std::cout << "handoff: not supported\n";
+  return config_.threads;
+}
+
+
+void relay::listen_for_handoff () noexcept
+{ }
+
+
+void relay::hand_off (handoff_channel &) noexcept
+{ }
+
+
+#endif // }}}1
+
+
+void relay::add_thread () noexcept
+{
+  if (threads_.size() == config_.max_threads)
+  {
+    std::cout << "threads: already at max-threads " << config_.max_threads << '\n';
+    return;
+  }
+
+  // id of last drained thread is reused: its per-thread slots in logic_
+  // (statistics, fan-out scratch) are free only after it exited
+  join_drained_threads();
+  auto id = static_cast<uint16_t>(threads_.size());
+  for (auto &thread: draining_)
+  {
+    if (thread->id == id)
+    {
+      std::cout << "threads: " << id << " still draining, try again later\n";
+      return;
     }
+  }
 
-  #endif
+  // new listeners join reuseport groups, kernel starts hashing flows to
+  // them immediately (sessions are shared, nothing to migrate)
+  threads_.emplace_back(std::make_unique<thread>(id, *this, thread_cpus_[id]));
+  threads_.back()->start();
+  std::cout << "threads: added " << id << " (" << threads_.size() << " running)\n";
+
+  if (steering_)
+  {
+    start_steering();
+  }
 }
 
 
-constexpr auto bind_flags =
-  urn::is_windows_build ?
-    uv_udp_flags{}
-  :
-    UV_UDP_REUSEADDR
-;
+void relay::drain_thread () noexcept
+{
+  if (threads_.size() == 1)
+  {
+    std::cout << "threads: can't drain last thread\n";
+    return;
+  }
+  if (config_.session_connect)
+  {
+    // sessions keep pointers to connected sockets owned by thread's loop
+    std::cout << "threads: can't drain with session.connect\n";
+    return;
+  }
+
+  // always last thread: leaving reuseport group moves last socket into
+  // freed slot, i.e. other threads keep their socket index (steering)
+  draining_.push_back(std::move(threads_.back()));
+  threads_.pop_back();
+  if (steering_)
+  {
+    start_steering();
+  }
 
+  auto &thread = *draining_.back();
+  uv_async_send(&thread.drain_async);
+  std::cout << "threads: draining " << thread.id << " (" << threads_.size() << " running)\n";
+}
 
-void start_udp_listener (uv_loop_t &loop,
-  uv_udp_t &socket,
-  uint16_t port,
-  uv_udp_recv_cb cb) noexcept
-{
-  constexpr auto udp_flags = AF_INET | (have_mmsg ? UV_UDP_RECVMMSG : 0);
-  libuv_call(uv_udp_init_ex, &loop, &socket, udp_flags);
 
-  enable_reuse_port(socket, static_cast<thread *>(loop.data)->id);
+void relay::join_drained_threads () noexcept
+{
+  // thread exit notifications may coalesce
+  for (auto it = draining_.begin();  it != draining_.end();  )
+  {
+    if (!(*it)->exited)
+    {
+      ++it;
+      continue;
+    }
+    std::cout << "threads: drained " << (*it)->id << '\n';
+    it = draining_.erase(it);
+  }
 
-  auto addr = make_ip4_addr_any_with_port(port);
+  if (handed_off_ && draining_.empty())
+  {
+    std::cout << "handoff: done\n";
+    uv_stop(uv_default_loop());
+  }
+}
 
-  libuv_call(uv_udp_bind, &socket,
-    reinterpret_cast<const sockaddr *>(&addr),
-    bind_flags
-  );
 
-  libuv_call(uv_udp_recv_start, &socket, &relay::alloc_buffer, cb);
+void relay::start_steering () noexcept
+{
+  // threads bind peer listeners in order, i.e. thread index is also index of
+  // its socket in each port's reuseport group
+  auto steering = std::make_unique<reuseport_steering>(threads_.size());
+  for (auto &socket: threads_[0]->peer)
+  {
+    if (auto status = steering->attach(socket))
+    {
+      std::cout << "rebalance: " << uv_strerror(status) << ", not steering\n";
+      return;
+    }
+  }
+  steering_ = std::move(steering);
 }
 
 
-void thread::start ()
+void relay::rebalance () noexcept
 {
-  libuv_call(uv_loop_init, &loop);
-  loop.data = this;
+  reuseport_steering::bucket_loads loads{};
+  for (auto &thread: threads_)
+  {
+    for (size_t b = 0;  b != loads.size();  ++b)
+    {
+      loads[b] += thread->bucket_packets[b].exchange(0, std::memory_order_relaxed);
+    }
+  }
 
-  start_udp_listener(loop, client, owner.config().client.port,
-    [](uv_udp_t *handle,
-      ssize_t nread,
-      const uv_buf_t *buf,
-      const sockaddr *src,
-      unsigned flags) noexcept
+  auto moved = steering_->rebalance(loads);
+  if (!moved)
+  {
+    return;
+  }
+
+  for (auto &socket: threads_[0]->peer)
+  {
+    if (auto status = steering_->attach(socket))
+    {
+      std::cout << "rebalance: " << uv_strerror(status) << '\n';
+      return;
+    }
+  }
+
+  std::string buckets;
+  for (size_t thread = 0;  thread != threads_.size();  ++thread)
+  {
+    size_t count = 0;
+    for (size_t b = 0;  b != loads.size();  ++b)
     {
-      die_on_error((int)nread, "client: uv_udp_recv_start", __FILE__, __LINE__);
+      count += steering_->thread_of(b) == thread;
+    }
+    buckets += std::to_string(count) + '/';
+  }
+  buckets.pop_back();
+  std::cout << "rebalance: moved " << moved << " buckets | buckets " << buckets << '\n';
+}
 
-      auto self = static_cast<thread *>(handle->loop->data);
-      if (nread > 0)
+
+void relay::on_statistics_tick () noexcept
+{
+  logic_.print_statistics(config_.statistics_print_interval);
+  if (threads_.empty())
+  {
+    // handed off
+    return;
+  }
+  if (steering_)
+  {
+    rebalance();
+  }
+
+  if constexpr (urn::is_linux_build)
+  {
+    // connected sockets are owned (and closed) by I/O threads, only
+    // listeners are sampled
+    std::string drops, recv_queue, send_queue;
+    for (auto &thread: threads_)
+    {
+      socket_pressure pressure;
+      for (auto &socket: thread->client)
       {
-        libuv::packet packet{*buf, static_cast<size_t>(nread)};
-        self->owner.on_client_received(*src, packet);
+        pressure += get_socket_pressure(socket);
       }
-
-      if (flags & UV_UDP_MMSG_CHUNK)
+      for (auto &socket: thread->peer)
       {
-        return;
+        pressure += get_socket_pressure(socket);
       }
-
-      self->io_bufs.release(self->io_bufs.last_alloc);
+      drops += std::to_string(pressure.drops - thread->kernel_drops) + '/';
+      recv_queue += std::to_string(pressure.recv_queue / 1024) + '/';
+      send_queue += std::to_string(pressure.send_queue / 1024) + '/';
+      thread->kernel_drops = pressure.drops;
     }
-  );
+    if (!drops.empty())
+    {
+      drops.pop_back();
+      recv_queue.pop_back();
+      send_queue.pop_back();
+    }
+    std::cout
+      << "kernel: drops " << drops
+      << " | queue in " << recv_queue << "KB"
+      << " | out " << send_queue << "KB\n";
+  }
 
-  start_udp_listener(loop, peer, owner.config().peer.port,
-    [](uv_udp_t *handle,
-      ssize_t nread,
-      const uv_buf_t *buf,
-      const sockaddr *src,
-      unsigned flags) noexcept
+  if (config_.busy_poll.count())
+  {
+    std::string spin, sleep;
+    const double interval = std::chrono::nanoseconds{config_.statistics_print_interval}.count();
+    for (auto &thread: threads_)
     {
-      die_on_error((int)nread, "peer: uv_udp_recv_start", __FILE__, __LINE__);
+      auto spin_time = thread->spin_time.exchange(0, std::memory_order_relaxed);
+      auto sleep_time = thread->sleep_time.exchange(0, std::memory_order_relaxed);
 
-      auto self = static_cast<thread *>(handle->loop->data);
-      bool packet_reused = false;
-      if (nread > 0)
+      auto now = uv_hrtime();
+      auto since = thread->sleep_start.load(std::memory_order_relaxed);
+      if (since && thread->sleep_start.compare_exchange_strong(since, now))
       {
-        libuv::packet packet{*buf, static_cast<size_t>(nread)};
-        packet_reused = self->owner.on_peer_received(*src, packet);
+        sleep_time += now - since;
       }
+      spin += std::to_string(static_cast<int>(spin_time * 100 / interval)) + "%/";
+      sleep += std::to_string(static_cast<int>(sleep_time * 100 / interval)) + "%/";
+    }
+    if (!spin.empty())
+    {
+      spin.pop_back();
+      sleep.pop_back();
+    }
+    std::cout << "busy-poll: spin " << spin << " | sleep " << sleep << '\n';
+  }
 
-      if (packet_reused || (flags & UV_UDP_MMSG_CHUNK))
-      {
-        return;
-      }
+  // loop utilization (time not blocked in poll, i.e. busy-poll spinning is
+  // busy), thread CPU time and received packets per CPU second
+  uint64_t packets = 0;
+  std::string allocations;
+  {
+    const double interval = std::chrono::nanoseconds{config_.statistics_print_interval}.count();
+    std::string busy, cpu, rate;
+    for (auto &thread: threads_)
+    {
+      auto thread_packets = thread->received_packets.exchange(0, std::memory_order_relaxed);
+      packets += thread_packets;
 
-      if (self->io_bufs.last_alloc->ref_count == 0)
+      if constexpr (urn::alloc_tracking::enabled)
       {
-        self->io_bufs.release(self->io_bufs.last_alloc);
+        auto total = thread->allocations.load(std::memory_order_relaxed);
+        auto count = total - std::exchange(thread->tick_allocations, total);
+        allocations += std::to_string(count) + " ("
+          + std::to_string(thread_packets ? count * 1000 / thread_packets : 0)
+          + ")/";
       }
+
+      auto idle_time = uv_metrics_idle_time(&thread->loop);
+      auto idle = idle_time - std::exchange(thread->idle_time, idle_time);
+      auto cpu_time = thread_cpu_time(thread->sys_thread);
+      auto used = cpu_time - std::exchange(thread->cpu_time, cpu_time);
+
+      busy += std::to_string((std::max)(0, 100 - static_cast<int>(idle * 100 / interval))) + "%/";
+      cpu += std::to_string(static_cast<int>(used * 100 / interval)) + "%/";
+      rate += std::to_string(used ? thread_packets * 1'000'000'000 / used : 0) + '/';
     }
-  );
+    if (!busy.empty())
+    {
+      busy.pop_back();
+      cpu.pop_back();
+      rate.pop_back();
+    }
+    std::cout
+      << "threads: busy " << busy
+      << " | cpu " << cpu
+      << " | " << rate << " packets/cpu-s\n";
+  }
 
-  sys_thread = std::thread(
-    [this]()
+  // heap allocations per thread (per 1000 received packets): steady state
+  // peer/client paths are expected at 0, registrations allocate
+  if (!allocations.empty())
+  {
+    allocations.pop_back();
+    std::cout << "heap: allocs " << allocations << '\n';
+  }
+
+  // buffer memory held per received packet: small buffer if copied or
+  // receive buffer shared by its packets
+  uint64_t buffer_bytes = 0;
+  size_t allocated = 0;
+  std::string small, batch;
+  for (auto &thread: threads_)
+  {
+    buffer_bytes += thread->received_buffer_bytes.exchange(0, std::memory_order_relaxed);
+    allocated += thread->recv_bufs.allocated.load(std::memory_order_relaxed)
+      + thread->small_bufs.allocated.load(std::memory_order_relaxed);
+    small += std::to_string(thread->small_size.load(std::memory_order_relaxed)) + '/';
+    batch += std::to_string(thread->batch.load(std::memory_order_relaxed)) + '/';
+  }
+  if (!small.empty())
+  {
+    small.pop_back();
+    batch.pop_back();
+  }
+  std::cout
+    << "io_buf: " << (packets ? buffer_bytes / packets : 0) << "B/packet"
+    << " | small " << small
+    << " | batch " << batch
+    << " | " << allocated / 1024 << "KB\n";
+
+  if (config_.session_connect)
+  {
+    size_t connected = 0;
+    for (auto &thread: threads_)
     {
-      this_thread = this;
-      this->owner.on_thread_start(id);
-      uv_run(&loop, UV_RUN_DEFAULT);
+      connected += thread->connected_sessions.load(std::memory_order_relaxed);
     }
-  );
+    std::cout << "session.connect: " << connected << " connected\n";
+  }
 }
 
 
-} // namespace
+void relay::on_trace_signal () noexcept
+{
+  static size_t dump_count = 0;
+  auto path = "urn-trace-"
+    + std::to_string(uv_os_getpid())
+    + '-'
+    + std::to_string(dump_count++)
+    + ".json";
+
+  std::ofstream file{path};
+  urn::chrome_trace_writer writer{file, trace_calibration_};
+  for (auto &thread: threads_)
+  {
+    if (thread->trace)
+    {
+      writer.write(thread->id, *thread->trace);
+    }
+  }
+  writer.finish();
 
+  std::cout << "trace: " << path << (file ? "" : " (failed)") << '\n';
+}
 
-relay::relay (const urn_libuv::config &conf) noexcept
-  : config_{conf}
-  , alloc_address_{make_ip4_addr_any_with_port(config_.client.port)}
-  , logic_{config_.threads, client_, peer_}
-{ }
 
+void relay::alloc_buffer (uv_handle_t *, size_t, uv_buf_t *buf) noexcept
+{
+  auto &thread = *this_thread;
+  thread.record(urn::trace_event::buffer_alloc, thread.recv_bufs.pool.empty());
+  thread.recv_buf = thread.recv_bufs.alloc();
+  buf->base = thread.recv_buf->data();
+  buf->len = thread.recv_buf->data_size;
+}
 
-int relay::run () noexcept
+
+uint64_t libuv::address_key (const endpoint &src) noexcept
 {
-  auto loop = uv_default_loop();
-  loop->data = this;
+  // IPv4: address, IPv6: /64 prefix (usually single host or subscriber)
+  if (src.addr.sa_family == AF_INET)
+  {
+    return src.v4.sin_addr.s_addr;
+  }
+  uint64_t prefix;
+  std::memcpy(&prefix, &src.v6.sin6_addr, sizeof(prefix));
+  return prefix;
+}
 
-  uv_timer_t statistics_timer;
-  libuv_call(uv_timer_init, loop, &statistics_timer);
-  statistics_timer.data = this;
-  libuv_call(uv_timer_start, &statistics_timer,
-    [](uv_timer_t *timer)
-    {
-      static_cast<relay *>(timer->data)->on_statistics_tick();
-    },
-    0,
-    std::chrono::milliseconds{config_.statistics_print_interval}.count()
+
+bool libuv::endpoint::operator== (const endpoint &that) const noexcept
+{
+  if (addr.sa_family != that.addr.sa_family)
+  {
+    return false;
+  }
+  if (addr.sa_family == AF_INET)
+  {
+    return v4.sin_port == that.v4.sin_port
+      && v4.sin_addr.s_addr == that.v4.sin_addr.s_addr;
+  }
+  return v6.sin6_port == that.v6.sin6_port
+    && std::memcmp(&v6.sin6_addr, &that.v6.sin6_addr, sizeof(v6.sin6_addr)) == 0;
+}
+
+
+size_t libuv::endpoint_hash (const endpoint &endpoint, uint64_t seed) noexcept
+{
+  if (endpoint.addr.sa_family == AF_INET)
+  {
+    return static_cast<size_t>(urn::mix(
+      (uint64_t{endpoint.v4.sin_addr.s_addr} << 16) | endpoint.v4.sin_port,
+      seed
+    ));
+  }
+
+  // address halves chained through mix(): folding them first would let
+  // client pick colliding interface ids within its own prefix
+  uint64_t half[2];
+  std::memcpy(half, &endpoint.v6.sin6_addr, sizeof(half));
+  return static_cast<size_t>(
+    urn::mix(urn::mix(half[0] ^ endpoint.v6.sin6_port, seed) ^ half[1], seed)
   );
+}
+
+
+void libuv::peer::start_send (const endpoint &dst,
+  const libuv::packet &packet,
+  size_t port_index) noexcept
+{
+  auto &thread = *this_thread;
+  auto buf = thread.packet_buf;
 
-  std::deque<thread> threads;
-  for (uint16_t id = 0;  id < config_.threads;  ++id)
+  if (buf->ref_count == buf->chunk_count)
   {
-    threads.emplace_back(id, *this).start();
+    die_on_error(UV_ENOBUFS, "peer: start_send", __FILE__, __LINE__);
   }
 
-  return uv_run(loop, UV_RUN_DEFAULT);
+  auto chunk = &buf->chunks()[buf->ref_count++];
+  chunk->send.request.data = buf;
+  chunk->send.packet = packet;
+  chunk->send.session = nullptr;
+
+  thread.record(urn::trace_event::send_submit, packet.size());
+
+  libuv_call(uv_udp_send, &chunk->send.request,
+    &thread.peer[port_index - thread.client.size()],
+    &chunk->send.packet, 1,
+    &dst.addr,
+    [](uv_udp_send_t *request, int status) noexcept
+    {
+      die_on_error(status, "peer: uv_udp_send", __FILE__, __LINE__);
+
+      auto chunk = reinterpret_cast<io_buf::chunk *>(request);
+      auto buf = reinterpret_cast<io_buf *>(chunk->send.request.data);
+      this_thread->io_events++;
+      this_thread->record(urn::trace_event::send_complete, status);
+      this_thread->owner.on_peer_sent(chunk->send.packet);
+
+      if (--buf->ref_count == 0)
+      {
+        buf->release();
+      }
+    }
+  );
 }
 
 
-void relay::alloc_buffer (uv_handle_t *, size_t, uv_buf_t *buf) noexcept
+libuv::session::session (const endpoint &client_endpoint,
+    size_t port_index) noexcept
+  : client_endpoint(client_endpoint)
+  , client_socket(port_index)
+{ }
+
+
+libuv::session::~session () noexcept
 {
-  auto b = this_thread->io_bufs.alloc();
-  buf->base = b->data;
-  buf->len = sizeof(b->data);
+  if (connected)
+  {
+    connected_owner.load(std::memory_order_relaxed)->retire(connected);
+  }
 }
 
 
 void libuv::session::start_send (const libuv::packet &packet) noexcept
 {
   auto &thread = *this_thread;
-  auto buf = thread.io_bufs.last_alloc;
+  auto buf = thread.packet_buf;
+
+  // connected socket needs no destination (nor route lookup)
+  auto socket = &thread.client[client_socket];
+  auto dst = &client_endpoint.addr;
+  if (auto owner = connected_owner.load(std::memory_order_relaxed))
+  {
+    if (owner == &thread && connected)
+    {
+      socket = &connected->handle;
+      dst = nullptr;
+    }
+  }
+  else if (auto threshold = thread.owner.config().session_connect)
+  {
+    // approximate: concurrent senders may lose window resets or counts
+    auto now = static_cast<uint32_t>(uv_now(&thread.loop));
+    auto window_start = rate_window_start.load(std::memory_order_relaxed);
+    if (now - window_start >= 1000)
+    {
+      rate_window_start.store(now, std::memory_order_relaxed);
+      rate_window_packets.store(0, std::memory_order_relaxed);
+    }
+    else if (rate_window_packets.fetch_add(1, std::memory_order_relaxed) + 1 == threshold)
+    {
+      urn_libuv::thread *expected = nullptr;
+      if (connected_owner.compare_exchange_strong(expected, &thread))
+      {
+        thread.connect_session(*this);
+      }
+    }
+  }
 
-  if (buf->ref_count == buf->chunks.size())
+  if (buf->ref_count == buf->chunk_count)
   {
     die_on_error(UV_ENOBUFS, "session: start_send", __FILE__, __LINE__);
   }
 
-  auto chunk = &buf->chunks[buf->ref_count++];
+  auto chunk = &buf->chunks()[buf->ref_count++];
   chunk->send.request.data = buf;
   chunk->send.packet = packet;
   chunk->send.session = this;
 
+  thread.record(urn::trace_event::send_submit, packet.size());
+
   libuv_call(uv_udp_send, &chunk->send.request,
-    &thread.client,
+    socket,
     &chunk->send.packet, 1,
-    &client_endpoint,
+    dst,
     [](uv_udp_send_t *request, int status) noexcept
     {
       die_on_error(status, "session: uv_udp_send", __FILE__, __LINE__);
 
       auto chunk = reinterpret_cast<io_buf::chunk *>(request);
       auto buf = reinterpret_cast<io_buf *>(chunk->send.request.data);
+      this_thread->io_events++;
+      this_thread->record(urn::trace_event::send_complete, status);
       this_thread->owner.on_session_sent(*chunk->send.session, chunk->send.packet);
 
       if (--buf->ref_count == 0)
       {
-        this_thread->io_bufs.release(buf);
+        buf->release();
       }
     }
   );
 }
 
 
+void libuv::session::start_fan_out (session *const sessions[],
+  size_t count,
+  const libuv::packet &packet) noexcept
+{
+  size_t sent = 0;
+  std::array<session *, max_fan_out> batch{};
+  size_t batch_size = 0;
+
+  #if __urn_os_linux
+
+    // libuv has no multi-destination send: members sharing first member's
+    // client socket get same payload with single sendmmsg() on its fd.
+    // Completes synchronously, i.e. io_buf is not referenced
+    auto &thread = *this_thread;
+    const auto socket = sessions[0]->client_socket;
+
+    iovec iov{packet.base, packet.len};
+    std::array<mmsghdr, max_fan_out> messages{};
+    for (size_t i = 0;  i != count && batch_size != batch.size();  ++i)
+    {
+      auto member = sessions[i];
+      if (member->client_socket != socket)
+      {
+        continue;
+      }
+      auto &hdr = messages[batch_size].msg_hdr;
+      hdr.msg_name = const_cast<sockaddr *>(&member->client_endpoint.addr);
+      hdr.msg_namelen = member->client_endpoint.addr.sa_family == AF_INET
+        ? sizeof(sockaddr_in)
+        : sizeof(sockaddr_in6)
+      ;
+      hdr.msg_iov = &iov;
+      hdr.msg_iovlen = 1;
+      batch[batch_size++] = member;
+    }
+
+    uv_os_fd_t fd;
+    libuv_call(uv_fileno,
+      reinterpret_cast<uv_handle_t *>(&thread.client[socket]),
+      &fd
+    );
+    thread.record(urn::trace_event::send_submit, packet.size());
+    auto result = sendmmsg(fd, messages.data(), batch_size, MSG_DONTWAIT);
+    sent = result > 0 ? static_cast<size_t>(result) : 0;
+
+    thread.io_events += sent;
+    for (size_t i = 0;  i != sent;  ++i)
+    {
+      thread.owner.on_session_sent(*batch[i], packet);
+    }
+
+  #endif
+
+  // not sent by sendmmsg (socket buffer full or different client socket):
+  // asynchronous send per member, sharing io_buf by reference
+  for (auto it = batch.begin() + sent;  it != batch.begin() + batch_size;  ++it)
+  {
+    (*it)->start_send(packet);
+  }
+  for (size_t i = 0;  i != count;  ++i)
+  {
+    auto member = sessions[i];
+    if (std::find(batch.begin(), batch.begin() + batch_size, member)
+      == batch.begin() + batch_size)
+    {
+      member->start_send(packet);
+    }
+  }
+}
+
+
 } // namespace urn_libuv
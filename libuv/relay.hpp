@@ -8,12 +8,21 @@
  *  - No maintenance invocations to relay
  */
 
+#include <libuv/handoff.hpp>
+#include <libuv/reuseport_steering.hpp>
+#include <urn/flight_recorder.hpp>
 #include <urn/intrusive_stack.hpp>
 #include <urn/relay.hpp>
 #include <uv.h>
+#include <atomic>
 #include <chrono>
+#include <csignal>
 #include <cstdlib>
 #include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
 
 
 //
@@ -32,6 +41,16 @@ namespace urn_libuv {
 
 constexpr bool have_mmsg = urn::is_linux_build;
 
+// max client endpoints per session (--fan-out), io_buf keeps send request
+// for each endpoint of each packet it holds
+constexpr size_t max_fan_out = 16;
+
+#if defined(SIGUSR2)
+  constexpr int trace_dump_signal = SIGUSR2;
+#else
+  constexpr int trace_dump_signal = SIGBREAK;
+#endif
+
 
 inline void die_on_error (int code, const char *fn, const char *file, int line)
 {
@@ -59,25 +78,146 @@ struct config //{{{1
 {
   static constexpr std::chrono::seconds statistics_print_interval{5};
 
+  struct port_range
+  {
+    uint16_t first, last;
+
+    size_t size () const noexcept
+    {
+      return last - first + 1u;
+    }
+  };
+
   struct
   {
-    uint16_t port = 3478;
+    port_range port{3478, 3478};
   } client{};
 
   struct
   {
-    uint16_t port = 3479;
+    port_range port{3479, 3479};
   } peer{};
 
+  enum class address_family
+  {
+    ip4,
+    ip6,
+    dual,
+  } family = address_family::ip4;
+
+  struct
+  {
+    // --cpu-list <list>: pin threads round-robin
+    std::vector<int> list{};
+
+    // --cpu-list auto: pin threads to CPUs handling RX queue IRQs
+    bool irq_affinity = false;
+
+    // --interface <name>: limit irq_affinity to single interface
+    std::string interface{};
+
+    // --numa <node>: pin threads to node CPUs (-1 = any)
+    int numa_node = -1;
+  } cpu{};
+
+  // --busy-poll <usec>: spin budget before blocking (0 = always block)
+  std::chrono::microseconds busy_poll{0};
+
+  // --trace: record hot-path events per thread, dump on trace_dump_signal
+  bool trace = false;
+
+  struct
+  {
+    // --session.rate <bytes/sec>: peer to client limit (0 = unlimited)
+    uint32_t rate = 0;
+
+    // --session.burst <bytes>: default rate/10, but at least 64KiB
+    uint32_t burst = 0;
+  } session_limit{};
+
+  struct
+  {
+    // --registration.rate <n>: per source address per second (0 = unlimited)
+    uint32_t rate = 0;
+
+    // --max-sessions <n>: global session cap (0 = unlimited)
+    size_t max_sessions = 0;
+  } registration_limit{};
+
+  struct
+  {
+    // --session.budget <n>: evict least recently used sessions above n
+    size_t count = 0;
+
+    // --session.memory <bytes>: same, as approximate memory budget
+    size_t memory = 0;
+  } session_budget{};
+
+  // --session.store <path>: keep sessions in memory-mapped file, restarted
+  // relay resumes forwarding them (POSIX, see map_session_store())
+  std::string session_store{};
+
+  // --fan-out <n>: client endpoints per session id (1 = no fan-out)
+  size_t fan_out = 1;
+
+  // --channel-data <n>: TURN ChannelData towards clients, max peers
+  // (channels) per session (0 = session id framing)
+  size_t channel_data = 0;
+
+  // --session.connect <pps>: send to client through connect()-ed socket
+  // once session's peer to client rate reaches pps (0 = never)
+  uint32_t session_connect = 0;
+
+  struct
+  {
+    // --socket.recv-buffer <bytes>: SO_RCVBUF (0 = system default)
+    int recv = 0;
+
+    // --socket.send-buffer <bytes>: SO_SNDBUF (0 = system default)
+    int send = 0;
+  } socket_buffer{};
+
+  // --rebalance: steer peer packets to threads by session id and move load
+  // between threads on sustained skew (Linux, see reuseport_steering)
+  bool rebalance = false;
+
+  // --handoff <path>: take listeners and sessions over from process
+  // listening on path and listen there for next one (POSIX, see
+  // handoff_channel)
+  std::string handoff{};
+
+  // --workers <n>: pre-fork n relay processes (each with own threads and
+  // reuseport listeners) sharing session store (POSIX, see run_workers())
+  uint16_t workers = 1;
+
   uint16_t threads;
 
+  // --max-threads <n>: I/O threads can be added up to n at runtime (default
+  // threads), see relay::add_thread() and relay::drain_thread()
+  uint16_t max_threads = 0;
+
   config (int argc, const char *argv[]);
 };
 
 
+struct thread;
+struct connected_socket;
+
+
 struct libuv //{{{1
 {
-  using endpoint = sockaddr;
+  union endpoint
+  {
+    sockaddr addr;
+    sockaddr_in v4;
+    sockaddr_in6 v6;
+
+    bool operator== (const endpoint &that) const noexcept;
+  };
+
+  static uint64_t address_key (const endpoint &src) noexcept;
+  static size_t endpoint_hash (const endpoint &endpoint, uint64_t seed) noexcept;
+
   struct packet;
   struct client;
   struct peer;
@@ -94,6 +234,14 @@ struct libuv::packet //{{{1
     : uv_buf_t(uv_buf_init(buf.base, (int)len))
   { }
 
+  // part of received buffer (relay may rewrite or strip headers)
+  packet (const std::byte *data, size_t len) noexcept
+    : uv_buf_t(uv_buf_init(
+        const_cast<char *>(reinterpret_cast<const char *>(data)),
+        (int)len
+      ))
+  { }
+
   const std::byte *data () const noexcept
   {
     return reinterpret_cast<const std::byte *>(uv_buf_t::base);
@@ -117,6 +265,13 @@ struct libuv::peer //{{{1
 {
   void start_receive () noexcept
   { }
+
+  // send from calling thread's peer socket that received session's peer
+  // packets (\a port_index as passed to relay::on_peer_received())
+  void start_send (const endpoint &dst,
+    const libuv::packet &packet,
+    size_t port_index
+  ) noexcept;
 };
 
 
@@ -124,19 +279,58 @@ struct libuv::session //{{{1
 {
   const endpoint client_endpoint;
 
-  session (const endpoint &client_endpoint) noexcept
-    : client_endpoint(client_endpoint)
-  { }
+  // index of per-thread client socket (address family and port) that
+  // received registration (port index passed to on_client_received(), kept
+  // in session store record), resolved once here to keep start_send() free
+  // of family checks
+  const size_t client_socket;
+
+  // --session.connect: thread that promoted session and its connected
+  // socket (only that thread sends through it, others use listener)
+  std::atomic<thread *> connected_owner{nullptr};
+  connected_socket *connected{};
+
+  // peer to client packets in current 1s window (promotion threshold)
+  std::atomic<uint32_t> rate_window_start{}, rate_window_packets{};
+
+  session (const endpoint &client_endpoint, size_t port_index) noexcept;
+  ~session () noexcept;
+
+  session (const session &) = delete;
+  session &operator= (const session &) = delete;
 
   void start_send (const libuv::packet &packet) noexcept;
+
+  static void start_fan_out (session *const sessions[], size_t count,
+    const libuv::packet &packet) noexcept;
 };
 
 
+using session_store_type = urn::relay<libuv, true>::session_store_type;
+
+
+/**
+ * Map session store sized for \a sessions sessions (0 = default) from file
+ * \a conf.session_store (attached if compatible, recreated otherwise) or
+ * anonymous shared memory if it is empty (inherited by forked workers).
+ * Records keep client socket index, so file created with other --family or
+ * --client.port is not compatible. Mapping is kept for process lifetime.
+ * Returns empty on failure (reason is printed).
+ */
+std::optional<session_store_type> map_session_store (const config &conf,
+  size_t sessions
+) noexcept;
+
+
 class relay //{{{1
 {
 public:
 
-  relay (const urn_libuv::config &conf) noexcept;
+  // \a shared_sessions: session store shared with other workers (--workers)
+  relay (const urn_libuv::config &conf,
+    session_store_type *shared_sessions = nullptr
+  ) noexcept;
+  ~relay () noexcept;
 
   int run () noexcept;
 
@@ -147,7 +341,7 @@ public:
   }
 
 
-  const sockaddr &alloc_address () const noexcept
+  const libuv::endpoint &alloc_address () const noexcept
   {
     return alloc_address_;
   }
@@ -159,15 +353,25 @@ public:
   }
 
 
-  void on_client_received (const libuv::endpoint &src, const libuv::packet &packet)
+  void on_clock_tick (uv_loop_t *loop) noexcept
+  {
+    logic_.on_clock_tick(std::chrono::milliseconds{uv_now(loop)});
+  }
+
+
+  bool on_client_received (const libuv::endpoint &src,
+    const libuv::packet &packet,
+    size_t port_index)
   {
-    logic_.on_client_received(src, packet);
+    return logic_.on_client_received(src, packet, port_index);
   }
 
 
-  bool on_peer_received (const libuv::endpoint &src, libuv::packet &packet)
+  bool on_peer_received (const libuv::endpoint &src,
+    libuv::packet &packet,
+    size_t port_index)
   {
-    return logic_.on_peer_received(src, packet);
+    return logic_.on_peer_received(src, packet, port_index);
   }
 
 
@@ -177,9 +381,19 @@ public:
   }
 
 
-  void on_statistics_tick () noexcept
+  void on_peer_sent (const libuv::packet &packet)
   {
-    logic_.print_statistics(config_.statistics_print_interval);
+    logic_.on_peer_sent(packet);
+  }
+
+
+  void on_statistics_tick () noexcept;
+  void on_trace_signal () noexcept;
+
+  // invoked by I/O thread after its loop exited (drained)
+  void on_thread_exit () noexcept
+  {
+    uv_async_send(&thread_exit_);
   }
 
 
@@ -192,8 +406,37 @@ private:
   libuv::peer peer_{};
 
   const urn_libuv::config config_;
-  const sockaddr alloc_address_;
+  const libuv::endpoint alloc_address_;
   urn::relay<libuv, true> logic_;
+  const urn::tsc_calibration trace_calibration_{};
+
+  // --session.store (empty if disabled or shared with workers)
+  std::optional<session_store_type> session_store_{};
+
+  // running threads (index is thread id) and drained ones not joined yet
+  std::vector<std::unique_ptr<thread>> threads_{}, draining_{};
+  std::vector<int> thread_cpus_{};
+  uv_async_t thread_exit_{};
+
+  // --rebalance, null if disabled or not supported
+  std::unique_ptr<reuseport_steering> steering_{};
+
+  // --handoff: listener for next process, sockets taken over from previous
+  // one (handed to started threads) and whether this process handed off
+  uv_pipe_t handoff_listener_{};
+  std::vector<int> inherited_sockets_{};
+  bool handed_off_ = false;
+
+  void add_thread () noexcept;
+  void drain_thread () noexcept;
+  void join_drained_threads () noexcept;
+
+  uint16_t take_over () noexcept;
+  void listen_for_handoff () noexcept;
+  void hand_off (handoff_channel &channel) noexcept;
+
+  void start_steering () noexcept;
+  void rebalance () noexcept;
 };
 
 
@@ -0,0 +1,154 @@
+#include <libuv/reuseport_steering.hpp>
+#include <urn/__bits/lib.hpp>
+#include <algorithm>
+#include <numeric>
+#include <vector>
+
+#if __urn_os_linux
+  #include <linux/filter.h>
+  #include <sys/socket.h>
+  #include <cerrno>
+#endif
+
+
+namespace urn_libuv {
+
+
+namespace {
+
+
+// Fibonacci hashing of leading session id bytes, top bits select bucket
+constexpr uint32_t hash_multiplier = 0x9e3779b1;
+constexpr uint32_t bucket_bits = 6;
+static_assert(reuseport_steering::bucket_count == 1 << bucket_bits);
+
+
+} // namespace
+
+
+reuseport_steering::reuseport_steering (size_t thread_count)
+  : thread_count_{(std::max)(thread_count, size_t{1})}
+{
+  for (size_t b = 0;  b != bucket_count;  ++b)
+  {
+    table_[b] = static_cast<uint16_t>(b % thread_count_);
+  }
+}
+
+
+size_t reuseport_steering::bucket (const std::byte *data, size_t size) noexcept
+{
+  if (size < 4)
+  {
+    return 0;
+  }
+
+  // BPF_LD | BPF_W | BPF_ABS loads in network byte order
+  uint32_t key = (std::to_integer<uint32_t>(data[0]) << 24)
+    | (std::to_integer<uint32_t>(data[1]) << 16)
+    | (std::to_integer<uint32_t>(data[2]) << 8)
+    | std::to_integer<uint32_t>(data[3]);
+  return (key * hash_multiplier) >> (32 - bucket_bits);
+}
+
+
+size_t reuseport_steering::rebalance (const bucket_loads &loads)
+{
+  std::vector<uint64_t> thread_loads(thread_count_);
+  for (size_t b = 0;  b != bucket_count;  ++b)
+  {
+    thread_loads[table_[b]] += loads[b];
+  }
+
+  auto total = std::accumulate(thread_loads.begin(), thread_loads.end(), uint64_t{});
+  auto max = *std::max_element(thread_loads.begin(), thread_loads.end());
+  if (thread_count_ < 2
+    || total < min_load
+    || max * thread_count_ * 100 <= total * (100 + skew_percent))
+  {
+    skewed_ = 0;
+    return 0;
+  }
+  if (++skewed_ < sustain)
+  {
+    return 0;
+  }
+  skewed_ = 0;
+
+  // greedy: move bucket closest to half of gap between hottest and coldest
+  // thread, while some bucket fits into gap (single heavy bucket can't be
+  // split and stays)
+  size_t moved = 0;
+  for (;  moved != bucket_count / 4;  ++moved)
+  {
+    auto [cold, hot] = std::minmax_element(thread_loads.begin(), thread_loads.end());
+    auto gap = *hot - *cold;
+    auto hot_thread = static_cast<uint16_t>(hot - thread_loads.begin());
+
+    size_t best = bucket_count;
+    uint64_t best_distance = gap;
+    for (size_t b = 0;  b != bucket_count;  ++b)
+    {
+      if (table_[b] != hot_thread || !loads[b] || loads[b] >= gap)
+      {
+        continue;
+      }
+      auto distance = loads[b] > gap / 2 ? loads[b] - gap / 2 : gap / 2 - loads[b];
+      if (distance < best_distance)
+      {
+        best = b;
+        best_distance = distance;
+      }
+    }
+    if (best == bucket_count)
+    {
+      break;
+    }
+
+    table_[best] = static_cast<uint16_t>(cold - thread_loads.begin());
+    *hot -= loads[best];
+    *cold += loads[best];
+  }
+  return moved;
+}
+
+
+int reuseport_steering::attach (uv_udp_t &socket) const noexcept
+{
+  #if __urn_os_linux && defined(SO_ATTACH_REUSEPORT_CBPF)
+
+    // A = hash(ld [0]) >> (32 - bucket_bits); return table_[A]
+    std::vector<sock_filter> code;
+    code.push_back(BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 0));
+    code.push_back(BPF_STMT(BPF_ALU | BPF_MUL | BPF_K, hash_multiplier));
+    code.push_back(BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 32 - bucket_bits));
+    for (uint32_t b = 0;  b != bucket_count;  ++b)
+    {
+      code.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, b, 0, 1));
+      code.push_back(BPF_STMT(BPF_RET | BPF_K, table_[b]));
+    }
+    code.push_back(BPF_STMT(BPF_RET | BPF_K, 0));
+
+    sock_fprog program{static_cast<unsigned short>(code.size()), code.data()};
+
+    uv_os_fd_t fd;
+    if (auto status = uv_fileno(reinterpret_cast<uv_handle_t *>(&socket), &fd))
+    {
+      return status;
+    }
+    if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program, sizeof(program)) == -1)
+    {
+      return -errno;
+    }
+    return 0;
+
+  #else
+
+    (void)socket;
+    return UV_ENOTSUP;
+
+  #endif
+}
+
+
+} // namespace urn_libuv
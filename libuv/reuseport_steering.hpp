@@ -0,0 +1,92 @@
+#pragma once
+
+/**
+ * \file libuv/reuseport_steering.hpp
+ * Peer listener load rebalancing (--rebalance)
+ *
+ * Kernel picks SO_REUSEPORT group member by flow hash, i.e. few heavy peer
+ * flows may land on same thread while others idle. Instead, peer packets are
+ * steered by session id: its leading 4 bytes are hashed into one of
+ * bucket_count buckets and classic BPF program (SO_ATTACH_REUSEPORT_CBPF)
+ * maps bucket to I/O thread. I/O threads count received packets per bucket
+ * and statistics tick moves buckets from hottest to coldest thread on
+ * sustained skew, replacing group's program at runtime (Linux only).
+ *
+ * Sessions are shared between threads, so moving bucket needs no session
+ * handoff. Connected sockets (--session.connect) are client side only and
+ * are not affected.
+ */
+
+#include <uv.h>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+
+namespace urn_libuv {
+
+
+class reuseport_steering
+{
+public:
+
+  static constexpr size_t bucket_count = 64;
+
+  using bucket_loads = std::array<uint64_t, bucket_count>;
+
+  // thread load above mean by this fraction (percent) is skew
+  static constexpr uint64_t skew_percent = 20;
+
+  // consecutive skewed rebalance() calls before buckets are moved
+  static constexpr size_t sustain = 3;
+
+  // interval total below this is too little traffic to act on
+  static constexpr uint64_t min_load = 1000;
+
+
+  /**
+   * Initially buckets are assigned round-robin to \a thread_count threads
+   */
+  reuseport_steering (size_t thread_count);
+
+
+  /**
+   * Return bucket of peer packet \a data of \a size bytes (same as BPF
+   * program). Packets shorter than 4 bytes are steered to thread 0.
+   */
+  static size_t bucket (const std::byte *data, size_t size) noexcept;
+
+
+  /**
+   * Return I/O thread index \a bucket is steered to
+   */
+  uint16_t thread_of (size_t bucket) const noexcept
+  {
+    return table_[bucket];
+  }
+
+
+  /**
+   * Feed per-bucket packet counts of last interval. Returns number of buckets
+   * moved (0 if no or not yet sustained skew), program must be re-attached
+   * if non-zero.
+   */
+  size_t rebalance (const bucket_loads &loads);
+
+
+  /**
+   * Attach current program to reuseport group of bound \a socket. Returns 0
+   * on success or libuv error code (UV_ENOTSUP if not supported).
+   */
+  int attach (uv_udp_t &socket) const noexcept;
+
+
+private:
+
+  const size_t thread_count_;
+  std::array<uint16_t, bucket_count> table_{};
+  size_t skewed_{};
+};
+
+
+} // namespace urn_libuv
@@ -0,0 +1,203 @@
+#include <libuv/workers.hpp>
+#include <urn/__bits/lib.hpp>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#if __urn_os_linux
+  #include <sys/prctl.h>
+#endif
+
+#if !__urn_os_windows
+  #include <sys/wait.h>
+  #include <unistd.h>
+  #include <cerrno>
+  #include <csignal>
+  #include <cstring>
+#endif
+
+
+namespace urn_libuv {
+
+
+#if !__urn_os_windows // {{{1
+
+
+namespace {
+
+
+// delay before restarting crashed worker (crash loop protection)
+constexpr std::chrono::seconds restart_delay{1};
+
+// SIGINT/SIGTERM received by parent, forwarded to workers
+volatile std::sig_atomic_t stop_signal = 0;
+
+
+pid_t start_worker (size_t index,
+  const config &conf,
+  session_store_type store,
+  const sigset_t &signal_mask) noexcept
+{
+  // otherwise buffered output is written by both processes
+  std::cout.flush();
+
+  auto pid = ::fork();
+  if (pid == 0)
+  {
+    // no loops or threads exist before fork, relay creates its own
+    std::signal(SIGINT, SIG_DFL);
+    std::signal(SIGTERM, SIG_DFL);
+    std::signal(SIGCHLD, SIG_DFL);
+    ::sigprocmask(SIG_SETMASK, &signal_mask, nullptr);
+    #if __urn_os_linux
+      ::prctl(PR_SET_PDEATHSIG, SIGTERM);
+    #endif
+    store.set_writer_id(static_cast<uint32_t>(::getpid()));
+    store.set_writer_liveness_check([](uint32_t pid) noexcept {
+      return ::kill(static_cast<pid_t>(pid), 0) == 0 || errno != ESRCH;
+    });
+    relay worker{conf, &store};
+    std::exit(worker.run());
+  }
+  else if (pid == -1)
+  {
+    std::cout << "workers: fork: " << std::strerror(errno) << '\n';
+  }
+  else
+  {
+    std::cout << "workers: started " << index << " (pid " << pid << ")\n";
+  }
+  return pid;
+}
+
+
+} // namespace
+
+
+int run_workers (const config &conf) noexcept
+{
+  auto store = map_session_store(conf,
+    conf.session_budget.count
+      ? conf.session_budget.count
+      : conf.registration_limit.max_sessions
+  );
+  if (!store)
+  {
+    return EXIT_FAILURE;
+  }
+
+  // signals are blocked except in sigsuspend() below: stop is forwarded
+  // only between reaps, to pids not yet reaped (i.e. not reusable)
+  sigset_t blocked{}, wait_mask{};
+  ::sigemptyset(&blocked);
+  for (auto signal: {SIGINT, SIGTERM, SIGCHLD})
+  {
+    ::sigaddset(&blocked, signal);
+  }
+  ::sigprocmask(SIG_BLOCK, &blocked, &wait_mask);
+
+  struct sigaction action{};
+  action.sa_handler = [](int signal) { stop_signal = signal; };
+  for (auto signal: {SIGINT, SIGTERM})
+  {
+    ::sigaction(signal, &action, nullptr);
+  }
+  // default disposition discards SIGCHLD, it would not end sigsuspend()
+  action.sa_handler = [](int) { };
+  ::sigaction(SIGCHLD, &action, nullptr);
+
+  std::vector<pid_t> workers(conf.workers, -1);
+  size_t running = 0;
+  for (size_t index = 0;  index != workers.size();  ++index)
+  {
+    workers[index] = start_worker(index, conf, *store, wait_mask);
+    running += workers[index] != -1;
+  }
+
+  bool stopping = false;
+  while (running)
+  {
+    if (stop_signal && !stopping)
+    {
+      stopping = true;
+      for (auto worker: workers)
+      {
+        if (worker != -1)
+        {
+          ::kill(worker, stop_signal);
+        }
+      }
+    }
+
+    int status{};
+    auto pid = ::waitpid(-1, &status, WNOHANG);
+    if (pid == 0)
+    {
+      // returns on SIGCHLD or stop signal, including pending ones
+      ::sigsuspend(&wait_mask);
+      continue;
+    }
+    else if (pid == -1)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      break;
+    }
+
+    size_t index = 0;
+    while (index != workers.size() && workers[index] != pid)
+    {
+      ++index;
+    }
+    if (index == workers.size())
+    {
+      continue;
+    }
+
+    workers[index] = -1;
+    running--;
+    if (stopping || (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS))
+    {
+      std::cout << "workers: " << index << " exited\n";
+      continue;
+    }
+
+    if (store->release_writer_lock(static_cast<uint32_t>(pid)))
+    {
+      std::cout << "workers: released session store lock held by " << index << '\n';
+    }
+    std::cout
+      << "workers: " << index << " (pid " << pid << ") "
+      << (WIFSIGNALED(status) ? "killed by signal " : "exited with ")
+      << (WIFSIGNALED(status) ? WTERMSIG(status) : WEXITSTATUS(status))
+      << ", restarting\n";
+    std::this_thread::sleep_for(restart_delay);
+
+    workers[index] = start_worker(index, conf, *store, wait_mask);
+    running += workers[index] != -1;
+  }
+
+  ::sigprocmask(SIG_SETMASK, &wait_mask, nullptr);
+  return EXIT_SUCCESS;
+}
+
+
+#else // }}}1 {{{1
+
+
+int run_workers (const config &conf) noexcept
+{
+  std::cout << "workers: not supported, running single process\n";
+  relay relay{conf};
+  return relay.run();
+}
+
+
+#endif // }}}1
+
+
+} // namespace urn_libuv
@@ -0,0 +1,40 @@
+#pragma once
+
+/**
+ * \file libuv/workers.hpp
+ * Multi-process mode (--workers <n>)
+ *
+ * Parent process maps session store in anonymous shared memory (or
+ * --session.store file) and forks workers. Each worker runs its own relay
+ * with own I/O threads and reuseport listeners, i.e. kernel spreads flows
+ * over workers' sockets same way it spreads them over threads.
+ *
+ * Store is position independent (slot indexes, no pointers), lookups are
+ * lock-free and writers serialize on spinlock in mapping. Worker registers
+ * sessions into its own table and writes them through to store, session
+ * missing from worker's table is restored from store by its first peer
+ * packet (see urn::relay::set_session_store()). Eviction erases from store
+ * and bumps its generation, other workers then check their copy against
+ * store on its next peer packet and drop it.
+ *
+ * Parent waits for workers and restarts crashed ones (releasing store
+ * writer lock if crashed worker held it). SIGINT/SIGTERM are forwarded to
+ * workers not yet reaped. Worker does not wait on lock
+ * longer than urn::session_store::max_lock_retries, lock of holder that no
+ * longer exists (kill(pid, 0) fails) is taken over. POSIX only.
+ */
+
+#include <libuv/relay.hpp>
+
+
+namespace urn_libuv {
+
+
+/**
+ * Run \a conf.workers relay processes, returns when all of them exited
+ * normally.
+ */
+int run_workers (const config &conf) noexcept;
+
+
+} // namespace urn_libuv
@@ -0,0 +1,9 @@
+list(APPEND urn_experiments loopback)
+
+list(APPEND urn_loopback_sources
+  loopback/main.cpp
+  loopback/relay.hpp
+  loopback/relay.cpp
+)
+
+list(APPEND urn_loopback_libs ${urn_os_libs})
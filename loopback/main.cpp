@@ -0,0 +1,24 @@
+#if __urn_alloc_tracking
+  #define __urn_alloc_tracking_operators
+  #include <urn/alloc_tracking.hpp>
+#endif
+
+#include <loopback/relay.hpp>
+#include <exception>
+#include <iostream>
+
+
+int main (int argc, const char *argv[])
+{
+  try
+  {
+    urn_loopback::config config{argc, argv};
+    urn_loopback::relay relay{config};
+    return relay.run();
+  }
+  catch (const std::exception &e)
+  {
+    std::cerr << e.what() << '\n';
+    return EXIT_FAILURE;
+  }
+}
@@ -0,0 +1,521 @@
+#include <loopback/relay.hpp>
+#include <urn/alloc_tracking.hpp>
+#include <cstring>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+
+namespace urn_loopback {
+
+
+namespace {
+
+
+template <typename T>
+void parse_numeric_argument (const std::string &name,
+  const std::string &value,
+  T &result)
+{
+  try
+  {
+    auto ull = std::stoull(value);
+    if (ull <= (std::numeric_limits<T>::max)())
+    {
+      result = static_cast<T>(ull);
+      return;
+    }
+    throw std::runtime_error(name + ": out of range (" + value + ')');
+  }
+  catch (const std::invalid_argument &)
+  {
+    throw std::runtime_error(name + ": invalid argument (" + value + ')');
+  }
+}
+
+
+} // namespace
+
+
+config::config (int argc, const char *argv[]) //{{{1
+  : threads{static_cast<uint16_t>(std::thread::hardware_concurrency() / 2)}
+{
+  std::deque<std::string> args{argv + 1, argv + argc};
+  for (auto i = 0u;  i < args.size();  ++i)
+  {
+    if (args[i] == "--threads")
+    {
+      parse_numeric_argument("threads", args.at(++i), threads);
+    }
+    else if (args[i] == "--sessions")
+    {
+      parse_numeric_argument("sessions", args.at(++i), sessions);
+    }
+    else if (args[i] == "--packet-size")
+    {
+      parse_numeric_argument("packet-size", args.at(++i), packet_size);
+    }
+    else if (args[i] == "--churn")
+    {
+      parse_numeric_argument("churn", args.at(++i), churn);
+    }
+    else if (args[i] == "--duration")
+    {
+      uint32_t sec{};
+      parse_numeric_argument("duration", args.at(++i), sec);
+      duration = std::chrono::seconds{sec};
+    }
+    else
+    {
+      throw std::runtime_error("invalid flag: '" + args[i] + '\'');
+    }
+  }
+
+  if (!threads)
+  {
+    threads = 1;
+  }
+  if (!sessions)
+  {
+    sessions = 1;
+  }
+  if (packet_size < sizeof(uint64_t))
+  {
+    packet_size = sizeof(uint64_t);
+  }
+  if (churn > 1000)
+  {
+    churn = 1000;
+  }
+
+  std::cout
+    << "threads = " << threads
+    << "\nsessions = " << sessions << " per thread"
+    << "\npacket-size = " << packet_size
+    << "\nchurn = " << churn << "/1000"
+    << "\nduration = " << duration.count() << 's'
+    << '\n';
+}
+
+
+struct thread //{{{1
+{
+  const uint16_t id;
+  relay &owner;
+
+  std::unique_ptr<ingress_ring> ingress = std::make_unique<ingress_ring>();
+  std::unique_ptr<egress_ring> egress = std::make_unique<egress_ring>();
+
+  // sessions whose start_send() was invoked while handling current packet
+  std::vector<loopback::session *> sending_sessions{};
+
+  // written by single thread (generator or relay), read by statistics
+  struct
+  {
+    std::atomic<uint64_t>
+      generated{},    // packets pushed to ingress
+      stalls{},       // ingress full or no free buffers
+      received{},     // forwarded packets returned to generator
+      mismatches{};   // forwarded to wrong client endpoint
+  } generator_stats{};
+
+  struct
+  {
+    std::atomic<uint64_t>
+      processed{},    // packets popped from ingress
+      idle{},         // polls with empty ingress
+      allocations{};  // heap allocations since start (urn_alloc_tracking)
+  } relay_stats{};
+
+  std::thread relay_thread{}, generator_thread{};
+
+
+  thread (uint16_t id, relay &owner) noexcept
+    : id{id}
+    , owner{owner}
+  { }
+
+
+  ~thread ()
+  {
+    join();
+  }
+
+
+  thread (const thread &) = delete;
+  thread &operator= (const thread &) = delete;
+
+
+  void start ()
+  {
+    relay_thread = std::thread{&thread::relay_loop, this};
+    generator_thread = std::thread{&thread::generator_loop, this};
+  }
+
+
+  void join ()
+  {
+    for (auto *t: {&generator_thread, &relay_thread})
+    {
+      if (t->joinable())
+      {
+        t->join();
+      }
+    }
+  }
+
+
+  void relay_loop ();
+  void generator_loop ();
+
+
+  void publish_allocations () noexcept
+  {
+    if constexpr (urn::alloc_tracking::enabled)
+    {
+      relay_stats.allocations.store(
+        urn::alloc_tracking::this_thread.allocations,
+        std::memory_order_relaxed
+      );
+    }
+  }
+};
+
+
+namespace {
+
+
+thread_local thread *this_thread = nullptr;
+
+
+void bump (std::atomic<uint64_t> &counter) noexcept
+{
+  // single writer
+  counter.store(
+    counter.load(std::memory_order_relaxed) + 1,
+    std::memory_order_relaxed
+  );
+}
+
+
+template <typename Ring, typename Message>
+void push (Ring &ring, const Message &message, relay &owner) noexcept
+{
+  while (!ring.try_push(message) && owner.running())
+  {
+    std::this_thread::yield();
+  }
+}
+
+
+uint64_t make_session_id (uint16_t generator, uint32_t seq) noexcept
+{
+  return (uint64_t{generator} + 1) << 32 | seq;
+}
+
+
+// registration source address, derived from session id to validate
+// forwarding destination
+loopback::endpoint client_endpoint_of (uint64_t id) noexcept
+{
+  return {static_cast<uint32_t>(id >> 32), static_cast<uint16_t>(id)};
+}
+
+
+struct xorshift
+{
+  uint64_t state;
+
+  uint64_t operator() () noexcept
+  {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+  }
+};
+
+
+} // namespace
+
+
+void loopback::session::start_send (const packet &p) noexcept //{{{1
+{
+  this_thread->sending_sessions.push_back(this);
+  push(*this_thread->egress, egress_message{p, client_endpoint, true, true},
+    this_thread->owner
+  );
+}
+
+
+void loopback::session::start_fan_out (session *const sessions[], //{{{1
+  size_t count,
+  const packet &p) noexcept
+{
+  // same buffer to each endpoint, generator reclaims it with last message
+  for (size_t i = 0;  i != count;  ++i)
+  {
+    this_thread->sending_sessions.push_back(sessions[i]);
+    push(*this_thread->egress,
+      egress_message{p, sessions[i]->client_endpoint, true, i + 1 == count},
+      this_thread->owner
+    );
+  }
+}
+
+
+void loopback::peer::start_send (const endpoint &dst, //{{{1
+  const packet &p,
+  size_t) noexcept
+{
+  push(*this_thread->egress, egress_message{p, dst, false, true},
+    this_thread->owner
+  );
+}
+
+
+void thread::relay_loop () //{{{1
+{
+  this_thread = this;
+  owner.on_thread_start(id);
+
+  ingress_message message;
+  while (owner.running())
+  {
+    if (!ingress->try_pop(message))
+    {
+      bump(relay_stats.idle);
+      std::this_thread::yield();
+      continue;
+    }
+    bump(relay_stats.processed);
+
+    if (message.from_client)
+    {
+      if (owner.on_client_received(message.src, message.packet))
+      {
+        owner.on_peer_sent(message.packet);
+        publish_allocations();
+        continue;
+      }
+    }
+    else if (owner.on_peer_received(message.src, message.packet))
+    {
+      for (auto session: sending_sessions)
+      {
+        owner.on_session_sent(*session, message.packet);
+      }
+      sending_sessions.clear();
+      publish_allocations();
+      continue;
+    }
+
+    // before returning buffer: generator starts traffic phase once all
+    // registrations are returned
+    publish_allocations();
+    push(*egress, egress_message{message.packet, {}, false, true}, owner);
+  }
+}
+
+
+void thread::generator_loop () //{{{1
+{
+  const auto &conf = owner.config();
+  const auto peer_endpoint = loopback::endpoint{
+    (std::numeric_limits<uint32_t>::max)(), id
+  };
+  xorshift random{id + 1u};
+
+  // every buffer is either free, in ingress or in egress, so rings never
+  // overflow because of buffer shortage
+  std::vector<std::byte> storage(ring_capacity * conf.packet_size);
+  std::vector<std::byte *> free_buffers;
+  for (size_t i = 0;  i != ring_capacity;  ++i)
+  {
+    free_buffers.push_back(storage.data() + i * conf.packet_size);
+  }
+
+  auto drain_egress = [&]
+  {
+    for (egress_message message;  egress->try_pop(message);  /**/)
+    {
+      if (message.forwarded)
+      {
+        bump(generator_stats.received);
+        uint64_t session_id;
+        std::memcpy(&session_id, message.packet.ptr, sizeof(session_id));
+        if (message.dst != client_endpoint_of(session_id))
+        {
+          bump(generator_stats.mismatches);
+        }
+      }
+      if (message.last)
+      {
+        free_buffers.push_back(message.packet.ptr);
+      }
+    }
+  };
+
+  auto send = [&](uint64_t session_id, bool from_client)
+  {
+    while (free_buffers.empty() && owner.running())
+    {
+      bump(generator_stats.stalls);
+      std::this_thread::yield();
+      drain_egress();
+    }
+    if (!owner.running())
+    {
+      return;
+    }
+
+    ingress_message message{
+      {free_buffers.back(), from_client ? sizeof(session_id) : conf.packet_size},
+      from_client ? client_endpoint_of(session_id) : peer_endpoint,
+      from_client,
+    };
+    free_buffers.pop_back();
+    std::memcpy(message.packet.ptr, &session_id, sizeof(session_id));
+
+    while (!ingress->try_push(message) && owner.running())
+    {
+      bump(generator_stats.stalls);
+      std::this_thread::yield();
+      drain_egress();
+    }
+    bump(generator_stats.generated);
+  };
+
+  // registration phase: all own sessions processed before traffic starts
+  uint32_t next_seq = 0;
+  while (next_seq != conf.sessions && owner.running())
+  {
+    send(make_session_id(id, next_seq++), true);
+    drain_egress();
+  }
+  while (free_buffers.size() != ring_capacity && owner.running())
+  {
+    std::this_thread::yield();
+    drain_egress();
+  }
+  owner.on_generator_ready();
+
+  // traffic phase
+  while (owner.running())
+  {
+    if (conf.churn && random() % 1000 < conf.churn)
+    {
+      send(make_session_id(id, next_seq++), true);
+    }
+    else
+    {
+      auto generator = static_cast<uint16_t>(random() % conf.threads);
+      auto seq = static_cast<uint32_t>(random() % conf.sessions);
+      send(make_session_id(generator, seq), false);
+    }
+    drain_egress();
+  }
+}
+
+
+relay::~relay () noexcept = default; //{{{1
+
+
+relay::relay (const urn_loopback::config &conf) noexcept
+  : config_{conf}
+  , logic_{config_.threads, client_, peer_, 2}
+{ }
+
+
+void relay::on_generator_ready () noexcept
+{
+  ready_generators_++;
+  while (ready_generators_.load() != config_.threads && running())
+  {
+    std::this_thread::yield();
+  }
+}
+
+
+int relay::run ()
+{
+  for (auto i = 0u;  i != config_.threads;  ++i)
+  {
+    threads_.emplace_back(std::make_unique<thread>(i, *this));
+  }
+  for (auto &thread: threads_)
+  {
+    thread->start();
+  }
+
+  while (ready_generators_.load() != config_.threads)
+  {
+    std::this_thread::yield();
+  }
+
+  // traffic phase
+  uint64_t processed_start = 0, allocations_start = 0;
+  for (auto &thread: threads_)
+  {
+    processed_start += thread->relay_stats.processed.load();
+    allocations_start += thread->relay_stats.allocations.load();
+  }
+  auto start = std::chrono::steady_clock::now();
+  for (auto left = config_.duration;  left.count() > 0;  left -= config_.statistics_print_interval)
+  {
+    std::this_thread::sleep_for(config_.statistics_print_interval);
+    logic_.print_statistics(config_.statistics_print_interval);
+  }
+  running_ = false;
+  for (auto &thread: threads_)
+  {
+    thread->join();
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+  uint64_t processed = 0, idle = 0, allocations = 0;
+  uint64_t generated = 0, stalls = 0, received = 0, mismatches = 0;
+  for (auto &thread: threads_)
+  {
+    processed += thread->relay_stats.processed.load();
+    idle += thread->relay_stats.idle.load();
+    allocations += thread->relay_stats.allocations.load();
+    generated += thread->generator_stats.generated.load();
+    stalls += thread->generator_stats.stalls.load();
+    received += thread->generator_stats.received.load();
+    mismatches += thread->generator_stats.mismatches.load();
+  }
+  processed -= processed_start;
+  allocations -= allocations_start;
+
+  std::cout
+    << std::fixed << std::setprecision(0)
+    << "\nrelay: " << processed / elapsed.count() << " pps"
+    << " (" << processed / elapsed.count() / config_.threads << " per thread)"
+    << " | idle polls " << idle
+  ;
+  if constexpr (urn::alloc_tracking::enabled)
+  {
+    std::cout
+      << std::setprecision(3)
+      << " | allocs " << allocations
+      << " (" << (processed ? 1.0 * allocations / processed : 0.0) << "/packet)"
+      << std::setprecision(0)
+    ;
+  }
+  std::cout
+    << "\ngenerator: sent " << generated
+    << " | forwarded " << received
+    << " | stalls " << stalls
+    << " | mismatches " << mismatches
+    << '\n';
+
+  return mismatches ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+
+} // namespace urn_loopback
@@ -0,0 +1,245 @@
+#pragma once
+
+/**
+ * \file loopback/relay.hpp
+ * In-process Library: generator threads feed relay threads through SPSC
+ * rings, no syscalls on data path.
+ *
+ * Each relay thread is paired with single generator thread (same shape as
+ * urn_libuv thread with its own client/peer sockets):
+ *  - ingress ring: generator -> relay thread (client and peer packets)
+ *  - egress ring: relay thread -> generator (forwarded packets and released
+ *    buffers)
+ *
+ * Generator first registers its own sessions, then (after all generators
+ * are done) sends peer packets to random sessions of all generators, so
+ * lookups hit sessions registered by other threads. With --churn, new
+ * sessions keep being registered during traffic phase.
+ *
+ * Notes:
+ *  - relay threads and generators poll (yield when idle)
+ *  - forwarded packet destination is validated against session id, any
+ *    mismatch makes process exit with failure
+ */
+
+#include <urn/relay.hpp>
+#include <urn/spsc_ring.hpp>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+
+namespace urn_loopback {
+
+
+struct config //{{{1
+{
+  static constexpr std::chrono::seconds statistics_print_interval{1};
+
+  // relay threads (each paired with generator)
+  uint16_t threads;
+
+  // sessions registered by each generator before traffic phase
+  uint32_t sessions = 1000;
+
+  // peer packet size (>= session id size)
+  uint16_t packet_size = 64;
+
+  // new session registrations per 1000 packets during traffic phase
+  uint16_t churn = 0;
+
+  // run time of traffic phase
+  std::chrono::seconds duration{10};
+
+  config (int argc, const char *argv[]);
+};
+
+
+struct loopback //{{{1
+{
+  struct endpoint
+  {
+    uint32_t address;
+    uint16_t port;
+
+    bool operator== (const endpoint &that) const noexcept
+    {
+      return address == that.address && port == that.port;
+    }
+
+    bool operator!= (const endpoint &that) const noexcept
+    {
+      return !(*this == that);
+    }
+  };
+
+
+  static uint64_t address_key (const endpoint &src) noexcept
+  {
+    return src.address;
+  }
+
+
+  static size_t endpoint_hash (const endpoint &endpoint, uint64_t seed) noexcept
+  {
+    return urn::mix((uint64_t{endpoint.address} << 16) | endpoint.port, seed);
+  }
+
+
+  struct packet
+  {
+    std::byte *ptr;
+    size_t len;
+
+    const std::byte *data () const noexcept
+    {
+      return ptr;
+    }
+
+    size_t size () const noexcept
+    {
+      return len;
+    }
+  };
+
+
+  struct client
+  {
+    void start_receive () noexcept
+    { }
+  };
+
+
+  struct peer
+  {
+    void start_receive () noexcept
+    { }
+
+    // generator sends only registrations on client path, buffer is
+    // returned unforwarded
+    void start_send (const endpoint &dst, const packet &p, size_t) noexcept;
+  };
+
+
+  struct session
+  {
+    const endpoint client_endpoint;
+
+    session (const endpoint &client_endpoint, size_t) noexcept
+      : client_endpoint{client_endpoint}
+    { }
+
+    void start_send (const packet &p) noexcept;
+
+    static void start_fan_out (session *const sessions[], size_t count,
+      const packet &p) noexcept;
+  };
+};
+
+
+// generator -> relay thread
+struct ingress_message
+{
+  loopback::packet packet;
+  loopback::endpoint src;
+  bool from_client;
+};
+
+
+// relay thread -> generator
+struct egress_message
+{
+  loopback::packet packet;
+  loopback::endpoint dst;
+  bool forwarded;
+
+  // last message referencing packet buffer (fan-out sends same buffer to
+  // multiple endpoints)
+  bool last;
+};
+
+
+static constexpr size_t ring_capacity = 1024;
+using ingress_ring = urn::spsc_ring<ingress_message, ring_capacity>;
+using egress_ring = urn::spsc_ring<egress_message, ring_capacity>;
+
+
+struct thread;
+
+
+class relay //{{{1
+{
+public:
+
+  relay (const urn_loopback::config &conf) noexcept;
+  ~relay () noexcept;
+
+  int run ();
+
+
+  const urn_loopback::config &config () const noexcept
+  {
+    return config_;
+  }
+
+
+  bool running () const noexcept
+  {
+    return running_.load(std::memory_order_relaxed);
+  }
+
+
+  void on_thread_start (uint16_t thread_index)
+  {
+    logic_.on_thread_start(thread_index);
+  }
+
+
+  bool on_client_received (const loopback::endpoint &src,
+    const loopback::packet &packet)
+  {
+    return logic_.on_client_received(src, packet, 0);
+  }
+
+
+  bool on_peer_received (const loopback::endpoint &src,
+    const loopback::packet &packet)
+  {
+    return logic_.on_peer_received(src, packet, 1);
+  }
+
+
+  void on_session_sent (loopback::session &session,
+    const loopback::packet &packet)
+  {
+    logic_.on_session_sent(session, packet);
+  }
+
+
+  void on_peer_sent (const loopback::packet &packet)
+  {
+    logic_.on_peer_sent(packet);
+  }
+
+
+  // generator finished registering sessions, wait for others
+  void on_generator_ready () noexcept;
+
+
+private:
+
+  loopback::client client_{};
+  loopback::peer peer_{};
+
+  const urn_loopback::config config_;
+  urn::relay<loopback, true> logic_;
+
+  std::atomic<bool> running_{true};
+  std::atomic<uint16_t> ready_generators_{0};
+
+  std::vector<std::unique_ptr<thread>> threads_{};
+};
+
+
+} // namespace urn_loopback
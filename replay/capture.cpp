@@ -0,0 +1,506 @@
+#include <urn/__bits/platform_sdk.hpp>
+#include <replay/capture.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#if __urn_os_windows
+  // platform_sdk.hpp
+#else
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+
+namespace urn_replay {
+
+
+namespace {
+
+
+constexpr uint32_t pcap_magic_usec = 0xa1b2c3d4;
+constexpr uint32_t pcap_magic_nsec = 0xa1b23c4d;
+constexpr uint32_t pcapng_section_header = 0x0a0d0d0a;
+constexpr uint32_t pcapng_byte_order_magic = 0x1a2b3c4d;
+
+constexpr uint32_t pcapng_interface_description = 1;
+constexpr uint32_t pcapng_simple_packet = 3;
+constexpr uint32_t pcapng_enhanced_packet = 6;
+
+constexpr uint32_t link_null = 0;
+constexpr uint32_t link_ethernet = 1;
+constexpr uint32_t link_raw = 101;
+constexpr uint32_t link_linux_sll = 113;
+constexpr uint32_t link_ipv4 = 228;
+constexpr uint32_t link_ipv6 = 229;
+constexpr uint32_t link_linux_sll2 = 276;
+
+constexpr uint16_t ether_type_ipv4 = 0x0800;
+constexpr uint16_t ether_type_ipv6 = 0x86dd;
+constexpr uint16_t ether_type_vlan = 0x8100;
+constexpr uint16_t ether_type_qinq = 0x88a8;
+
+constexpr uint8_t ip_proto_udp = 17;
+
+
+uint32_t load32 (const std::byte *p) noexcept
+{
+  uint32_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+
+double pow10 (int exp) noexcept
+{
+  double v = 1;
+  while (exp-- > 0)
+  {
+    v *= 10;
+  }
+  return v;
+}
+
+
+uint32_t byte_swap (uint32_t v) noexcept
+{
+  return (v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000) | (v << 24);
+}
+
+
+// network byte order
+uint16_t be16 (const std::byte *p) noexcept
+{
+  return static_cast<uint16_t>(
+    (std::to_integer<uint16_t>(p[0]) << 8) | std::to_integer<uint16_t>(p[1])
+  );
+}
+
+
+bool parse_udp (const std::byte *data, size_t size, udp_packet &packet) noexcept
+{
+  if (size < 8)
+  {
+    return false;
+  }
+
+  size_t length = be16(data + 4);
+  if (length < 8 || length > size)
+  {
+    // truncated by snaplen
+    length = size;
+  }
+
+  packet.src.port = be16(data);
+  packet.dst_port = be16(data + 2);
+  packet.data = data + 8;
+  packet.size = length - 8;
+  return true;
+}
+
+
+bool parse_ipv4 (const std::byte *data, size_t size, udp_packet &packet) noexcept
+{
+  if (size < 20 || (std::to_integer<uint8_t>(data[0]) >> 4) != 4)
+  {
+    return false;
+  }
+
+  size_t header_size = (std::to_integer<uint8_t>(data[0]) & 0x0f) * 4u;
+  size_t total_size = be16(data + 2);
+  auto fragment_offset = be16(data + 6) & 0x1fff;
+  if (std::to_integer<uint8_t>(data[9]) != ip_proto_udp
+    || fragment_offset != 0
+    || header_size < 20
+    || total_size < header_size)
+  {
+    return false;
+  }
+  if (total_size < size)
+  {
+    // Ethernet padding
+    size = total_size;
+  }
+
+  auto &address = packet.src.address;
+  std::memset(address.data(), 0, 10);
+  address[10] = address[11] = 0xff;
+  std::memcpy(address.data() + 12, data + 12, 4);
+
+  return size > header_size
+    && parse_udp(data + header_size, size - header_size, packet);
+}
+
+
+bool parse_ipv6 (const std::byte *data, size_t size, udp_packet &packet) noexcept
+{
+  if (size < 40 || (std::to_integer<uint8_t>(data[0]) >> 4) != 6)
+  {
+    return false;
+  }
+
+  std::memcpy(packet.src.address.data(), data + 8, 16);
+
+  auto next_header = std::to_integer<uint8_t>(data[6]);
+  size_t offset = 40;
+
+  // skip hop-by-hop, routing and destination options extension headers
+  while (next_header == 0 || next_header == 43 || next_header == 60)
+  {
+    if (offset + 8 > size)
+    {
+      return false;
+    }
+    next_header = std::to_integer<uint8_t>(data[offset]);
+    offset += (std::to_integer<size_t>(data[offset + 1]) + 1) * 8;
+  }
+
+  return next_header == ip_proto_udp
+    && offset < size
+    && parse_udp(data + offset, size - offset, packet);
+}
+
+
+bool parse_ip (const std::byte *data, size_t size, udp_packet &packet) noexcept
+{
+  if (size == 0)
+  {
+    return false;
+  }
+  switch (std::to_integer<uint8_t>(data[0]) >> 4)
+  {
+    case 4: return parse_ipv4(data, size, packet);
+    case 6: return parse_ipv6(data, size, packet);
+  }
+  return false;
+}
+
+
+bool parse_ether_type (uint16_t type,
+  const std::byte *data,
+  size_t size,
+  udp_packet &packet) noexcept
+{
+  switch (type)
+  {
+    case ether_type_ipv4: return parse_ipv4(data, size, packet);
+    case ether_type_ipv6: return parse_ipv6(data, size, packet);
+  }
+  return false;
+}
+
+
+} // namespace
+
+
+capture_reader::capture_reader (const capture &source)
+  : it_{source.data()}
+  , end_{source.data() + source.size()}
+{
+  if (source.size() < 24)
+  {
+    throw std::runtime_error("capture: file too small");
+  }
+
+  auto magic = load32(it_);
+  if (magic == pcap_magic_usec || magic == pcap_magic_nsec
+    || byte_swap(magic) == pcap_magic_usec || byte_swap(magic) == pcap_magic_nsec)
+  {
+    swapped_ = (magic != pcap_magic_usec && magic != pcap_magic_nsec);
+    auto unit = swapped_ ? byte_swap(magic) : magic;
+    interfaces_.push_back({
+      read32(it_ + 20),
+      unit == pcap_magic_nsec ? 1.0 : 1000.0
+    });
+    it_ += 24;
+  }
+  else if (magic == pcapng_section_header)
+  {
+    // section header is parsed as any other block
+    pcapng_ = true;
+  }
+  else
+  {
+    throw std::runtime_error("capture: unknown file format");
+  }
+}
+
+
+bool capture_reader::next (udp_packet &packet)
+{
+  if (pcapng_)
+  {
+    return next_pcapng_block(packet);
+  }
+  return next_pcap_record(packet);
+}
+
+
+bool capture_reader::next_pcap_record (udp_packet &packet) noexcept
+{
+  while (end_ - it_ >= 16)
+  {
+    auto ts_sec = read32(it_);
+    auto ts_frac = read32(it_ + 4);
+    auto captured = read32(it_ + 8);
+    auto data = it_ + 16;
+    if (static_cast<size_t>(end_ - data) < captured)
+    {
+      return false;
+    }
+    it_ = data + captured;
+
+    if (parse_link(interfaces_[0].link_type, data, captured, packet))
+    {
+      packet.timestamp = ts_sec * 1'000'000'000ull
+        + static_cast<uint64_t>(ts_frac * interfaces_[0].timestamp_unit_ns);
+      return true;
+    }
+  }
+  return false;
+}
+
+
+bool capture_reader::next_pcapng_block (udp_packet &packet)
+{
+  while (end_ - it_ >= 12)
+  {
+    auto block = it_;
+    auto type = load32(block);
+
+    if (type == pcapng_section_header)
+    {
+      // byte order is defined per section
+      auto order = load32(block + 8);
+      if (order != pcapng_byte_order_magic && byte_swap(order) != pcapng_byte_order_magic)
+      {
+        return false;
+      }
+      swapped_ = (order != pcapng_byte_order_magic);
+      interfaces_.clear();
+    }
+    else
+    {
+      type = read32(block);
+    }
+
+    auto length = read32(block + 4);
+    if (length < 12 || length % 4 || static_cast<size_t>(end_ - block) < length)
+    {
+      return false;
+    }
+    it_ = block + length;
+
+    auto body = block + 8;
+    size_t body_size = length - 12;
+
+    if (type == pcapng_interface_description && body_size >= 8)
+    {
+      interface i{read16(body), 1000.0};
+
+      // options: look for if_tsresol (9)
+      for (auto opt = body + 8;  opt + 4 <= body + body_size;  /**/)
+      {
+        auto code = read16(opt), opt_size = read16(opt + 2);
+        if (code == 0 || opt + 4 + opt_size > body + body_size)
+        {
+          break;
+        }
+        if (code == 9 && opt_size >= 1)
+        {
+          auto resolution = std::to_integer<uint8_t>(opt[4]);
+          double units_per_sec = (resolution & 0x80)
+            ? static_cast<double>(1ull << (resolution & 0x7f))
+            : pow10(resolution);
+          i.timestamp_unit_ns = 1e9 / units_per_sec;
+        }
+        opt += 4 + ((opt_size + 3u) & ~3u);
+      }
+
+      interfaces_.push_back(i);
+    }
+    else if (type == pcapng_enhanced_packet && body_size >= 20)
+    {
+      auto interface_id = read32(body);
+      auto captured = read32(body + 12);
+      if (interface_id < interfaces_.size() && captured <= body_size - 20)
+      {
+        auto &i = interfaces_[interface_id];
+        if (parse_link(i.link_type, body + 20, captured, packet))
+        {
+          uint64_t ts = (uint64_t{read32(body + 4)} << 32) | read32(body + 8);
+          packet.timestamp = static_cast<uint64_t>(ts * i.timestamp_unit_ns);
+          return true;
+        }
+      }
+    }
+    else if (type == pcapng_simple_packet && body_size >= 4 && !interfaces_.empty())
+    {
+      // no timestamp, captured length is implied by block length
+      size_t captured = (std::min<size_t>)(read32(body), body_size - 4);
+      if (parse_link(interfaces_[0].link_type, body + 4, captured, packet))
+      {
+        packet.timestamp = 0;
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+
+bool capture_reader::parse_link (uint32_t link_type,
+  const std::byte *data,
+  size_t size,
+  udp_packet &packet) noexcept
+{
+  switch (link_type)
+  {
+    case link_ethernet:
+    {
+      if (size < 14)
+      {
+        return false;
+      }
+      size_t offset = 12;
+      auto type = be16(data + offset);
+      while ((type == ether_type_vlan || type == ether_type_qinq) && offset + 6 <= size)
+      {
+        offset += 4;
+        type = be16(data + offset);
+      }
+      offset += 2;
+      return parse_ether_type(type, data + offset, size - offset, packet);
+    }
+
+    case link_raw:
+      return parse_ip(data, size, packet);
+
+    case link_ipv4:
+      return parse_ipv4(data, size, packet);
+
+    case link_ipv6:
+      return parse_ipv6(data, size, packet);
+
+    case link_linux_sll:
+      return size >= 16
+        && parse_ether_type(be16(data + 14), data + 16, size - 16, packet);
+
+    case link_linux_sll2:
+      return size >= 20
+        && parse_ether_type(be16(data), data + 20, size - 20, packet);
+
+    case link_null:
+      // family in capturing host byte order, 2 is AF_INET everywhere
+      return size >= 4 && parse_ip(data + 4, size - 4, packet);
+  }
+  return false;
+}
+
+
+uint16_t capture_reader::read16 (const std::byte *p) const noexcept
+{
+  uint16_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return swapped_ ? static_cast<uint16_t>((v >> 8) | (v << 8)) : v;
+}
+
+
+uint32_t capture_reader::read32 (const std::byte *p) const noexcept
+{
+  auto v = load32(p);
+  return swapped_ ? byte_swap(v) : v;
+}
+
+
+#if __urn_os_windows // {{{1
+
+
+capture::capture (const std::string &path)
+{
+  auto file = CreateFileA(path.c_str(),
+    GENERIC_READ,
+    FILE_SHARE_READ,
+    nullptr,
+    OPEN_EXISTING,
+    FILE_FLAG_SEQUENTIAL_SCAN,
+    nullptr
+  );
+  if (file == INVALID_HANDLE_VALUE)
+  {
+    throw std::runtime_error("capture: " + path + ": can't open");
+  }
+
+  LARGE_INTEGER file_size;
+  GetFileSizeEx(file, &file_size);
+  size_ = static_cast<size_t>(file_size.QuadPart);
+
+  handle_ = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  CloseHandle(file);
+  if (!handle_)
+  {
+    throw std::runtime_error("capture: " + path + ": can't map");
+  }
+
+  data_ = static_cast<const std::byte *>(
+    MapViewOfFile(handle_, FILE_MAP_READ, 0, 0, 0)
+  );
+  if (!data_)
+  {
+    CloseHandle(handle_);
+    throw std::runtime_error("capture: " + path + ": can't map");
+  }
+}
+
+
+capture::~capture () noexcept
+{
+  UnmapViewOfFile(data_);
+  CloseHandle(handle_);
+}
+
+
+#else // {{{1
+
+
+capture::capture (const std::string &path)
+{
+  auto fd = ::open(path.c_str(), O_RDONLY);
+  if (fd == -1)
+  {
+    throw std::runtime_error("capture: " + path + ": " + std::strerror(errno));
+  }
+
+  struct stat st{};
+  if (::fstat(fd, &st) == -1 || st.st_size == 0)
+  {
+    ::close(fd);
+    throw std::runtime_error("capture: " + path + ": empty or unreadable");
+  }
+  size_ = static_cast<size_t>(st.st_size);
+
+  auto p = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (p == MAP_FAILED)
+  {
+    throw std::runtime_error("capture: " + path + ": " + std::strerror(errno));
+  }
+  ::madvise(p, size_, MADV_SEQUENTIAL);
+
+  data_ = static_cast<const std::byte *>(p);
+}
+
+
+capture::~capture () noexcept
+{
+  ::munmap(const_cast<std::byte *>(data_), size_);
+}
+
+
+#endif // }}}1
+
+
+} // namespace urn_replay
@@ -0,0 +1,135 @@
+#pragma once
+
+/**
+ * \file replay/capture.hpp
+ * Memory-mapped pcap/pcapng reader for UDP traffic
+ *
+ * Supported formats:
+ *  - pcap (microsecond/nanosecond timestamps, either byte order)
+ *  - pcapng (SHB, IDB, EPB, SPB blocks; other blocks are skipped)
+ *
+ * Supported link types: Ethernet (with VLAN tags), raw IP, Linux cooked
+ * capture (v1, v2) and BSD loopback. Non-UDP packets and non-first IPv4
+ * fragments are skipped.
+ */
+
+#include <urn/__bits/lib.hpp>
+#include <array>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+
+namespace urn_replay {
+
+
+struct endpoint
+{
+  // IPv4 addresses are stored as IPv4-mapped IPv6 addresses
+  std::array<uint8_t, 16> address;
+  uint16_t port;
+
+  bool operator== (const endpoint &that) const noexcept
+  {
+    return port == that.port && address == that.address;
+  }
+};
+
+
+struct udp_packet
+{
+  // capture timestamp in nanoseconds
+  uint64_t timestamp;
+
+  endpoint src;
+  uint16_t dst_port;
+
+  const std::byte *data;
+  size_t size;
+};
+
+
+/**
+ * Read-only memory mapping of capture file. Mapping is shared by all
+ * capture_reader instances.
+ */
+class capture
+{
+public:
+
+  // throws std::runtime_error if file can't be mapped or format is unknown
+  explicit capture (const std::string &path);
+  ~capture () noexcept;
+
+  capture (const capture &) = delete;
+  capture &operator= (const capture &) = delete;
+
+  const std::byte *data () const noexcept
+  {
+    return data_;
+  }
+
+  size_t size () const noexcept
+  {
+    return size_;
+  }
+
+
+private:
+
+  const std::byte *data_{};
+  size_t size_{};
+
+  #if __urn_os_windows
+    void *handle_{};
+  #endif
+};
+
+
+/**
+ * Sequential reader of UDP packets from capture. Records are parsed
+ * in-place, returned packet data points into mapping.
+ */
+class capture_reader
+{
+public:
+
+  // throws std::runtime_error if file format is unknown
+  explicit capture_reader (const capture &source);
+
+  capture_reader (const capture_reader &) = default;
+  capture_reader &operator= (const capture_reader &) = default;
+
+  // return false on end of capture (or truncated record)
+  bool next (udp_packet &packet);
+
+
+private:
+
+  const std::byte *it_, *end_;
+  bool pcapng_{}, swapped_{};
+
+  struct interface
+  {
+    uint32_t link_type;
+    double timestamp_unit_ns;
+  };
+
+  // pcap: single file-wide interface
+  // pcapng: interfaces of current section
+  std::vector<interface> interfaces_{};
+
+  bool next_pcap_record (udp_packet &packet) noexcept;
+  bool next_pcapng_block (udp_packet &packet);
+  bool parse_link (uint32_t link_type,
+    const std::byte *data,
+    size_t size,
+    udp_packet &packet
+  ) noexcept;
+
+  uint16_t read16 (const std::byte *p) const noexcept;
+  uint32_t read32 (const std::byte *p) const noexcept;
+};
+
+
+} // namespace urn_replay
@@ -0,0 +1,11 @@
+list(APPEND urn_experiments replay)
+
+list(APPEND urn_replay_sources
+  replay/main.cpp
+  replay/capture.hpp
+  replay/capture.cpp
+  replay/relay.hpp
+  replay/relay.cpp
+)
+
+list(APPEND urn_replay_libs ${urn_os_libs})
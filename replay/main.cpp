@@ -0,0 +1,23 @@
+#if __urn_alloc_tracking
+  #define __urn_alloc_tracking_operators
+  #include <urn/alloc_tracking.hpp>
+#endif
+
+#include <replay/relay.hpp>
+#include <exception>
+#include <iostream>
+
+
+int main (int argc, const char *argv[])
+{
+  try
+  {
+    urn_replay::config config{argc, argv};
+    return urn_replay::run(config);
+  }
+  catch (const std::exception &e)
+  {
+    std::cerr << e.what() << '\n';
+    return EXIT_FAILURE;
+  }
+}
@@ -0,0 +1,502 @@
+#include <replay/relay.hpp>
+#include <urn/alloc_tracking.hpp>
+#include <atomic>
+#include <cstring>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <thread>
+
+
+namespace urn_replay {
+
+
+namespace {
+
+
+template <typename T>
+void parse_numeric_argument (const std::string &name,
+  const std::string &value,
+  T &result)
+{
+  try
+  {
+    auto ull = std::stoull(value);
+    if (ull <= (std::numeric_limits<T>::max)())
+    {
+      result = static_cast<T>(ull);
+      return;
+    }
+    throw std::runtime_error(name + ": out of range (" + value + ')');
+  }
+  catch (const std::invalid_argument &)
+  {
+    throw std::runtime_error(name + ": invalid argument (" + value + ')');
+  }
+}
+
+
+void parse_port_range_argument (const std::string &name,
+  const std::string &value,
+  config::port_range &result)
+{
+  // <port> or <first>-<last>
+  auto dash = value.find('-');
+  parse_numeric_argument(name, value.substr(0, dash), result.first);
+  result.last = result.first;
+  if (dash != value.npos)
+  {
+    parse_numeric_argument(name, value.substr(dash + 1), result.last);
+  }
+  if (result.last < result.first)
+  {
+    throw std::runtime_error(name + ": invalid range (" + value + ')');
+  }
+}
+
+
+std::ostream &operator<< (std::ostream &os, const config::port_range &range)
+{
+  os << range.first;
+  if (range.last != range.first)
+  {
+    os << '-' << range.last;
+  }
+  return os;
+}
+
+
+} // namespace
+
+
+config::config (int argc, const char *argv[]) //{{{1
+{
+  std::deque<std::string> args{argv + 1, argv + argc};
+  for (auto i = 0u;  i < args.size();  ++i)
+  {
+    if (args[i] == "--threads")
+    {
+      parse_numeric_argument("threads", args.at(++i), threads);
+    }
+    else if (args[i] == "--client.port")
+    {
+      parse_port_range_argument("client.port", args.at(++i), client.port);
+    }
+    else if (args[i] == "--peer.port")
+    {
+      parse_port_range_argument("peer.port", args.at(++i), peer.port);
+    }
+    else if (args[i] == "--timing")
+    {
+      auto &value = args.at(++i);
+      if (value == "original")
+      {
+        original_timing = true;
+      }
+      else if (value == "fast")
+      {
+        original_timing = false;
+      }
+      else
+      {
+        throw std::runtime_error("timing: invalid argument (" + value + ')');
+      }
+    }
+    else if (args[i] == "--loop")
+    {
+      parse_numeric_argument("loop", args.at(++i), loops);
+    }
+    else if (args[i].size() && args[i][0] != '-' && capture_path.empty())
+    {
+      capture_path = args[i];
+    }
+    else
+    {
+      throw std::runtime_error("invalid flag: '" + args[i] + '\'');
+    }
+  }
+
+  if (capture_path.empty())
+  {
+    throw std::runtime_error("usage: urn_replay [flags] <capture.pcap[ng]>");
+  }
+  if (!threads)
+  {
+    threads = 1;
+  }
+  if (!loops)
+  {
+    loops = 1;
+  }
+
+  std::cout
+    << "capture = " << capture_path
+    << "\nthreads = " << threads
+    << "\nclient.port = " << client.port
+    << "\npeer.port = " << peer.port
+    << "\ntiming = " << (original_timing ? "original" : "fast")
+    << "\nloop = " << loops
+    << '\n';
+}
+
+
+namespace { // {{{1
+
+
+// Sends complete synchronously: library::session::start_send() and
+// start_fan_out() park packet here and replay loop invokes
+// relay::on_session_sent() for each session once hook returns
+struct pending_send
+{
+  std::vector<library::session *> sessions{};
+  library::packet packet{};
+};
+
+thread_local pending_send this_thread_pending_send{};
+
+
+enum class direction { client, peer, other };
+
+
+struct thread_result
+{
+  size_t client_packets = 0;
+  size_t client_forwarded = 0;
+  size_t peer_packets = 0;
+  size_t forwarded = 0;
+  size_t missed = 0;
+  size_t bytes = 0;
+  size_t client_allocations = 0;
+  size_t peer_allocations = 0;
+};
+
+
+struct capture_summary
+{
+  size_t packets = 0, client_packets = 0, peer_packets = 0;
+  uint64_t first_timestamp = 0, last_timestamp = 0;
+};
+
+
+direction classify (const config &conf, const udp_packet &packet) noexcept
+{
+  if (conf.client.port.contains(packet.dst_port))
+  {
+    return direction::client;
+  }
+  else if (conf.peer.port.contains(packet.dst_port))
+  {
+    return direction::peer;
+  }
+  return direction::other;
+}
+
+
+uint16_t owner_thread (const udp_packet &packet, uint16_t thread_count)
+  noexcept
+{
+  // session id if present (keeps whole session on same thread) or source
+  uint64_t key;
+  if (packet.size >= sizeof(key))
+  {
+    std::memcpy(&key, packet.data, sizeof(key));
+  }
+  else
+  {
+    std::memcpy(&key, packet.src.address.data() + 8, sizeof(key));
+    key ^= packet.src.port;
+  }
+  key *= 0x9e3779b97f4a7c15ull;
+  return static_cast<uint16_t>((key >> 32) % thread_count);
+}
+
+
+capture_summary summarize (const capture &source, const config &conf)
+{
+  capture_summary result;
+  capture_reader reader{source};
+  for (udp_packet packet;  reader.next(packet);  /**/)
+  {
+    if (!result.packets++)
+    {
+      result.first_timestamp = packet.timestamp;
+    }
+    result.last_timestamp = packet.timestamp;
+
+    switch (classify(conf, packet))
+    {
+      case direction::client: result.client_packets++; break;
+      case direction::peer: result.peer_packets++; break;
+      case direction::other: break;
+    }
+  }
+  return result;
+}
+
+
+template <typename Relay>
+void replay_thread (Relay &relay,
+  const capture &source,
+  const config &conf,
+  const capture_summary &summary,
+  uint16_t thread_index,
+  std::chrono::steady_clock::time_point start,
+  thread_result &result)
+{
+  relay.on_thread_start(thread_index);
+
+  // next loop is started after last packet of previous loop (+1ns)
+  const auto loop_duration = std::chrono::nanoseconds{
+    summary.last_timestamp - summary.first_timestamp + 1
+  };
+
+  for (size_t loop = 0;  loop != conf.loops;  ++loop)
+  {
+    capture_reader reader{source};
+    for (udp_packet packet;  reader.next(packet);  /**/)
+    {
+      auto dir = classify(conf, packet);
+      if (dir == direction::other
+        || owner_thread(packet, conf.threads) != thread_index)
+      {
+        continue;
+      }
+
+      if (conf.original_timing)
+      {
+        std::this_thread::sleep_until(start
+          + loop * loop_duration
+          + std::chrono::nanoseconds{packet.timestamp - summary.first_timestamp}
+        );
+      }
+
+      library::packet p{packet.data, packet.size};
+      result.bytes += packet.size;
+      urn::alloc_tracking::scope allocs;
+      if (dir == direction::client)
+      {
+        result.client_packets++;
+        if (relay.on_client_received(packet.src, p))
+        {
+          // library::peer::start_send() completes synchronously
+          result.client_forwarded++;
+          relay.on_peer_sent(p);
+        }
+      }
+      else if (relay.on_peer_received(packet.src, p,
+          1 + packet.dst_port - conf.peer.port.first))
+      {
+        result.forwarded++;
+        auto &pending = this_thread_pending_send;
+        for (auto session: pending.sessions)
+        {
+          relay.on_session_sent(*session, pending.packet);
+        }
+        pending.sessions.clear();
+      }
+      else
+      {
+        result.missed++;
+      }
+      (dir == direction::client
+        ? result.client_allocations
+        : result.peer_allocations
+      ) += allocs.allocations();
+    }
+  }
+
+  result.peer_packets = result.forwarded + result.missed;
+}
+
+
+template <bool MultiThreaded>
+void replay (const capture &source,
+  const config &conf,
+  const capture_summary &summary,
+  std::vector<thread_result> &results)
+{
+  library::client client;
+  library::peer peer;
+
+  // port index: 0 for client ports, 1.. for peer ports
+  using relay_type = urn::relay<library, MultiThreaded>;
+  relay_type relay{conf.threads, client, peer,
+    1u + conf.peer.port.last - conf.peer.port.first
+  };
+
+  // let threads start together
+  std::atomic<uint16_t> ready{0};
+  std::atomic<bool> go{false};
+  std::chrono::steady_clock::time_point start{};
+
+  std::vector<std::thread> threads;
+  for (uint16_t i = 0;  i != conf.threads;  ++i)
+  {
+    threads.emplace_back(
+      [&, i]
+      {
+        ready++;
+        while (!go.load(std::memory_order_acquire))
+        {
+          std::this_thread::yield();
+        }
+        replay_thread(relay, source, conf, summary, i, start, results[i]);
+      }
+    );
+  }
+
+  while (ready.load() != conf.threads)
+  {
+    std::this_thread::yield();
+  }
+  start = std::chrono::steady_clock::now();
+  go.store(true, std::memory_order_release);
+
+  for (auto &thread: threads)
+  {
+    thread.join();
+  }
+}
+
+
+} // namespace
+
+
+uint64_t library::address_key (const endpoint &src) noexcept //{{{1
+{
+  // IPv4 (mapped): address, IPv6: /64 prefix
+  static constexpr uint8_t v4_mapped_prefix[12] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff
+  };
+  uint64_t key;
+  if (std::memcmp(src.address.data(), v4_mapped_prefix, 12) == 0)
+  {
+    uint32_t v4;
+    std::memcpy(&v4, src.address.data() + 12, sizeof(v4));
+    key = v4;
+  }
+  else
+  {
+    std::memcpy(&key, src.address.data(), sizeof(key));
+  }
+  return key;
+}
+
+
+size_t library::endpoint_hash (const endpoint &endpoint, uint64_t seed) //{{{1
+  noexcept
+{
+  // address halves chained through mix(), port in first round
+  uint64_t half[2];
+  std::memcpy(half, endpoint.address.data(), sizeof(half));
+  return static_cast<size_t>(
+    urn::mix(urn::mix(half[0] ^ endpoint.port, seed) ^ half[1], seed)
+  );
+}
+
+
+void library::session::start_send (const packet &p) noexcept //{{{1
+{
+  auto &pending = this_thread_pending_send;
+  pending.sessions.push_back(this);
+  pending.packet = p;
+}
+
+
+void library::session::start_fan_out (session *const sessions[], //{{{1
+  size_t count,
+  const packet &p) noexcept
+{
+  auto &pending = this_thread_pending_send;
+  pending.sessions.insert(pending.sessions.end(), sessions, sessions + count);
+  pending.packet = p;
+}
+
+
+int run (const config &conf) //{{{1
+{
+  capture source{conf.capture_path};
+
+  auto summary = summarize(source, conf);
+  std::cout
+    << "\ncapture: " << summary.packets << " UDP packets"
+    << " (client " << summary.client_packets
+    << ", peer " << summary.peer_packets
+    << ", other " << (summary.packets - summary.client_packets - summary.peer_packets)
+    << "), "
+    << std::fixed << std::setprecision(3)
+    << (summary.last_timestamp - summary.first_timestamp) / 1e9 << "s\n";
+  if (!summary.client_packets && !summary.peer_packets)
+  {
+    std::cout << "nothing to replay\n";
+    return EXIT_FAILURE;
+  }
+
+  std::vector<thread_result> results(conf.threads);
+  auto start = std::chrono::steady_clock::now();
+  if (conf.threads == 1)
+  {
+    replay<false>(source, conf, summary, results);
+  }
+  else
+  {
+    replay<true>(source, conf, summary, results);
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+  thread_result total;
+  for (auto &r: results)
+  {
+    total.client_packets += r.client_packets;
+    total.client_forwarded += r.client_forwarded;
+    total.peer_packets += r.peer_packets;
+    total.forwarded += r.forwarded;
+    total.missed += r.missed;
+    total.bytes += r.bytes;
+    total.client_allocations += r.client_allocations;
+    total.peer_allocations += r.peer_allocations;
+  }
+  auto packets = total.client_packets + total.peer_packets;
+
+  std::cout
+    << "replay: " << packets << " packets in " << elapsed.count() << "s"
+    << " | " << std::setprecision(0) << packets / elapsed.count() << " pps"
+    << " | " << std::setprecision(1) << elapsed.count() * 1e9 / packets << " ns/packet"
+    << " | " << std::setprecision(1) << total.bytes * 8 / elapsed.count() / 1e6 << " Mbps"
+    << "\nclient: " << total.client_packets
+    << " (forwarded " << total.client_forwarded << ')'
+    << " | peer: " << total.peer_packets
+    << " (forwarded " << total.forwarded
+    << ", missed " << total.missed
+    << ")\n";
+  if constexpr (urn::alloc_tracking::enabled)
+  {
+    // registrations allocate sessions, forwarding should not
+    auto per_packet = [](size_t allocations, size_t packets)
+    {
+      return packets ? 1.0 * allocations / packets : 0.0;
+    };
+    std::cout
+      << std::setprecision(3)
+      << "allocs: client " << total.client_allocations
+      << " (" << per_packet(total.client_allocations, total.client_packets) << "/packet)"
+      << " | peer " << total.peer_allocations
+      << " (" << per_packet(total.peer_allocations, total.peer_packets) << "/packet)\n";
+  }
+  std::cout << "dist";
+  for (auto &r: results)
+  {
+    auto share = r.client_packets + r.peer_packets;
+    std::cout
+      << (&r == &results.front() ? " " : "/")
+      << std::setprecision(0) << (packets ? share * 100.0 / packets : 0.0) << '%';
+  }
+  std::cout << '\n';
+
+  return EXIT_SUCCESS;
+}
+
+
+} // namespace urn_replay
@@ -0,0 +1,126 @@
+#pragma once
+
+/**
+ * \file replay/relay.hpp
+ * Offline replay of captured client/peer UDP traffic through urn::relay
+ *
+ * Packets are read from memory-mapped capture and fed directly to relay
+ * hooks using in-memory Library (no sockets). Packets are steered to
+ * threads by session id (first 8 bytes of payload), so registration and
+ * forwarded data of same session are handled by same thread in capture
+ * order, making runs deterministic.
+ *
+ * Notes:
+ *  - session sends complete immediately (after hook returns)
+ *  - with --timing original, each thread waits until packet's capture
+ *    offset from first packet has elapsed
+ */
+
+#include <replay/capture.hpp>
+#include <urn/relay.hpp>
+#include <chrono>
+#include <string>
+#include <vector>
+
+
+namespace urn_replay {
+
+
+struct config //{{{1
+{
+  struct port_range
+  {
+    uint16_t first, last;
+
+    bool contains (uint16_t port) const noexcept
+    {
+      return first <= port && port <= last;
+    }
+  };
+
+  std::string capture_path{};
+
+  struct
+  {
+    port_range port{3478, 3478};
+  } client{};
+
+  struct
+  {
+    port_range port{3479, 3479};
+  } peer{};
+
+  // keep original inter-arrival times (otherwise replay as fast as possible)
+  bool original_timing = false;
+
+  // number of times capture is replayed
+  size_t loops = 1;
+
+  uint16_t threads = 1;
+
+  config (int argc, const char *argv[]);
+};
+
+
+struct library //{{{1
+{
+  using endpoint = urn_replay::endpoint;
+
+  static uint64_t address_key (const endpoint &src) noexcept;
+  static size_t endpoint_hash (const endpoint &endpoint, uint64_t seed) noexcept;
+
+  struct packet
+  {
+    const std::byte *ptr;
+    size_t len;
+
+    const std::byte *data () const noexcept
+    {
+      return ptr;
+    }
+
+    size_t size () const noexcept
+    {
+      return len;
+    }
+  };
+
+  struct client
+  {
+    void start_receive () noexcept
+    { }
+  };
+
+  struct peer
+  {
+    void start_receive () noexcept
+    { }
+
+    // nothing to send to, replay loop completes send immediately
+    void start_send (const endpoint &, const packet &, size_t) noexcept
+    { }
+  };
+
+  struct session
+  {
+    const endpoint client_endpoint;
+
+    session (const endpoint &client_endpoint, size_t) noexcept
+      : client_endpoint{client_endpoint}
+    { }
+
+    void start_send (const packet &p) noexcept;
+
+    static void start_fan_out (session *const sessions[], size_t count,
+      const packet &p) noexcept;
+  };
+};
+
+
+/**
+ * Replay capture and print report, returns process exit code
+ */
+int run (const config &conf);
+
+
+} // namespace urn_replay
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <urn/__bits/lib.hpp>
+#include <chrono>
+#include <random>
+
+
+__urn_begin
+
+
+// splitmix64 finalizer of key ^ seed: each input bit affects all output bits
+// (hash tables and sketches keyed by client-chosen values)
+constexpr uint64_t mix (uint64_t key, uint64_t seed) noexcept
+{
+  key ^= seed;
+  key ^= key >> 30;
+  key *= 0xbf58476d1ce4e5b9ull;
+  key ^= key >> 27;
+  key *= 0x94d049bb133111ebull;
+  key ^= key >> 31;
+  return key;
+}
+
+
+// per-instance seed for mix()
+inline uint64_t random_seed () noexcept
+{
+  try
+  {
+    std::random_device device;
+    return (uint64_t{device()} << 32) | device();
+  }
+  catch (...)
+  {
+    // no entropy source: still differs between runs
+    return static_cast<uint64_t>(
+      std::chrono::steady_clock::now().time_since_epoch().count()
+    );
+  }
+}
+
+
+__urn_end
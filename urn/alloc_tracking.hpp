@@ -0,0 +1,114 @@
+#pragma once
+
+/**
+ * \file urn/alloc_tracking.hpp
+ * Per-thread heap allocation counters
+ *
+ * Build option urn_alloc_tracking (unittests always) defines
+ * __urn_alloc_tracking=1. Counters are then updated by replacement global
+ * operator new, defined by executable in exactly one translation unit that
+ * defines __urn_alloc_tracking_operators before including this header.
+ * Otherwise counters stay zero.
+ */
+
+#include <urn/__bits/lib.hpp>
+
+#if !defined(__urn_alloc_tracking)
+  #define __urn_alloc_tracking 0
+#endif
+
+#if __urn_alloc_tracking && defined(__urn_alloc_tracking_operators)
+  #include <cstdlib>
+  #include <new>
+#endif
+
+
+__urn_begin
+
+
+namespace alloc_tracking {
+
+
+struct counters
+{
+  uint64_t allocations{}, bytes{};
+};
+
+
+// calling thread's allocations since thread start
+inline thread_local counters this_thread{};
+
+
+constexpr bool enabled = __urn_alloc_tracking == 1;
+
+
+inline void on_alloc (size_t size) noexcept
+{
+  this_thread.allocations++;
+  this_thread.bytes += size;
+}
+
+
+/**
+ * Calling thread's allocations since construction
+ */
+class scope
+{
+public:
+
+  scope () noexcept
+    : start_{this_thread}
+  { }
+
+
+  uint64_t allocations () const noexcept
+  {
+    return this_thread.allocations - start_.allocations;
+  }
+
+
+  uint64_t bytes () const noexcept
+  {
+    return this_thread.bytes - start_.bytes;
+  }
+
+
+private:
+
+  const counters start_;
+};
+
+
+} // namespace alloc_tracking
+
+
+__urn_end
+
+
+#if __urn_alloc_tracking && defined(__urn_alloc_tracking_operators) // {{{1
+
+// array and nothrow forms forward to these in standard library
+
+void *operator new (size_t size)
+{
+  urn::alloc_tracking::on_alloc(size);
+  if (auto ptr = std::malloc(size ? size : 1))
+  {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+
+void operator delete (void *ptr) noexcept
+{
+  std::free(ptr);
+}
+
+
+void operator delete (void *ptr, size_t) noexcept
+{
+  std::free(ptr);
+}
+
+#endif // }}}1
@@ -0,0 +1,87 @@
+#include <urn/alloc_tracking.hpp>
+#include <urn/common.test.hpp>
+#include <thread>
+
+
+namespace {
+
+
+// keeps compiler from eliding new/delete pairs
+void *volatile sink = nullptr;
+
+
+// Catch's SECTION bookkeeping allocates, measured cases use plain test cases
+
+
+TEST_CASE("alloc_tracking: enabled")
+{
+  // unittests always count (see common.test.cpp)
+  CHECK(urn::alloc_tracking::enabled);
+}
+
+
+TEST_CASE("alloc_tracking: new")
+{
+  urn::alloc_tracking::scope allocs;
+  auto p = new uint64_t{1};
+  sink = p;
+  delete p;
+  auto allocations = allocs.allocations(), bytes = allocs.bytes();
+  CHECK(allocations == 1);
+  CHECK(bytes == sizeof(uint64_t));
+}
+
+
+TEST_CASE("alloc_tracking: array")
+{
+  urn::alloc_tracking::scope allocs;
+  auto p = new char[100];
+  sink = p;
+  delete[] p;
+  auto allocations = allocs.allocations(), bytes = allocs.bytes();
+  CHECK(allocations == 1);
+  CHECK(bytes == 100);
+}
+
+
+TEST_CASE("alloc_tracking: nested")
+{
+  urn::alloc_tracking::scope outer;
+  auto a = new uint64_t{1};
+  sink = a;
+
+  urn::alloc_tracking::scope inner;
+  auto b = new uint64_t{2};
+  sink = b;
+  auto inner_allocations = inner.allocations();
+  auto outer_allocations = outer.allocations();
+
+  delete b;
+  delete a;
+  CHECK(inner_allocations == 1);
+  CHECK(outer_allocations == 2);
+}
+
+
+TEST_CASE("alloc_tracking: per thread")
+{
+  uint64_t allocations = 0;
+  std::thread other([&allocations]
+  {
+    urn::alloc_tracking::scope allocs;
+    auto p = new uint64_t{1};
+    sink = p;
+    delete p;
+    allocations = allocs.allocations();
+  });
+
+  urn::alloc_tracking::scope allocs;
+  other.join();
+  auto this_thread_allocations = allocs.allocations();
+
+  CHECK(allocations == 1);
+  CHECK(this_thread_allocations == 0);
+}
+
+
+} // namespace
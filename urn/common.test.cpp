@@ -2,6 +2,7 @@
 #define CATCH_CONFIG_RUNNER
 
 #include <catch2/catch.hpp>
+#include <urn/alloc_tracking.hpp>
 #include <urn/common.test.hpp>
 #include <cstdlib>
 
@@ -38,6 +39,7 @@ int main (int argc, char *argv[])
 
 void *operator new (size_t size)
 {
+  urn::alloc_tracking::on_alloc(size);
   if (urn_test::bad_alloc_once::fail)
   {
     urn_test::bad_alloc_once::fail = false;
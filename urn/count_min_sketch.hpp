@@ -0,0 +1,133 @@
+#pragma once
+
+/**
+ * \file urn/count_min_sketch.hpp
+ * Fixed-size approximate event counter per key
+ */
+
+#include <urn/__bits/lib.hpp>
+#include <urn/__bits/mix.hpp>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <limits>
+
+
+__urn_begin
+
+
+/**
+ * Count-min sketch: \a Depth rows of \a Width counters, each key maps to one
+ * counter per row. Estimate is minimum of key's counters, so it is never
+ * below true count and overestimates only when all rows collide with other
+ * heavy keys. Memory is Width * Depth * 4B regardless of number of keys.
+ * Keys are mixed with per-instance random seed, so keys colliding with
+ * victim's key can't be chosen in advance.
+ *
+ * Counters are relaxed atomics: add() and estimate() are safe from multiple
+ * threads, clear() concurrently with add() may lose some increments (good
+ * enough for windowed rate limiting).
+ */
+template <size_t Width = 4096, size_t Depth = 4>
+class count_min_sketch
+{
+  static_assert(Width && (Width & (Width - 1)) == 0,
+    "Width must be power of 2"
+  );
+  static_assert(Depth > 0, "Depth must be positive");
+
+public:
+
+  // random seed
+  count_min_sketch () noexcept
+    : seed_{random_seed()}
+  { }
+
+
+  explicit count_min_sketch (uint64_t seed) noexcept
+    : seed_{seed}
+  { }
+
+
+  count_min_sketch (const count_min_sketch &) = delete;
+  count_min_sketch &operator= (const count_min_sketch &) = delete;
+
+
+  /**
+   * Increment \a key counters and return new estimate
+   */
+  uint32_t add (uint64_t key) noexcept
+  {
+    auto hash = mix(key, seed_);
+    auto result = (std::numeric_limits<uint32_t>::max)();
+    for (size_t row = 0;  row != Depth;  ++row)
+    {
+      auto &counter = rows_[row][index(hash, row)];
+      result = (std::min)(result,
+        counter.fetch_add(1, std::memory_order_relaxed) + 1
+      );
+    }
+    return result;
+  }
+
+
+  uint32_t estimate (uint64_t key) const noexcept
+  {
+    auto hash = mix(key, seed_);
+    auto result = (std::numeric_limits<uint32_t>::max)();
+    for (size_t row = 0;  row != Depth;  ++row)
+    {
+      auto &counter = rows_[row][index(hash, row)];
+      result = (std::min)(result, counter.load(std::memory_order_relaxed));
+    }
+    return result;
+  }
+
+
+  void clear () noexcept
+  {
+    for (auto &row: rows_)
+    {
+      for (auto &counter: row)
+      {
+        counter.store(0, std::memory_order_relaxed);
+      }
+    }
+  }
+
+
+  uint64_t seed () const noexcept
+  {
+    return seed_;
+  }
+
+
+  static constexpr size_t width () noexcept
+  {
+    return Width;
+  }
+
+
+  static constexpr size_t depth () noexcept
+  {
+    return Depth;
+  }
+
+
+private:
+
+  const uint64_t seed_;
+  std::array<std::array<std::atomic<uint32_t>, Width>, Depth> rows_{};
+
+
+  static constexpr size_t index (uint64_t hash, size_t row) noexcept
+  {
+    // double hashing: h1 + row * h2 (h2 odd to visit distinct counters)
+    const auto h1 = static_cast<size_t>(hash);
+    const auto h2 = static_cast<size_t>(hash >> 32) | 1;
+    return (h1 + row * h2) & (Width - 1);
+  }
+};
+
+
+__urn_end
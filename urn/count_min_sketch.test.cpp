@@ -0,0 +1,95 @@
+#include <urn/count_min_sketch.hpp>
+#include <urn/common.test.hpp>
+#include <memory>
+#include <vector>
+
+
+namespace {
+
+
+TEST_CASE("count_min_sketch")
+{
+  using sketch_type = urn::count_min_sketch<64, 4>;
+  auto sketch = std::make_unique<sketch_type>();
+  CHECK(sketch->width() == 64);
+  CHECK(sketch->depth() == 4);
+  CHECK(sketch->estimate(1) == 0);
+
+
+  SECTION("add")
+  {
+    CHECK(sketch->add(1) == 1);
+    CHECK(sketch->add(1) == 2);
+    CHECK(sketch->add(2) >= 1);
+    CHECK(sketch->estimate(1) >= 2);
+  }
+
+
+  SECTION("clear")
+  {
+    sketch->add(1);
+    sketch->add(2);
+    sketch->clear();
+    CHECK(sketch->estimate(1) == 0);
+    CHECK(sketch->estimate(2) == 0);
+  }
+
+
+  SECTION("heavy hitter among many keys")
+  {
+    // more distinct keys than counters per row
+    for (uint64_t key = 100;  key != 100 + 4 * sketch->width();  ++key)
+    {
+      sketch->add(key);
+    }
+    for (auto i = 0;  i != 1000;  ++i)
+    {
+      sketch->add(1);
+    }
+
+    // never underestimates, light keys stay well below heavy one
+    CHECK(sketch->estimate(1) >= 1000);
+    size_t light_over_threshold = 0;
+    for (uint64_t key = 100;  key != 100 + 4 * sketch->width();  ++key)
+    {
+      auto estimate = sketch->estimate(key);
+      CHECK(estimate >= 1);
+      light_over_threshold += (estimate >= 100);
+    }
+    CHECK(light_over_threshold < sketch->width() / 4);
+  }
+}
+
+
+TEST_CASE("count_min_sketch: seed")
+{
+  // single row: keys sharing counter with key 1 depend on seed
+  using sketch_type = urn::count_min_sketch<64, 1>;
+  auto a = std::make_unique<sketch_type>(1);
+  auto b = std::make_unique<sketch_type>(2);
+  CHECK(a->seed() == 1);
+  a->add(1);
+  b->add(1);
+
+  std::vector<uint64_t> a_colliding, b_colliding;
+  for (uint64_t key = 2;  key != 1000;  ++key)
+  {
+    if (a->estimate(key))
+    {
+      a_colliding.push_back(key);
+    }
+    if (b->estimate(key))
+    {
+      b_colliding.push_back(key);
+    }
+  }
+  CHECK_FALSE(a_colliding.empty());
+  CHECK_FALSE(b_colliding.empty());
+  CHECK(a_colliding != b_colliding);
+
+  // default: random
+  CHECK(std::make_unique<sketch_type>()->seed() != std::make_unique<sketch_type>()->seed());
+}
+
+
+} // namespace
@@ -0,0 +1,250 @@
+#pragma once
+
+/**
+ * \file urn/flight_recorder.hpp
+ * Per-thread fixed-size ring of hot-path trace events
+ */
+
+#include <urn/__bits/lib.hpp>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <ostream>
+#include <vector>
+
+#if defined(_MSC_VER)
+  #include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+  #include <x86intrin.h>
+#endif
+
+
+__urn_begin
+
+
+/**
+ * Cheap monotonic timestamp counter: TSC on x86, virtual counter on AArch64
+ * and steady_clock elsewhere. Units are platform-specific, use
+ * tsc_calibration to convert.
+ */
+inline uint64_t tsc_now () noexcept
+{
+  #if defined(_M_X64) || defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+  #elif defined(__aarch64__)
+    uint64_t value;
+    asm volatile("mrs %0, cntvct_el0" : "=r"(value));
+    return value;
+  #else
+    return std::chrono::steady_clock::now().time_since_epoch().count();
+  #endif
+}
+
+
+/**
+ * Maps tsc_now() values to microseconds since construction. Rate is
+ * measured against steady_clock over whole lifetime of calibration object,
+ * so it gets more accurate the longer it lives.
+ */
+class tsc_calibration
+{
+public:
+
+  tsc_calibration () noexcept
+    : tsc_{tsc_now()}
+    , time_{std::chrono::steady_clock::now()}
+  { }
+
+
+  double ticks_per_usec () const noexcept
+  {
+    auto tsc = tsc_now();
+    auto usec = std::chrono::duration<double, std::micro>(
+      std::chrono::steady_clock::now() - time_
+    ).count();
+    return usec > 0 ? (tsc - tsc_) / usec : 1.0;
+  }
+
+
+  double to_usec (uint64_t tsc, double ticks_per_usec) const noexcept
+  {
+    return tsc > tsc_ ? (tsc - tsc_) / ticks_per_usec : 0.0;
+  }
+
+
+private:
+
+  const uint64_t tsc_;
+  const std::chrono::steady_clock::time_point time_;
+};
+
+
+enum class trace_event: uint32_t
+{
+  recv_batch,       // value: number of packets received in batch
+  lookup_miss,      // value: packet size
+  send_submit,      // value: packet size
+  send_complete,    // value: status (0 = success)
+  buffer_alloc,     // value: 1 if new buffer was allocated, 0 if reused
+};
+
+
+inline const char *to_string (trace_event event) noexcept
+{
+  switch (event)
+  {
+    case trace_event::recv_batch: return "recv_batch";
+    case trace_event::lookup_miss: return "lookup_miss";
+    case trace_event::send_submit: return "send_submit";
+    case trace_event::send_complete: return "send_complete";
+    case trace_event::buffer_alloc: return "buffer_alloc";
+  }
+  return "unknown";
+}
+
+
+/**
+ * Single-writer ring of last \a Capacity events. Recording is a timestamp
+ * read and 16B store, no branches or synchronisation.
+ *
+ * snapshot() can be invoked from other thread while owner keeps recording.
+ * It is best-effort: events that may have been overwritten during copy are
+ * dropped, but single event being written at the same time may be torn.
+ */
+template <size_t Capacity = 64 * 1024>
+class flight_recorder
+{
+  static_assert(Capacity && (Capacity & (Capacity - 1)) == 0,
+    "Capacity must be power of 2"
+  );
+
+public:
+
+  struct event
+  {
+    uint64_t tsc;
+    trace_event type;
+    uint32_t value;
+  };
+
+
+  void record (trace_event type, uint32_t value = 0) noexcept
+  {
+    auto head = head_.load(std::memory_order_relaxed);
+    events_[head & (Capacity - 1)] = {tsc_now(), type, value};
+    head_.store(head + 1, std::memory_order_release);
+  }
+
+
+  size_t size () const noexcept
+  {
+    auto head = head_.load(std::memory_order_acquire);
+    return head < Capacity ? static_cast<size_t>(head) : Capacity;
+  }
+
+
+  static constexpr size_t capacity () noexcept
+  {
+    return Capacity;
+  }
+
+
+  /**
+   * Return recorded events in chronological order
+   */
+  std::vector<event> snapshot () const
+  {
+    auto head = head_.load(std::memory_order_acquire);
+    auto first = head < Capacity ? 0 : head - Capacity;
+
+    std::vector<event> result;
+    result.reserve(head - first);
+    for (auto i = first;  i != head;  ++i)
+    {
+      result.push_back(events_[i & (Capacity - 1)]);
+    }
+
+    // drop events overwritten by writer while copying
+    auto overwritten = static_cast<size_t>(
+      head_.load(std::memory_order_acquire) - head
+    );
+    result.erase(
+      result.begin(),
+      result.begin() + (std::min)(overwritten, result.size())
+    );
+
+    return result;
+  }
+
+
+private:
+
+  std::atomic<uint64_t> head_{0};
+  std::array<event, Capacity> events_{};
+};
+
+
+/**
+ * Write recorded events as Chrome trace / Perfetto JSON (instant events,
+ * one track per recorder).
+ *
+ * Usage:
+ * \code
+ * urn::chrome_trace_writer writer{file, calibration};
+ * writer.write(0, recorder_of_thread_0);
+ * writer.write(1, recorder_of_thread_1);
+ * writer.finish();
+ * \endcode
+ */
+class chrome_trace_writer
+{
+public:
+
+  chrome_trace_writer (std::ostream &os, const tsc_calibration &calibration)
+    : os_{os}
+    , calibration_{calibration}
+    , ticks_per_usec_{calibration.ticks_per_usec()}
+  {
+    os_ << std::fixed << std::setprecision(3) << "{\"traceEvents\":[";
+  }
+
+
+  chrome_trace_writer (const chrome_trace_writer &) = delete;
+  chrome_trace_writer &operator= (const chrome_trace_writer &) = delete;
+
+
+  template <size_t Capacity>
+  void write (size_t tid, const flight_recorder<Capacity> &recorder)
+  {
+    for (auto &e: recorder.snapshot())
+    {
+      os_
+        << (first_ ? "\n" : ",\n")
+        << "{\"name\":\"" << to_string(e.type) << '"'
+        << ",\"ph\":\"i\",\"s\":\"t\",\"pid\":1"
+        << ",\"tid\":" << tid
+        << ",\"ts\":" << calibration_.to_usec(e.tsc, ticks_per_usec_)
+        << ",\"args\":{\"value\":" << e.value << "}}";
+      first_ = false;
+    }
+  }
+
+
+  void finish ()
+  {
+    os_ << "\n],\"displayTimeUnit\":\"ns\"}\n";
+  }
+
+
+private:
+
+  std::ostream &os_;
+  const tsc_calibration &calibration_;
+  const double ticks_per_usec_;
+  bool first_ = true;
+};
+
+
+__urn_end
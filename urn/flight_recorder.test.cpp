@@ -0,0 +1,73 @@
+#include <urn/flight_recorder.hpp>
+#include <urn/common.test.hpp>
+#include <memory>
+#include <sstream>
+
+
+namespace {
+
+
+TEST_CASE("flight_recorder")
+{
+  using recorder_type = urn::flight_recorder<4>;
+  auto recorder = std::make_unique<recorder_type>();
+  CHECK(recorder->size() == 0);
+  CHECK(recorder->snapshot().empty());
+
+
+  SECTION("record")
+  {
+    recorder->record(urn::trace_event::recv_batch, 10);
+    recorder->record(urn::trace_event::lookup_miss, 20);
+    REQUIRE(recorder->size() == 2);
+
+    auto events = recorder->snapshot();
+    REQUIRE(events.size() == 2);
+    CHECK(events[0].type == urn::trace_event::recv_batch);
+    CHECK(events[0].value == 10);
+    CHECK(events[1].type == urn::trace_event::lookup_miss);
+    CHECK(events[1].value == 20);
+    CHECK(events[0].tsc <= events[1].tsc);
+  }
+
+
+  SECTION("wrap")
+  {
+    for (uint32_t i = 0;  i != 2 * recorder->capacity() + 1;  ++i)
+    {
+      recorder->record(urn::trace_event::send_submit, i);
+    }
+    REQUIRE(recorder->size() == recorder->capacity());
+
+    // only last capacity() events, oldest first
+    auto events = recorder->snapshot();
+    REQUIRE(events.size() == recorder->capacity());
+    for (uint32_t i = 0;  i != events.size();  ++i)
+    {
+      CHECK(events[i].value == recorder->capacity() + 1 + i);
+    }
+  }
+
+
+  SECTION("chrome_trace_writer")
+  {
+    urn::tsc_calibration calibration;
+    recorder->record(urn::trace_event::send_complete);
+    recorder->record(urn::trace_event::buffer_alloc, 1);
+
+    std::ostringstream oss;
+    urn::chrome_trace_writer writer{oss, calibration};
+    writer.write(3, *recorder);
+    writer.finish();
+
+    auto json = oss.str();
+    CHECK(json.find("{\"traceEvents\":[") == 0);
+    CHECK(json.find("\"name\":\"send_complete\"") != json.npos);
+    CHECK(json.find("\"name\":\"buffer_alloc\"") != json.npos);
+    CHECK(json.find("\"tid\":3") != json.npos);
+    CHECK(json.find("\"value\":1}") != json.npos);
+  }
+}
+
+
+} // namespace
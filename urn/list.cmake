@@ -1,15 +1,30 @@
 list(APPEND urn_sources
   urn/__bits/lib.hpp
+  urn/__bits/mix.hpp
   urn/__bits/platform_sdk.hpp
+  urn/alloc_tracking.hpp
+  urn/count_min_sketch.hpp
+  urn/flight_recorder.hpp
   urn/intrusive_stack.hpp
   urn/mutex.hpp
   urn/relay.hpp
+  urn/session_id_hash.hpp
+  urn/session_store.hpp
+  urn/spsc_ring.hpp
+  urn/token_bucket.hpp
 )
 
 list(APPEND urn_unittests_sources
   urn/common.test.hpp
   urn/common.test.cpp
+  urn/alloc_tracking.test.cpp
+  urn/count_min_sketch.test.cpp
+  urn/flight_recorder.test.cpp
   urn/intrusive_stack.test.cpp
   urn/mutex.test.cpp
   urn/relay.test.cpp
+  urn/session_id_hash.test.cpp
+  urn/session_store.test.cpp
+  urn/spsc_ring.test.cpp
+  urn/token_bucket.test.cpp
 )
@@ -8,18 +8,44 @@
  */
 
 #include <urn/__bits/lib.hpp>
+#include <urn/__bits/mix.hpp>
+#include <urn/count_min_sketch.hpp>
 #include <urn/mutex.hpp>
+#include <urn/session_id_hash.hpp>
+#include <urn/session_store.hpp>
+#include <urn/token_bucket.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
 #include <iomanip>
 #include <iostream>
+#include <memory>
+#include <type_traits>
 #include <unordered_map>
 #include <sstream>
+#include <utility>
 #include <vector>
 
 
 __urn_begin
 
 
-template <typename Library, bool MultiThreaded = false>
+/**
+ * Relay business logic for \a Library (see README.md). All internal
+ * containers and tables allocate from \a Allocator (rebound as needed),
+ * e.g. std::pmr::polymorphic_allocator<std::byte> to place sessions into
+ * pool or monotonic resource backed by huge pages or shared memory.
+ *
+ * Session table hashes client-chosen ids with \a SessionIdHash (see
+ * urn/session_id_hash.hpp).
+ */
+template <typename Library,
+  bool MultiThreaded = false,
+  typename Allocator = std::allocator<std::byte>,
+  typename SessionIdHash = seeded_session_id_hash
+>
 class relay
 {
 public:
@@ -35,18 +61,55 @@ public:
 
   using mutex_type = shared_mutex<MultiThreaded>;
 
+  // session store record: client endpoint and port index that received its
+  // registration (Library::session is constructed from both)
+  struct stored_session
+  {
+    endpoint_type client_endpoint;
+    uint32_t port_index;
+  };
+  using session_store_type = session_store<stored_session>;
+  using allocator_type = Allocator;
+  using session_id_hash = SessionIdHash;
+
 
-  relay (uint16_t thread_count, client_type &client, peer_type &peer) noexcept
+  /**
+   * Construct relay for \a thread_count threads. Library can listen on
+   * multiple ports, \a port_count is number of distinct port indexes it
+   * passes to on_client_received() and on_peer_received() (used only for
+   * ingress distribution statistics). Sessions and other internal state
+   * (per-thread included) are allocated using \a alloc, its exceptions are
+   * propagated.
+   */
+  relay (uint16_t thread_count,
+      client_type &client,
+      peer_type &peer,
+      size_t port_count = 1,
+      const allocator_type &alloc = allocator_type{})
     : client_{client}
     , peer_{peer}
-    , per_thread_statistics_{thread_count}
-  { }
+    , port_count_{port_count}
+    , alloc_{alloc}
+    , per_thread_fan_out_{alloc_}
+    , per_thread_statistics_{make_statistics(thread_count, port_count)}
+  {
+    per_thread_fan_out_.reserve(thread_count);
+    while (per_thread_fan_out_.size() != thread_count)
+    {
+      per_thread_fan_out_.push_back(fan_out_list{alloc_});
+    }
+  }
+
+  relay (const relay &) = delete;
+  relay &operator= (const relay &) = delete;
 
 
   void print_statistics (const std::chrono::seconds &interval)
   {
-    std::string bytes_in_distribution;
-    auto stats = load_statistics(bytes_in_distribution);
+    std::string bytes_in_distribution, bytes_in_port_distribution;
+    auto stats = load_statistics(bytes_in_distribution,
+      bytes_in_port_distribution
+    );
     auto [in_bps, in_unit] = bits_per_sec(stats.in.bytes, interval);
     auto [out_bps, out_unit] = bits_per_sec(stats.out.bytes, interval);
     stats.in.packets /= interval.count();
@@ -54,41 +117,278 @@ public:
     std::cout
       << "in: " << stats.in.packets << '/' << in_bps << in_unit
       << " | out: " << stats.out.packets << '/' << out_bps << out_unit
-      << " | dist " << bytes_in_distribution
-      << '\n';
+      << " | dist " << bytes_in_distribution;
+    if (stats.in_port_bytes.size() > 1)
+    {
+      std::cout << " | ports " << bytes_in_port_distribution;
+    }
+    if (stats.rate_limited)
+    {
+      std::cout << " | rate-limited " << stats.rate_limited / interval.count();
+    }
+    if (stats.registrations_rejected)
+    {
+      std::cout
+        << " | rejected "
+        << stats.registrations_rejected / interval.count();
+    }
+    if (stats.evictions)
+    {
+      std::cout << " | evicted " << stats.evictions / interval.count();
+    }
+    if (stats.restored)
+    {
+      std::cout << " | restored " << stats.restored / interval.count();
+    }
+    if (stats.fan_out_packets)
+    {
+      // average endpoints per fanned out packet, one decimal
+      auto degree = 10 * stats.fan_out_sends / stats.fan_out_packets;
+      std::cout << " | fan-out " << degree / 10 << '.' << degree % 10;
+    }
+    std::cout << '\n';
+  }
+
+
+  /**
+   * Limit peer to client traffic of each session to \a bytes_per_sec with
+   * bursts up to \a burst_bytes (0 = unlimited). Packets over limit are
+   * dropped before session::start_send(). Must be set before threads start.
+   */
+  void set_session_rate_limit (uint32_t bytes_per_sec, uint32_t burst_bytes)
+    noexcept
+  {
+    session_rate_limit_ = {bytes_per_sec, burst_bytes};
+  }
+
+
+  /**
+   * Protect client port against registration floods:
+   *  - \a per_source_per_sec: max registrations per source address (as
+   *    identified by Library::address_key()) per second, tracked
+   *    approximately in fixed-size sketch (0 = unlimited)
+   *  - \a max_sessions: global session cap (0 = unlimited)
+   *
+   * Rejected registrations are dropped before taking exclusive sessions
+   * lock, so flood does not stall session lookups. Must be set before
+   * threads start.
+   */
+  void set_registration_limit (uint32_t per_source_per_sec, size_t max_sessions)
+  {
+    registrations_per_source_limit_ = per_source_per_sec;
+    if (per_source_per_sec && !registrations_per_source_)
+    {
+      registrations_per_source_ = allocate_unique<registration_sketch>();
+    }
+    max_sessions_ = max_sessions;
+  }
+
+
+  /**
+   * Keep at most \a max_sessions sessions. When full, new registration
+   * evicts approximately least recently used session (CLOCK: lookups set
+   * reference bit under shared lock, eviction sweep clears it and evicts
+   * first unreferenced session). Sessions with sends in flight are never
+   * evicted, if all are busy, registration is rejected. 0 = unlimited.
+   *
+   * Use session_memory_size() to convert memory budget to session count.
+   * Must be set before any sessions are registered.
+   */
+  void set_session_budget (size_t max_sessions)
+  {
+    session_budget_ = max_sessions;
+    sessions_.reserve(max_sessions);
+    clients_.reserve(max_sessions);
+    clock_.reserve(max_sessions);
+  }
+
+
+  /**
+   * Allow up to \a max_endpoints different client endpoints to register
+   * with same session id. Each peer packet is then sent to all of them with
+   * single Library::session::start_fan_out() call (on_session_sent() is
+   * still invoked per endpoint). Default 1 rejects duplicate registrations.
+   * Must be set before threads start.
+   */
+  void set_fan_out (size_t max_endpoints) noexcept
+  {
+    fan_out_limit_ = max_endpoints ? max_endpoints : 1;
+  }
+
+
+  /**
+   * Use TURN ChannelData framing (RFC 5766, 4B header with channel number
+   * 0x4000..0x7fff) towards clients:
+   *  - peer to client: session id prefix of peer packet is rewritten in
+   *    place into ChannelData header, peers are bound to channels in order
+   *    of their first packets (up to \a max_channels per session, packets
+   *    from other peers are dropped)
+   *  - client to peer: ChannelData channel selects peer, header is stripped
+   *
+   * Channel lookup is direct index into per-session table. 0 = disabled,
+   * client data is forwarded as is to first peer. Must be set before
+   * threads start.
+   */
+  void set_channel_data (size_t max_channels) noexcept
+  {
+    channel_data_ = max_channels > 0;
+    channel_capacity_ = max_channels
+      ? (std::min)(max_channels, channel_number_count)
+      : 1
+    ;
+  }
+
+
+  /**
+   * Mirror sessions into \a store: registrations and evictions are written
+   * through, session missing from table is restored from store by its first
+   * peer packet (i.e. store kept in file survives restart). Only first
+   * client endpoint of fan-out session is stored, channel bindings are
+   * learned again. Store is not owned. Must be set before threads start.
+   *
+   * Store may be shared with other relays (processes): when its generation
+   * changes (session erased or re-registered elsewhere), peer packet checks
+   * its session against store once and session no longer stored with same
+   * client endpoint is dropped from table (restored again if re-registered).
+   */
+  void set_session_store (session_store_type *store) noexcept
+  {
+    session_store_ = store;
+  }
+
+
+  /**
+   * Approximate memory used per session: session and client map elements
+   * (see map_element_size()), channel table and CLOCK slot. Allocator
+   * overhead is not included.
+   */
+  size_t session_memory_size () const noexcept
+  {
+    return map_element_size<session_map>()
+      + map_element_size<client_map>()
+      + channel_capacity_ * sizeof(channel_binding)
+      + sizeof(session_id);
   }
 
 
   void on_thread_start (uint16_t thread_index)
   {
     this_thread_statistics_ = &per_thread_statistics_.at(thread_index);
+    this_thread_fan_out_ = &per_thread_fan_out_.at(thread_index);
+    this_thread_fan_out_->reserve(fan_out_limit_);
   }
 
 
-  void on_client_received (const endpoint_type &src, const packet_type &packet)
+  /**
+   * Advance calling thread's coarse clock (milliseconds, used for session
+   * rate and registration limiting). Library should invoke it at least once
+   * per event loop iteration.
+   */
+  void on_clock_tick (std::chrono::milliseconds now) noexcept
   {
-    update_io_statistics(this_thread_statistics_->in, packet);
+    this_thread_now_ = static_cast<uint32_t>(now.count());
+  }
+
+
+  /**
+   * Packet of session id size is registration, anything else from
+   * registered client endpoint is forwarded to session's peer (once peer
+   * endpoint is learned from first peer packet). With ChannelData framing
+   * (see set_channel_data()), peer is selected by channel number and only
+   * payload is forwarded; ChannelData message with 4B payload has session
+   * id size and is registration only if its channel is not bound. Returns
+   * true if \a packet is passed to peer::start_send(), client receive is
+   * then restarted on on_peer_sent().
+   */
+  bool on_client_received (const endpoint_type &src,
+    const packet_type &packet,
+    size_t port_index = 0)
+  {
+    update_in_statistics(port_index, packet);
+    if (channel_data_ || packet.size() != sizeof(session_id))
+    {
+      if (auto channel = get_client_channel(packet);  channel != no_channel)
+      {
+        if (auto [peer, peer_port] = find_peer(src, channel);  peer_port)
+        {
+          peer_.start_send(peer,
+            channel_data_ ? get_channel_data_payload(packet) : packet,
+            peer_port - 1
+          );
+          return true;
+        }
+      }
+    }
+
     if (packet.size() == sizeof(session_id))
     {
-      if (try_register_session(get_session_id(packet.data()), src))
+      if (!is_registration_allowed(src))
+      {
+        this_thread_statistics_->registrations_rejected++;
+      }
+      else if (try_register_session(get_session_id(packet.data()), src, port_index))
       {
         peer_.start_receive();
       }
     }
     client_.start_receive();
+    return false;
   }
 
 
-  bool on_peer_received (const endpoint_type &, const packet_type &packet)
+  bool on_peer_received (const endpoint_type &src,
+    const packet_type &packet,
+    size_t port_index = 0)
   {
-    update_io_statistics(this_thread_statistics_->in, packet);
+    update_in_statistics(port_index, packet);
     if (packet.size() >= sizeof(session_id))
     {
-      if (auto session = find_session(get_session_id(packet.data())))
+      if (auto session = acquire_or_restore_session(get_session_id(packet.data())))
       {
+        auto channel = find_channel(*session, src);
+        if (channel == no_channel
+          && session->channel_count.load(std::memory_order_relaxed) < channel_capacity_)
+        {
+          channel = bind_channel(*session, src, port_index);
+        }
+
+        if (channel_data_ && channel == no_channel)
+        {
+          // channel table full, nothing to frame packet with
+          release_members(*session);
+          peer_.start_receive();
+          return false;
+        }
+
+        if (session_rate_limit_
+          && !session->limiter.try_consume(session_rate_limit_,
+            this_thread_now_,
+            static_cast<uint32_t>(packet.size())))
+        {
+          release_members(*session);
+          this_thread_statistics_->rate_limited++;
+          peer_.start_receive();
+          return false;
+        }
+
+        const auto out = channel_data_
+          ? make_channel_data(packet, channel)
+          : packet
+        ;
+
         // peer receive is restarted when sending finishes
         // (on_session_sent is invoked)
-        session->start_send(packet);
+        auto &fan_out = *this_thread_fan_out_;
+        if (fan_out.empty())
+        {
+          session->start_send(out);
+        }
+        else
+        {
+          this_thread_statistics_->fan_out_packets++;
+          this_thread_statistics_->fan_out_sends += fan_out.size();
+          session_type::start_fan_out(fan_out.data(), fan_out.size(), out);
+        }
         return true;
       }
     }
@@ -97,21 +397,60 @@ public:
   }
 
 
-  void on_session_sent (session_type &, const packet_type &packet)
+  void on_session_sent (session_type &session, const packet_type &packet)
   {
+    release_session(static_cast<session_entry &>(session));
     update_io_statistics(this_thread_statistics_->out, packet);
     peer_.start_receive();
   }
 
 
+  void on_peer_sent (const packet_type &packet)
+  {
+    update_io_statistics(this_thread_statistics_->out, packet);
+    client_.start_receive();
+  }
+
+
   session_type *find_session (session_id id)
+  {
+    return find_session_entry(id);
+  }
+
+
+  /**
+   * Invoke \a fn(id, session) for each registered client endpoint (fan-out
+   * members included). Registrations wait until it returns.
+   */
+  template <typename F>
+  void for_each_session (F &&fn) const
   {
     std::shared_lock lock{sessions_mutex_};
-    if (auto it = sessions_.find(id);  it != sessions_.end())
+    for (auto &[id, entry]: sessions_)
     {
-      return &it->second;
+      for (auto member = &entry;  member;  member = member->next_member.get())
+      {
+        fn(id, static_cast<const session_type &>(*member));
+      }
     }
-    return nullptr;
+  }
+
+
+  /**
+   * Register \a src (received on \a port_index) for session \a id outside
+   * of packet path (session state received from other process).
+   * Maximum sessions, fan-out limit and budget apply, existing registration
+   * is kept. Per-source registration limit does not: sending process
+   * already admitted these sessions, handoff replays many of them at once.
+   * Calling thread must have invoked on_thread_start(). Returns true if
+   * registered.
+   */
+  bool import_session (session_id id,
+    const endpoint_type &src,
+    size_t port_index)
+  {
+    return port_index < port_count_
+      && try_register_session(id, src, port_index);
   }
 
 
@@ -119,11 +458,170 @@ private:
 
   client_type &client_;
   peer_type &peer_;
+  const size_t port_count_;
+
+  // TURN ChannelData (RFC 5766 section 11.4)
+  static constexpr size_t channel_data_header_size = 4;
+  static constexpr size_t channel_number_first = 0x4000;
+  static constexpr size_t channel_number_count = 0x4000;
+  static constexpr size_t no_channel = ~size_t{};
+
+  struct channel_binding
+  {
+    endpoint_type peer{};
+    size_t port_index{};
+  };
+
+  bool channel_data_ = false;
+  size_t channel_capacity_ = 1;
+
+  // allocator_type rebound to T and unique_ptr returning memory to it (see
+  // allocate_unique())
+  template <typename T>
+  using rebind_alloc = typename std::allocator_traits<allocator_type>
+    ::template rebind_alloc<T>;
+
+  template <typename T>
+  struct allocator_delete
+  {
+    // relay's alloc_ (allocators need not be assignable, e.g.
+    // std::pmr::polymorphic_allocator)
+    const allocator_type *owner;
+    size_t count = 1;
+
+    void operator() (T *ptr) noexcept
+    {
+      using traits = std::allocator_traits<rebind_alloc<T>>;
+      rebind_alloc<T> alloc{*owner};
+      for (auto it = ptr;  it != ptr + count;  ++it)
+      {
+        traits::destroy(alloc, it);
+      }
+      traits::deallocate(alloc, ptr, count);
+    }
+  };
+
+  template <typename T>
+  using unique_ptr = std::unique_ptr<T, allocator_delete<std::remove_extent_t<T>>>;
+
+  // Library session with relay's per-session state
+  struct session_entry: session_type
+  {
+    token_bucket limiter;
+
+    // port index that received registration (see stored_session)
+    const uint32_t client_port_index;
+
+    // additional client endpoints registered with same id (fan-out)
+    unique_ptr<session_entry> next_member;
+
+    // peers indexed by channel (number - 0x4000), bound in order of their
+    // first packets: table is allocated and entries written once under
+    // exclusive lock, published by channel_count
+    unique_ptr<channel_binding[]> channels;
+    std::atomic<size_t> channel_count{0};
+
+    // eviction state (used only with session budget or store)
+    // new sessions start unreferenced: registration flood evicts its own
+    // sessions before established ones
+    std::atomic<bool> referenced{false};
+    std::atomic<uint32_t> sends_in_flight{0};
+
+    // store generation entry was last validated at (see set_session_store())
+    std::atomic<uint64_t> store_generation{not_stored};
+
+    session_entry (const endpoint_type &src,
+        size_t port_index,
+        const token_bucket::limit &limit,
+        uint32_t now,
+        const allocator_type &alloc)
+      : session_type(src, port_index)
+      , limiter{limit, now}
+      , client_port_index{static_cast<uint32_t>(port_index)}
+      , next_member{nullptr, {&alloc}}
+      , channels{nullptr, {&alloc}}
+    { }
+  };
 
-  using session_map = std::unordered_map<session_id, session_type>;
-  session_map sessions_{};
+  allocator_type alloc_;
+
+  using session_map = std::unordered_map<session_id,
+    session_entry,
+    session_id_hash,
+    std::equal_to<session_id>,
+    rebind_alloc<std::pair<const session_id, session_entry>>
+  >;
+  session_map sessions_{alloc_};
   mutable mutex_type sessions_mutex_{};
 
+  // reverse index for client to peer path: client endpoint -> session
+  // (head entry with peer endpoint), guarded by sessions_mutex_
+  struct endpoint_hash
+  {
+    // random per relay, colliding endpoints can't be chosen in advance
+    uint64_t seed = random_seed();
+
+    size_t operator() (const endpoint_type &endpoint) const noexcept
+    {
+      return Library::endpoint_hash(endpoint, seed);
+    }
+  };
+  using client_map = std::unordered_map<endpoint_type,
+    session_entry *,
+    endpoint_hash,
+    std::equal_to<endpoint_type>,
+    rebind_alloc<std::pair<const endpoint_type, session_entry *>>
+  >;
+  client_map clients_{alloc_};
+
+
+  template <typename Map>
+  static constexpr size_t map_element_size () noexcept
+  {
+    // node: next pointer, value and hash code, which libstdc++ caches only
+    // if hasher may throw (libc++ always); bucket pointer per element at
+    // max load factor 1 (reserved by set_session_budget())
+    constexpr bool cached_hash = !std::is_nothrow_invocable_v<
+      const typename Map::hasher &,
+      const typename Map::key_type &
+    >;
+    return sizeof(void *)
+      + sizeof(typename Map::value_type)
+      + (cached_hash ? sizeof(size_t) : 0)
+      + sizeof(void *);
+  }
+
+  // fan-out (see set_fan_out()), members of session being sent to by
+  // calling thread (empty for single endpoint sessions)
+  size_t fan_out_limit_ = 1;
+  using fan_out_list = std::vector<session_type *, rebind_alloc<session_type *>>;
+  std::vector<fan_out_list, rebind_alloc<fan_out_list>> per_thread_fan_out_;
+  static inline thread_local fan_out_list *this_thread_fan_out_{};
+
+  // CLOCK eviction (see set_session_budget()), guarded by sessions_mutex_
+  size_t session_budget_{};
+  std::vector<session_id, rebind_alloc<session_id>> clock_{alloc_};
+  size_t clock_hand_{};
+
+
+  token_bucket::limit session_rate_limit_{};
+  static inline thread_local uint32_t this_thread_now_{};
+
+  // registration flood protection (see set_registration_limit())
+  static constexpr uint32_t registration_window_ms = 1000;
+  using registration_sketch = count_min_sketch<>;
+  unique_ptr<registration_sketch> registrations_per_source_{nullptr, {&alloc_}};
+  uint32_t registrations_per_source_limit_{};
+  std::atomic<uint32_t> registration_window_start_{};
+  size_t max_sessions_{};
+  std::atomic<size_t> session_count_{};
+
+  // persistent mirror (see set_session_store()), null if not used
+  session_store_type *session_store_{};
+
+  // session_entry::store_generation of entry that store had no room for
+  static constexpr uint64_t not_stored = ~uint64_t{0};
+
   struct statistics
   {
     struct direction
@@ -131,12 +629,44 @@ private:
       size_t packets, bytes;
     } in{}, out{};
 
+    // peer packets dropped by session rate limiter
+    size_t rate_limited{};
+
+    // client registrations dropped by flood protection
+    size_t registrations_rejected{};
+
+    // sessions evicted to keep session budget
+    size_t evictions{};
+
+    // sessions restored from session store
+    size_t restored{};
+
+    // peer packets sent to multiple endpoints and number of those sends
+    size_t fan_out_packets{}, fan_out_sends{};
+
+    // ingress bytes per Library port index
+    std::vector<size_t, rebind_alloc<size_t>> in_port_bytes;
+
+    statistics (size_t port_count, const allocator_type &alloc)
+      : in_port_bytes(port_count, alloc)
+    { }
+
     void get_and_reset_into (statistics &dest)
     {
       dest.in.packets = std::exchange(in.packets, 0);
       dest.in.bytes = std::exchange(in.bytes, 0);
       dest.out.packets = std::exchange(out.packets, 0);
       dest.out.bytes = std::exchange(out.bytes, 0);
+      dest.rate_limited = std::exchange(rate_limited, 0);
+      dest.registrations_rejected = std::exchange(registrations_rejected, 0);
+      dest.evictions = std::exchange(evictions, 0);
+      dest.restored = std::exchange(restored, 0);
+      dest.fan_out_packets = std::exchange(fan_out_packets, 0);
+      dest.fan_out_sends = std::exchange(fan_out_sends, 0);
+      for (size_t i = 0;  i != in_port_bytes.size();  ++i)
+      {
+        dest.in_port_bytes[i] = std::exchange(in_port_bytes[i], 0);
+      }
     }
 
     void sum_into (statistics &dest)
@@ -145,12 +675,80 @@ private:
       dest.in.bytes += in.bytes;
       dest.out.packets += out.packets;
       dest.out.bytes += out.bytes;
+      dest.rate_limited += rate_limited;
+      dest.registrations_rejected += registrations_rejected;
+      dest.evictions += evictions;
+      dest.restored += restored;
+      dest.fan_out_packets += fan_out_packets;
+      dest.fan_out_sends += fan_out_sends;
+      for (size_t i = 0;  i != in_port_bytes.size();  ++i)
+      {
+        dest.in_port_bytes[i] += in_port_bytes[i];
+      }
     }
   };
-  std::vector<statistics> per_thread_statistics_;
+  using statistics_list = std::vector<statistics, rebind_alloc<statistics>>;
+  statistics_list per_thread_statistics_;
   static inline thread_local statistics *this_thread_statistics_{};
 
 
+  statistics_list make_statistics (size_t thread_count, size_t port_count) const
+  {
+    // emplaced: copies would use allocator's
+    // select_on_container_copy_construction()
+    statistics_list result{alloc_};
+    result.reserve(thread_count);
+    while (result.size() != thread_count)
+    {
+      result.emplace_back(port_count, alloc_);
+    }
+    return result;
+  }
+
+
+  // std::make_unique() counterparts using alloc_
+  template <typename T, typename... Args>
+  std::enable_if_t<!std::is_array_v<T>, unique_ptr<T>> allocate_unique (
+    Args &&...args)
+  {
+    return allocate_unique_impl<T>(1, std::forward<Args>(args)...);
+  }
+
+  template <typename T>
+  std::enable_if_t<std::is_array_v<T>, unique_ptr<T>> allocate_unique (
+    size_t count)
+  {
+    return allocate_unique_impl<T>(count);
+  }
+
+  template <typename T, typename... Args>
+  unique_ptr<T> allocate_unique_impl (size_t count, Args &&...args)
+  {
+    using value_type = std::remove_extent_t<T>;
+    using traits = std::allocator_traits<rebind_alloc<value_type>>;
+    rebind_alloc<value_type> alloc{alloc_};
+    auto ptr = traits::allocate(alloc, count);
+    size_t constructed = 0;
+    try
+    {
+      for (/**/;  constructed != count;  ++constructed)
+      {
+        traits::construct(alloc, ptr + constructed, std::forward<Args>(args)...);
+      }
+    }
+    catch (...)
+    {
+      while (constructed)
+      {
+        traits::destroy(alloc, ptr + --constructed);
+      }
+      traits::deallocate(alloc, ptr, count);
+      throw;
+    }
+    return unique_ptr<T>{ptr, {&alloc_, count}};
+  }
+
+
   static session_id get_session_id (const std::byte *data)
   {
     // htonll not used:
@@ -160,10 +758,497 @@ private:
   }
 
 
-  bool try_register_session (session_id id, const endpoint_type &src)
+  session_entry *find_session_entry (session_id id)
+  {
+    std::shared_lock lock{sessions_mutex_};
+    if (auto it = sessions_.find(id);  it != sessions_.end())
+    {
+      return &it->second;
+    }
+    return nullptr;
+  }
+
+
+  session_entry *acquire_session (session_id id)
+  {
+    this_thread_fan_out_->clear();
+
+    std::shared_lock lock{sessions_mutex_};
+    if (auto it = sessions_.find(id);  it != sessions_.end())
+    {
+      auto &entry = it->second;
+      if (session_budget_ && !entry.referenced.load(std::memory_order_relaxed))
+      {
+        entry.referenced.store(true, std::memory_order_relaxed);
+      }
+
+      // members are collected (and pinned) under lock, registration may
+      // append to chain concurrently
+      for (auto member = &entry;  member;  member = member->next_member.get())
+      {
+        if (tracks_sends_in_flight())
+        {
+          // eviction (exclusive lock) must not see zero
+          member->sends_in_flight.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (entry.next_member)
+        {
+          this_thread_fan_out_->push_back(member);
+        }
+      }
+      return &entry;
+    }
+    return nullptr;
+  }
+
+
+  session_entry *acquire_or_restore_session (session_id id)
+  {
+    if (auto session = acquire_session(id))
+    {
+      if (!session_store_ || is_stored(*session, id))
+      {
+        return session;
+      }
+
+      // erased or re-registered by other relay sharing store
+      release_members(*session);
+      if (!try_erase_stale_session(id))
+      {
+        return nullptr;
+      }
+    }
+
+    stored_session record{};
+    if (!session_store_
+      || !session_store_->find(id, record)
+      || record.port_index >= port_count_)
+    {
+      return nullptr;
+    }
+
+    // may lose race with other thread restoring same session
+    if (try_register_session(id, record.client_endpoint, record.port_index))
+    {
+      this_thread_statistics_->restored++;
+    }
+    return acquire_session(id);
+  }
+
+
+  // returns peer endpoint and port index + 1 (0 if not found)
+  std::pair<endpoint_type, size_t> find_peer (const endpoint_type &src,
+    size_t channel)
+  {
+    // copied under lock: session may be evicted once lock is released
+    std::shared_lock lock{sessions_mutex_};
+    if (auto it = clients_.find(src);  it != clients_.end())
+    {
+      auto &entry = *it->second;
+      if (channel < entry.channel_count.load(std::memory_order_acquire))
+      {
+        auto &binding = entry.channels[channel];
+        return {binding.peer, binding.port_index + 1};
+      }
+    }
+    return {};
+  }
+
+
+  static size_t find_channel (const session_entry &entry,
+    const endpoint_type &src) noexcept
+  {
+    auto count = entry.channel_count.load(std::memory_order_acquire);
+    for (size_t channel = 0;  channel != count;  ++channel)
+    {
+      if (entry.channels[channel].peer == src)
+      {
+        return channel;
+      }
+    }
+    return no_channel;
+  }
+
+
+  size_t bind_channel (session_entry &entry,
+    const endpoint_type &src,
+    size_t port_index)
+  {
+    // once per peer, entry is pinned by caller
+    std::lock_guard lock{sessions_mutex_};
+    if (auto channel = find_channel(entry, src);  channel != no_channel)
+    {
+      return channel;
+    }
+
+    auto count = entry.channel_count.load(std::memory_order_relaxed);
+    if (count == channel_capacity_)
+    {
+      return no_channel;
+    }
+    if (!entry.channels)
+    {
+      entry.channels = allocate_unique<channel_binding[]>(channel_capacity_);
+    }
+    entry.channels[count] = {src, port_index};
+    entry.channel_count.store(count + 1, std::memory_order_release);
+    return count;
+  }
+
+
+  size_t get_client_channel (const packet_type &packet) const noexcept
+  {
+    if (!channel_data_)
+    {
+      return 0;
+    }
+
+    auto data = packet.data();
+    if (packet.size() < channel_data_header_size)
+    {
+      return no_channel;
+    }
+    auto number = load_u16(data);
+    auto length = load_u16(data + 2);
+    if (number < channel_number_first
+      || number >= channel_number_first + channel_number_count
+      || channel_data_header_size + length > packet.size())
+    {
+      return no_channel;
+    }
+    return number - channel_number_first;
+  }
+
+
+  static packet_type get_channel_data_payload (const packet_type &packet)
+    noexcept
+  {
+    // length may be less than remaining size (padding)
+    auto data = const_cast<std::byte *>(packet.data());
+    return packet_type{data + channel_data_header_size, load_u16(data + 2)};
+  }
+
+
+  static packet_type make_channel_data (const packet_type &packet,
+    size_t channel) noexcept
+  {
+    // tail of session id is replaced in place with ChannelData header
+    auto data = const_cast<std::byte *>(packet.data())
+      + sizeof(session_id)
+      - channel_data_header_size;
+    auto length = packet.size() - sizeof(session_id);
+    store_u16(data, channel_number_first + channel);
+    store_u16(data + 2, length);
+    return packet_type{data, channel_data_header_size + length};
+  }
+
+
+  static size_t load_u16 (const std::byte *data) noexcept
+  {
+    return (std::to_integer<size_t>(data[0]) << 8)
+      | std::to_integer<size_t>(data[1]);
+  }
+
+
+  static void store_u16 (std::byte *data, size_t value) noexcept
+  {
+    data[0] = static_cast<std::byte>(value >> 8);
+    data[1] = static_cast<std::byte>(value);
+  }
+
+
+  void release_members (session_entry &entry) noexcept
+  {
+    for (auto member = &entry;  member;  member = member->next_member.get())
+    {
+      release_session(*member);
+    }
+  }
+
+
+  void unindex_client (const endpoint_type &src, const session_entry *entry)
+  {
+    // endpoint may have re-registered with other session since
+    if (auto it = clients_.find(src);  it != clients_.end() && it->second == entry)
+    {
+      clients_.erase(it);
+    }
+  }
+
+
+  bool tracks_sends_in_flight () const noexcept
+  {
+    return session_budget_ || session_store_;
+  }
+
+
+  void release_session (session_entry &entry) noexcept
+  {
+    if (tracks_sends_in_flight())
+    {
+      entry.sends_in_flight.fetch_sub(1, std::memory_order_release);
+    }
+  }
+
+
+  static bool has_sends_in_flight (const session_entry &entry) noexcept
+  {
+    for (auto member = &entry;  member;  member = member->next_member.get())
+    {
+      if (member->sends_in_flight.load(std::memory_order_acquire))
+      {
+        return true;
+      }
+    }
+    return false;
+  }
+
+
+  bool try_add_member (session_entry &entry,
+    const endpoint_type &src,
+    size_t port_index)
+  {
+    size_t count = 0;
+    auto last = &entry;
+    for (auto member = &entry;  member;  member = member->next_member.get())
+    {
+      if (member->client_endpoint == src)
+      {
+        // retransmitted registration
+        return false;
+      }
+      last = member;
+      count++;
+    }
+    if (count == fan_out_limit_)
+    {
+      this_thread_statistics_->registrations_rejected++;
+      return false;
+    }
+    last->next_member = allocate_unique<session_entry>(src,
+      port_index,
+      session_rate_limit_,
+      this_thread_now_,
+      alloc_
+    );
+    clients_.insert_or_assign(src, &entry);
+    return true;
+  }
+
+
+  void erase_session (typename session_map::iterator it)
+  {
+    auto &entry = it->second;
+    for (auto member = &entry;  member;  member = member->next_member.get())
+    {
+      unindex_client(member->client_endpoint, &entry);
+    }
+    sessions_.erase(it);
+    session_count_.store(sessions_.size(), std::memory_order_relaxed);
+  }
+
+
+  static stored_session make_stored_session (const endpoint_type &src,
+    size_t port_index) noexcept
+  {
+    // padding zeroed: store compares records bytewise
+    stored_session record;
+    std::memset(&record, 0, sizeof(record));
+    record.client_endpoint = src;
+    record.port_index = static_cast<uint32_t>(port_index);
+    return record;
+  }
+
+
+  bool is_stored (session_entry &entry, session_id id) noexcept
+  {
+    auto generation = session_store_->generation();
+    auto validated = entry.store_generation.load(std::memory_order_relaxed);
+    if (validated == generation || validated == not_stored)
+    {
+      return true;
+    }
+
+    stored_session record{};
+    if (!session_store_->find(id, record)
+      || !(record.client_endpoint == entry.client_endpoint)
+      || record.port_index != entry.client_port_index)
+    {
+      return false;
+    }
+    entry.store_generation.store(generation, std::memory_order_relaxed);
+    return true;
+  }
+
+
+  bool try_erase_stale_session (session_id id)
   {
     std::lock_guard lock{sessions_mutex_};
-    return sessions_.try_emplace(id, src).second;
+    auto it = sessions_.find(id);
+    if (it == sessions_.end() || is_stored(it->second, id))
+    {
+      // already erased (or restored) by other thread
+      return true;
+    }
+    if (has_sends_in_flight(it->second))
+    {
+      // erased by next peer packet
+      return false;
+    }
+
+    // its CLOCK slot is reused by next eviction sweep
+    erase_session(it);
+    return true;
+  }
+
+
+  bool try_evict_session ()
+  {
+    // two sweeps: first may only clear reference bits
+    for (size_t i = 0;  i != 2 * clock_.size();  ++i)
+    {
+      auto it = sessions_.find(clock_[clock_hand_]);
+      if (it == sessions_.end())
+      {
+        // erased as stale: clock_hand_ is left at free slot
+        return true;
+      }
+
+      auto &entry = it->second;
+      if (!has_sends_in_flight(entry))
+      {
+        if (!entry.referenced.load(std::memory_order_relaxed))
+        {
+          // clock_hand_ is left at freed slot for new session
+          if (session_store_)
+          {
+            session_store_->erase(it->first);
+          }
+          erase_session(it);
+          this_thread_statistics_->evictions++;
+          return true;
+        }
+        entry.referenced.store(false, std::memory_order_relaxed);
+      }
+      clock_hand_ = (clock_hand_ + 1) % clock_.size();
+    }
+    return false;
+  }
+
+
+  bool is_registration_allowed (const endpoint_type &src) noexcept
+  {
+    if (max_sessions_
+      && session_count_.load(std::memory_order_relaxed) >= max_sessions_)
+    {
+      return false;
+    }
+
+    if (registrations_per_source_)
+    {
+      // first thread noticing new window resets counters
+      // (signed: thread whose clock lags behind window start is in same
+      // window, not wrapped far into future)
+      auto window_start = registration_window_start_.load(
+        std::memory_order_relaxed
+      );
+      const auto elapsed = static_cast<int32_t>(this_thread_now_ - window_start);
+      constexpr auto window = static_cast<int32_t>(registration_window_ms);
+      if ((elapsed >= window || elapsed < -window)
+        && registration_window_start_.compare_exchange_strong(window_start,
+          this_thread_now_,
+          std::memory_order_relaxed))
+      {
+        registrations_per_source_->clear();
+      }
+
+      auto count = registrations_per_source_->add(Library::address_key(src));
+      if (count > registrations_per_source_limit_)
+      {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+
+  bool try_register_session (session_id id,
+    const endpoint_type &src,
+    size_t port_index)
+  {
+    std::lock_guard lock{sessions_mutex_};
+    if (max_sessions_ && sessions_.size() >= max_sessions_)
+    {
+      // lost race with other threads after is_registration_allowed()
+      this_thread_statistics_->registrations_rejected++;
+      return false;
+    }
+
+    if (fan_out_limit_ > 1)
+    {
+      if (auto it = sessions_.find(id);  it != sessions_.end())
+      {
+        return try_add_member(it->second, src, port_index);
+      }
+    }
+
+    // CLOCK slots of stale sessions (see try_erase_stale_session()) are
+    // freed only by sweep, i.e. clock_ may be full with fewer sessions
+    bool evicted = false;
+    if (session_budget_ && clock_.size() >= session_budget_)
+    {
+      if (sessions_.count(id))
+      {
+        return false;
+      }
+      if (!try_evict_session())
+      {
+        // all sessions have sends in flight
+        this_thread_statistics_->registrations_rejected++;
+        return false;
+      }
+      evicted = true;
+    }
+
+    auto [it, inserted] = sessions_.try_emplace(id,
+      src,
+      port_index,
+      session_rate_limit_,
+      this_thread_now_,
+      alloc_
+    );
+    session_count_.store(sessions_.size(), std::memory_order_relaxed);
+    if (inserted)
+    {
+      clients_.insert_or_assign(src, &it->second);
+      if (session_store_)
+      {
+        // generation before insert: missing concurrent erase only costs
+        // one extra validation
+        auto generation = session_store_->generation();
+        it->second.store_generation.store(
+          session_store_->insert(id, make_stored_session(src, port_index))
+            ? generation
+            : not_stored,
+          std::memory_order_relaxed
+        );
+      }
+    }
+
+    if (inserted && session_budget_)
+    {
+      if (evicted)
+      {
+        clock_[clock_hand_] = id;
+        clock_hand_ = (clock_hand_ + 1) % clock_.size();
+      }
+      else
+      {
+        clock_.push_back(id);
+      }
+    }
+    return inserted;
   }
 
 
@@ -175,13 +1260,41 @@ private:
   }
 
 
-  statistics load_statistics (std::string &in_bytes_distribution) noexcept
+  void update_in_statistics (size_t port_index, const packet_type &packet)
+    noexcept
+  {
+    update_io_statistics(this_thread_statistics_->in, packet);
+    this_thread_statistics_->in_port_bytes[port_index] += packet.size();
+  }
+
+
+  static void append_share (std::string &distribution, size_t part, size_t total)
+  {
+    std::ostringstream oss;
+    oss
+      << std::fixed
+      << std::setprecision(0)
+      << (total ? part * 100.0 / total : 0.0)
+      << "%/"
+    ;
+    distribution += oss.str();
+  }
+
+
+  statistics load_statistics (std::string &in_bytes_distribution,
+    std::string &in_bytes_port_distribution)
   {
     // not thread-safe but good enough to skip sync overhead
 
     // aggregate and reset per thread stats
-    statistics total{};
-    std::vector<statistics> per_thread_statistics(per_thread_statistics_.size());
+    const auto port_count = per_thread_statistics_.empty()
+      ? 1
+      : per_thread_statistics_[0].in_port_bytes.size()
+    ;
+    statistics total{port_count, alloc_};
+    auto per_thread_statistics = make_statistics(per_thread_statistics_.size(),
+      port_count
+    );
     for (size_t i = 0;  i != per_thread_statistics_.size();  ++i)
     {
       per_thread_statistics_[i].get_and_reset_into(per_thread_statistics[i]);
@@ -192,20 +1305,24 @@ private:
     in_bytes_distribution.clear();
     for (auto &statistics: per_thread_statistics)
     {
-      std::ostringstream oss;
-      oss
-        << std::fixed
-        << std::setprecision(0)
-        << (total.in.bytes ? statistics.in.bytes * 100.0 / total.in.bytes : 0.0)
-        << "%/"
-      ;
-      in_bytes_distribution += oss.str();
+      append_share(in_bytes_distribution, statistics.in.bytes, total.in.bytes);
     }
     if (in_bytes_distribution.size())
     {
       in_bytes_distribution.pop_back();
     }
 
+    // and between ports
+    in_bytes_port_distribution.clear();
+    for (auto &bytes: total.in_port_bytes)
+    {
+      append_share(in_bytes_port_distribution, bytes, total.in.bytes);
+    }
+    if (in_bytes_port_distribution.size())
+    {
+      in_bytes_port_distribution.pop_back();
+    }
+
     return total;
   }
 
@@ -1,6 +1,13 @@
 #include <urn/relay.hpp>
+#include <urn/alloc_tracking.hpp>
 #include <urn/common.test.hpp>
+#include <algorithm>
+#include <array>
+#include <memory_resource>
+#include <thread>
+#include <tuple>
 #include <utility>
+#include <vector>
 
 
 namespace {
@@ -10,6 +17,17 @@ struct test_lib
 {
   using endpoint = uint64_t;
 
+  static uint64_t address_key (const endpoint &src) noexcept
+  {
+    // tests use endpoints below 100 as "addresses" with single port
+    return src % 100;
+  }
+
+  static size_t endpoint_hash (const endpoint &endpoint, uint64_t seed) noexcept
+  {
+    return urn::mix(endpoint, seed);
+  }
+
   struct packet
   {
     const std::byte *ptr;
@@ -21,6 +39,11 @@ struct test_lib
       , len{std::size(c) * sizeof(*std::data(c))}
     { }
 
+    packet (const std::byte *ptr, size_t len) noexcept
+      : ptr{ptr}
+      , len{len}
+    { }
+
     const std::byte *data () const noexcept
     {
       return ptr;
@@ -52,12 +75,32 @@ struct test_lib
   struct peer
   {
     bool start_recv_invoked = false;
+    bool start_send_invoked = false;
+    endpoint send_dst{};
+    const std::byte *send_data{};
+    size_t send_size{};
+    size_t send_port_index{};
 
     void start_receive () noexcept
     {
       start_recv_invoked = true;
     }
 
+    void start_send (const endpoint &dst, const packet &p, size_t port_index)
+      noexcept
+    {
+      start_send_invoked = true;
+      send_dst = dst;
+      send_data = p.data();
+      send_size = p.size();
+      send_port_index = port_index;
+    }
+
+    bool is_start_send_invoked ()
+    {
+      return std::exchange(start_send_invoked, false);
+    }
+
     bool is_start_recv_invoked ()
     {
       return std::exchange(start_recv_invoked, false);
@@ -69,18 +112,33 @@ struct test_lib
   {
     inline static session *last_ = nullptr;
 
-    const endpoint src;
+    const endpoint client_endpoint;
+    const size_t port_index;
     bool start_send_invoked = false;
+    const std::byte *sent_data{};
+    size_t sent_size{};
 
-    session (const endpoint &src) noexcept
-      : src{src}
+    session (const endpoint &client_endpoint, size_t port_index) noexcept
+      : client_endpoint{client_endpoint}
+      , port_index{port_index}
     {
       last_ = this;
     }
 
-    void start_send (const packet &) noexcept
+    void start_send (const packet &p) noexcept
     {
       start_send_invoked = true;
+      sent_data = p.data();
+      sent_size = p.size();
+    }
+
+    static void start_fan_out (session *const sessions[], size_t count,
+      const packet &packet) noexcept
+    {
+      for (auto it = sessions;  it != sessions + count;  ++it)
+      {
+        (*it)->start_send(packet);
+      }
     }
 
     bool is_start_send_invoked ()
@@ -98,16 +156,44 @@ struct test_lib
 
 using single_threaded = urn::relay<test_lib, false>;
 using multi_threaded = urn::relay<test_lib, true>;
+using pool_allocated = urn::relay<test_lib,
+  true,
+  std::pmr::polymorphic_allocator<std::byte>
+>;
+using identity_hashed = urn::relay<test_lib,
+  false,
+  std::allocator<std::byte>,
+  urn::identity_session_id_hash
+>;
+
+
+template <typename Relay>
+typename Relay::allocator_type test_allocator ()
+{
+  if constexpr (std::is_same_v<Relay, pool_allocated>)
+  {
+    static std::pmr::synchronized_pool_resource pool{};
+    return &pool;
+  }
+  else
+  {
+    return {};
+  }
+}
 
 
 TEMPLATE_TEST_CASE("relay", "",
   single_threaded,
-  multi_threaded)
+  multi_threaded,
+  pool_allocated,
+  identity_hashed)
 {
   typename TestType::client_type client{};
   typename TestType::peer_type peer{};
 
-  TestType relay{1, client, peer};
+  // client and peer port indexes
+  constexpr size_t port_count = 4;
+  TestType relay{1, client, peer, port_count, test_allocator<TestType>()};
   relay.on_thread_start(0);
 
   constexpr uint64_t a_id = 1, b_id = 2;
@@ -136,7 +222,7 @@ TEMPLATE_TEST_CASE("relay", "",
     // session must be created
     auto a = test_lib::session::last_created();
     REQUIRE(a != nullptr);
-    CHECK(a->src == a_src);
+    CHECK(a->client_endpoint == a_src);
   }
 
 
@@ -164,7 +250,7 @@ TEMPLATE_TEST_CASE("relay", "",
       CHECK(peer.is_start_recv_invoked());
       auto a = test_lib::session::last_created();
       REQUIRE(a != nullptr);
-      CHECK(a->src == a_src);
+      CHECK(a->client_endpoint == a_src);
     }
 
     // second
@@ -175,11 +261,466 @@ TEMPLATE_TEST_CASE("relay", "",
       CHECK(peer.is_start_recv_invoked());
       auto b = test_lib::session::last_created();
       REQUIRE(b != nullptr);
-      CHECK(b->src == b_src);
+      CHECK(b->client_endpoint == b_src);
+    }
+  }
+
+
+  SECTION("on_client_received: per-source registration limit")
+  {
+    relay.set_registration_limit(2, 0);
+    relay.on_clock_tick(std::chrono::milliseconds{1000});
+
+    auto register_session = [&](uint64_t id, test_lib::endpoint src)
+    {
+      uint64_t data[] = { id };
+      relay.on_client_received(src, data);
+      CHECK(client.is_start_recv_invoked());
+      auto created = test_lib::session::last_created() != nullptr;
+      CHECK(peer.is_start_recv_invoked() == created);
+      return created;
+    };
+
+    CHECK(register_session(1, a_src));
+    CHECK(register_session(2, a_src));
+
+    // over limit, also from different port of same address
+    CHECK_FALSE(register_session(3, a_src));
+    CHECK_FALSE(register_session(3, a_src + 100));
+
+    // other sources are not affected
+    CHECK(register_session(3, b_src));
+
+    // new window
+    relay.on_clock_tick(std::chrono::milliseconds{2000});
+    CHECK(register_session(4, a_src));
+    CHECK(register_session(5, a_src));
+    CHECK_FALSE(register_session(6, a_src));
+
+    // thread with lagging clock does not start new window
+    bool lagging_created = true;
+    std::thread{
+      [&]
+      {
+        relay.on_thread_start(0);
+        relay.on_clock_tick(std::chrono::milliseconds{1999});
+        uint64_t data[] = { 6 };
+        relay.on_client_received(a_src, data);
+        lagging_created = test_lib::session::last_created() != nullptr;
+      }
+    }.join();
+    CHECK_FALSE(lagging_created);
+    CHECK(client.is_start_recv_invoked());
+    CHECK_FALSE(register_session(6, a_src));
+  }
+
+
+  SECTION("on_client_received: session cap")
+  {
+    relay.set_registration_limit(0, 1);
+
+    {
+      uint64_t data[] = { a_id };
+      relay.on_client_received(a_src, data);
+      CHECK(peer.is_start_recv_invoked());
+      REQUIRE(test_lib::session::last_created() != nullptr);
+    }
+
+    {
+      uint64_t data[] = { b_id };
+      relay.on_client_received(b_src, data);
+      CHECK(client.is_start_recv_invoked());
+      CHECK_FALSE(peer.is_start_recv_invoked());
+      CHECK(test_lib::session::last_created() == nullptr);
+    }
+
+    // existing session still works
+    uint64_t data[] = { a_id, 100 };
+    CHECK(relay.on_peer_received(a_src, data));
+  }
+
+
+  SECTION("on_client_received: session budget")
+  {
+    relay.set_session_budget(2);
+    CHECK(relay.session_memory_size() > sizeof(test_lib::session));
+
+    test_lib::session *a = nullptr, *b = nullptr;
+    {
+      uint64_t data[] = { a_id };
+      relay.on_client_received(a_src, data);
+      a = test_lib::session::last_created();
+      REQUIRE(a != nullptr);
+    }
+    {
+      uint64_t data[] = { b_id };
+      relay.on_client_received(b_src, data);
+      b = test_lib::session::last_created();
+      REQUIRE(b != nullptr);
+    }
+
+    SECTION("least recently used is evicted")
+    {
+      // not used since registration: oldest goes first
+      constexpr uint64_t c_id = 3, d_id = 4;
+      {
+        uint64_t data[] = { c_id };
+        relay.on_client_received(a_src, data);
+        CHECK(peer.is_start_recv_invoked());
+        REQUIRE(test_lib::session::last_created() != nullptr);
+      }
+      CHECK(relay.find_session(a_id) == nullptr);
+      CHECK(relay.find_session(b_id) == b);
+
+      // b is used, c not
+      uint64_t data[] = { b_id, 100 };
+      REQUIRE(relay.on_peer_received(b_src, data));
+      relay.on_session_sent(*b, data);
+      {
+        uint64_t data[] = { d_id };
+        relay.on_client_received(a_src, data);
+        REQUIRE(test_lib::session::last_created() != nullptr);
+      }
+      CHECK(relay.find_session(b_id) == b);
+      CHECK(relay.find_session(c_id) == nullptr);
+      CHECK(relay.find_session(d_id) != nullptr);
+    }
+
+    SECTION("duplicate registration does not evict")
+    {
+      uint64_t data[] = { a_id };
+      relay.on_client_received(a_src, data);
+      CHECK(test_lib::session::last_created() == nullptr);
+      CHECK(relay.find_session(a_id) == a);
+      CHECK(relay.find_session(b_id) == b);
+    }
+
+    SECTION("sessions with sends in flight are not evicted")
+    {
+      uint64_t a_data[] = { a_id, 100 }, b_data[] = { b_id, 100 };
+      CHECK(peer.is_start_recv_invoked());
+      REQUIRE(relay.on_peer_received(a_src, a_data));
+      REQUIRE(relay.on_peer_received(b_src, b_data));
+
+      // all busy: rejected
+      constexpr uint64_t c_id = 3;
+      uint64_t data[] = { c_id };
+      relay.on_client_received(a_src, data);
+      CHECK(test_lib::session::last_created() == nullptr);
+      CHECK_FALSE(peer.is_start_recv_invoked());
+
+      // a completes: evicted for c
+      relay.on_session_sent(*a, a_data);
+      relay.on_client_received(a_src, data);
+      CHECK(test_lib::session::last_created() != nullptr);
+      CHECK(relay.find_session(a_id) == nullptr);
+      CHECK(relay.find_session(b_id) == b);
+      relay.on_session_sent(*b, b_data);
     }
   }
 
 
+  SECTION("session store")
+  {
+    using store_type = typename TestType::session_store_type;
+    std::vector<uint64_t> memory(store_type::memory_size(16) / sizeof(uint64_t));
+    auto store = store_type::create(memory.data(), 16, 0);
+    relay.set_session_store(&store);
+
+    SECTION("registration is stored")
+    {
+      uint64_t data[] = { a_id };
+      relay.on_client_received(a_src, data, 2);
+      REQUIRE(test_lib::session::last_created() != nullptr);
+
+      typename TestType::stored_session record{};
+      REQUIRE(store.find(a_id, record));
+      CHECK(record.client_endpoint == a_src);
+      CHECK(record.port_index == 2);
+    }
+
+    SECTION("restore on peer packet")
+    {
+      // registered before restart
+      REQUIRE(store.insert(a_id, {a_src, 0}));
+
+      uint64_t data[] = { a_id, 100 };
+      CHECK(relay.on_peer_received(b_src, data));
+      auto session = test_lib::session::last_created();
+      REQUIRE(session != nullptr);
+      CHECK(session->client_endpoint == a_src);
+      CHECK(session->port_index == 0);
+      CHECK(session->is_start_send_invoked());
+      CHECK(relay.find_session(a_id) == session);
+      relay.on_session_sent(*session, data);
+
+      // not stored: dropped
+      uint64_t b_data[] = { b_id, 100 };
+      CHECK_FALSE(relay.on_peer_received(b_src, b_data));
+      CHECK(test_lib::session::last_created() == nullptr);
+    }
+
+    SECTION("evicted session is erased")
+    {
+      relay.set_session_budget(1);
+      {
+        uint64_t data[] = { a_id };
+        relay.on_client_received(a_src, data);
+        REQUIRE(test_lib::session::last_created() != nullptr);
+      }
+      {
+        uint64_t data[] = { b_id };
+        relay.on_client_received(b_src, data);
+        REQUIRE(test_lib::session::last_created() != nullptr);
+      }
+
+      typename TestType::stored_session record{};
+      CHECK_FALSE(store.find(a_id, record));
+      CHECK(store.find(b_id, record));
+      CHECK(store.size() == 1);
+    }
+
+    SECTION("erase by other relay propagates")
+    {
+      uint64_t registration[] = { a_id }, data[] = { a_id, 100 };
+      relay.on_client_received(a_src, registration);
+      auto session = test_lib::session::last_created();
+      REQUIRE(session != nullptr);
+
+      // evicted by other process while send is in flight
+      CHECK(relay.on_peer_received(b_src, data));
+      auto other = store;
+      other.set_writer_id(2);
+      REQUIRE(other.erase(a_id));
+
+      // in flight: kept until send completes, but not forwarded to
+      CHECK_FALSE(relay.on_peer_received(b_src, data));
+      CHECK(peer.is_start_recv_invoked());
+      CHECK(relay.find_session(a_id) == session);
+
+      relay.on_session_sent(*session, data);
+      CHECK_FALSE(relay.on_peer_received(b_src, data));
+      CHECK(relay.find_session(a_id) == nullptr);
+    }
+
+    SECTION("re-registration by other relay propagates")
+    {
+      constexpr test_lib::endpoint c_src = 33;
+      uint64_t registration[] = { a_id }, data[] = { a_id, 100 };
+      relay.on_client_received(a_src, registration);
+      REQUIRE(test_lib::session::last_created() != nullptr);
+
+      auto other = store;
+      other.set_writer_id(2);
+      REQUIRE(other.insert(a_id, {c_src, 0}));
+
+      CHECK(relay.on_peer_received(b_src, data));
+      auto session = test_lib::session::last_created();
+      REQUIRE(session != nullptr);
+      CHECK(session->client_endpoint == c_src);
+      CHECK(session->is_start_send_invoked());
+      CHECK(relay.find_session(a_id) == session);
+      relay.on_session_sent(*session, data);
+    }
+
+    SECTION("unrelated erase does not drop session")
+    {
+      uint64_t registration[] = { a_id }, data[] = { a_id, 100 };
+      relay.on_client_received(a_src, registration);
+      auto session = test_lib::session::last_created();
+      REQUIRE(session != nullptr);
+      REQUIRE(store.insert(b_id, {b_src, 0}));
+      REQUIRE(store.erase(b_id));
+
+      CHECK(relay.on_peer_received(b_src, data));
+      CHECK(session->is_start_send_invoked());
+      CHECK(test_lib::session::last_created() == nullptr);
+      relay.on_session_sent(*session, data);
+    }
+
+    SECTION("stale session frees its budget slot")
+    {
+      relay.set_session_budget(1);
+      uint64_t registration[] = { a_id }, data[] = { a_id, 100 };
+      relay.on_client_received(a_src, registration);
+      REQUIRE(test_lib::session::last_created() != nullptr);
+      REQUIRE(store.erase(a_id));
+      CHECK_FALSE(relay.on_peer_received(b_src, data));
+      CHECK(relay.find_session(a_id) == nullptr);
+
+      uint64_t b_data[] = { b_id };
+      relay.on_client_received(b_src, b_data);
+      REQUIRE(test_lib::session::last_created() != nullptr);
+      CHECK(relay.find_session(b_id) != nullptr);
+    }
+
+    SECTION("restore keeps client port index")
+    {
+      // dual-stack listener layout with port range: IPv4 ports 0..1, IPv6
+      // ports 2..3; replies must leave from port that got registration
+      constexpr test_lib::endpoint c_src = 33;
+      for (auto [id, src, port]: {
+        std::tuple{a_id, a_src, size_t{1}},
+        {b_id, b_src, size_t{3}},
+        {uint64_t{3}, c_src, size_t{2}}})
+      {
+        uint64_t data[] = { id };
+        relay.on_client_received(src, data, port);
+        REQUIRE(test_lib::session::last_created() != nullptr);
+      }
+
+      // restarted relay restores sessions from peer packets (last client
+      // packet was received on port 0)
+      typename TestType::client_type restarted_client{};
+      typename TestType::peer_type restarted_peer{};
+      TestType restarted{1, restarted_client, restarted_peer, port_count,
+        test_allocator<TestType>()
+      };
+      restarted.on_thread_start(0);
+      restarted.set_session_store(&store);
+      uint64_t registration[] = { 4 };
+      restarted.on_client_received(a_src, registration, 0);
+      REQUIRE(test_lib::session::last_created() != nullptr);
+
+      for (auto [id, src, port]: {
+        std::tuple{a_id, a_src, size_t{1}},
+        {b_id, b_src, size_t{3}},
+        {uint64_t{3}, c_src, size_t{2}}})
+      {
+        uint64_t data[] = { id, 100 };
+        CHECK(restarted.on_peer_received(b_src, data, 3));
+        auto session = test_lib::session::last_created();
+        REQUIRE(session != nullptr);
+        CHECK(session->client_endpoint == src);
+        CHECK(session->port_index == port);
+        restarted.on_session_sent(*session, data);
+      }
+
+      // record from other listener layout: dropped
+      REQUIRE(store.insert(5, {a_src, port_count}));
+      uint64_t data[] = { 5, 100 };
+      CHECK_FALSE(restarted.on_peer_received(b_src, data, 3));
+      CHECK(test_lib::session::last_created() == nullptr);
+
+      restarted.set_session_store(nullptr);
+      relay.on_thread_start(0);
+    }
+
+    SECTION("two workers with port range")
+    {
+      // same listener layout in both workers, client port range 0..3
+      store.set_writer_id(1);
+      auto worker_store = store;
+      worker_store.set_writer_id(2);
+      typename TestType::client_type worker_client{};
+      typename TestType::peer_type worker_peer{};
+      TestType worker{1, worker_client, worker_peer, port_count,
+        test_allocator<TestType>()
+      };
+      worker.on_thread_start(0);
+      worker.set_session_store(&worker_store);
+
+      relay.on_thread_start(0);
+      for (auto [id, src, port]: {std::tuple{a_id, a_src, size_t{1}}, {b_id, b_src, size_t{3}}})
+      {
+        uint64_t data[] = { id };
+        relay.on_client_received(src, data, port);
+        REQUIRE(test_lib::session::last_created() != nullptr);
+      }
+
+      // peer packets steered to other worker
+      worker.on_thread_start(0);
+      for (auto [id, src, port]: {std::tuple{a_id, a_src, size_t{1}}, {b_id, b_src, size_t{3}}})
+      {
+        uint64_t data[] = { id, 100 };
+        CHECK(worker.on_peer_received(b_src, data, port_count - 1));
+        auto session = test_lib::session::last_created();
+        REQUIRE(session != nullptr);
+        CHECK(session->client_endpoint == src);
+        CHECK(session->port_index == port);
+        worker.on_session_sent(*session, data);
+      }
+
+      // and other way around
+      constexpr uint64_t c_id = 3;
+      constexpr test_lib::endpoint c_src = 33;
+      uint64_t registration[] = { c_id };
+      worker.on_client_received(c_src, registration, 2);
+      REQUIRE(test_lib::session::last_created() != nullptr);
+
+      relay.on_thread_start(0);
+      uint64_t data[] = { c_id, 100 };
+      CHECK(relay.on_peer_received(b_src, data, port_count - 1));
+      auto session = test_lib::session::last_created();
+      REQUIRE(session != nullptr);
+      CHECK(session->client_endpoint == c_src);
+      CHECK(session->port_index == 2);
+      relay.on_session_sent(*session, data);
+
+      worker.set_session_store(nullptr);
+    }
+
+    relay.set_session_store(nullptr);
+  }
+
+
+  SECTION("session handoff")
+  {
+    relay.set_fan_out(2);
+    constexpr test_lib::endpoint c_src = 33;
+    for (auto [id, src]: {std::pair{a_id, a_src}, {a_id, c_src}, {b_id, b_src}})
+    {
+      uint64_t data[] = { id };
+      relay.on_client_received(src, data, src % port_count);
+      REQUIRE(test_lib::session::last_created() != nullptr);
+    }
+
+    std::vector<std::tuple<uint64_t, test_lib::endpoint, size_t>> sessions;
+    relay.for_each_session(
+      [&sessions](uint64_t id, const test_lib::session &session)
+      {
+        sessions.emplace_back(id, session.client_endpoint, session.port_index);
+      }
+    );
+    std::sort(sessions.begin(), sessions.end());
+    CHECK(sessions == decltype(sessions){
+      {a_id, a_src, a_src % port_count},
+      {a_id, c_src, c_src % port_count},
+      {b_id, b_src, b_src % port_count}
+    });
+
+    // other relay receives same sessions
+    typename TestType::client_type other_client{};
+    typename TestType::peer_type other_peer{};
+    TestType other{1, other_client, other_peer, port_count, test_allocator<TestType>()};
+    other.on_thread_start(0);
+    other.set_fan_out(2);
+    for (auto &[id, src, port]: sessions)
+    {
+      CHECK(other.import_session(id, src, port));
+    }
+    CHECK_FALSE(other.import_session(b_id, b_src, 0));
+    CHECK_FALSE(other.import_session(3, a_src, port_count));
+
+    // already admitted by sending relay: per-source limit does not apply
+    other.set_registration_limit(1, 0);
+    other.on_clock_tick(std::chrono::milliseconds{1000});
+    CHECK(other.import_session(3, a_src + 100, 0));
+    CHECK(other.import_session(4, a_src + 200, 0));
+
+    uint64_t data[] = { a_id, 100 };
+    CHECK(other.on_peer_received(b_src, data));
+    auto session = other.find_session(a_id);
+    REQUIRE(session != nullptr);
+    CHECK(session->client_endpoint == a_src);
+    CHECK(session->port_index == a_src % port_count);
+    CHECK(session->is_start_send_invoked());
+
+    // per-thread statistics pointer is shared by relays of same type
+    relay.on_thread_start(0);
+  }
+
+
   SECTION("on_peer_received: invalid data")
   {
     char data[] = { 'a' };
@@ -239,6 +780,281 @@ TEMPLATE_TEST_CASE("relay", "",
   }
 
 
+  SECTION("on_peer_received: no allocations once warmed up")
+  {
+    // fan-out session a and single endpoint session b
+    relay.set_fan_out(2);
+    test_lib::session *a1 = nullptr, *a2 = nullptr, *b = nullptr;
+    {
+      uint64_t data[] = { a_id };
+      relay.on_client_received(a_src, data);
+      a1 = test_lib::session::last_created();
+      relay.on_client_received(b_src, data);
+      a2 = test_lib::session::last_created();
+
+      data[0] = b_id;
+      relay.on_client_received(a_src + 100, data);
+      b = test_lib::session::last_created();
+
+      REQUIRE(a1 != nullptr);
+      REQUIRE(a2 != nullptr);
+      REQUIRE(b != nullptr);
+    }
+
+    // first packets size per-thread fan-out buffer and allocate sessions'
+    // channel tables (once per session, like registration)
+    uint64_t a_data[] = { a_id, 100 }, b_data[] = { b_id, 100 };
+    REQUIRE(relay.on_peer_received(a_src, a_data));
+    relay.on_session_sent(*a1, a_data);
+    relay.on_session_sent(*a2, a_data);
+    REQUIRE(relay.on_peer_received(b_src, b_data));
+    relay.on_session_sent(*b, b_data);
+
+    // Catch assertions allocate, check only after measuring
+    constexpr size_t packets = 100;
+    size_t forwarded = 0;
+    urn::alloc_tracking::scope allocs;
+    for (auto i = 0U;  i != packets;  ++i)
+    {
+      forwarded += relay.on_peer_received(a_src, a_data);
+      relay.on_session_sent(*a1, a_data);
+      relay.on_session_sent(*a2, a_data);
+
+      // including unknown peer endpoints when channel table is full
+      forwarded += relay.on_peer_received(b_src + 100 * i, b_data);
+      relay.on_session_sent(*b, b_data);
+    }
+    const auto allocations = allocs.allocations();
+
+    CHECK(forwarded == 2 * packets);
+    CHECK(allocations == 0);
+  }
+
+
+  SECTION("on_peer_received: fan-out")
+  {
+    relay.set_fan_out(2);
+    constexpr test_lib::endpoint c_src = 33;
+
+    test_lib::session *a = nullptr, *b = nullptr;
+    {
+      uint64_t data[] = { a_id };
+      relay.on_client_received(a_src, data);
+      a = test_lib::session::last_created();
+      REQUIRE(a != nullptr);
+
+      // same id from other endpoint joins session
+      relay.on_client_received(b_src, data);
+      b = test_lib::session::last_created();
+      REQUIRE(b != nullptr);
+      CHECK(b->client_endpoint == b_src);
+      CHECK(relay.find_session(a_id) == a);
+
+      // retransmitted registration is not duplicated
+      relay.on_client_received(b_src, data);
+      CHECK(test_lib::session::last_created() == nullptr);
+
+      // over limit
+      relay.on_client_received(c_src, data);
+      CHECK(test_lib::session::last_created() == nullptr);
+    }
+
+    // forward to both
+    uint64_t data[] = { a_id, 100 };
+    CHECK(peer.is_start_recv_invoked());
+    CHECK(relay.on_peer_received(a_src, data));
+    CHECK(a->is_start_send_invoked());
+    CHECK(b->is_start_send_invoked());
+    CHECK_FALSE(peer.is_start_recv_invoked());
+    relay.on_session_sent(*a, data);
+    relay.on_session_sent(*b, data);
+    CHECK(peer.is_start_recv_invoked());
+
+    // single endpoint session is not affected
+    {
+      uint64_t data[] = { b_id };
+      relay.on_client_received(c_src, data);
+      REQUIRE(test_lib::session::last_created() != nullptr);
+    }
+    uint64_t b_data[] = { b_id, 100 };
+    CHECK(relay.on_peer_received(c_src, b_data));
+    CHECK_FALSE(a->is_start_send_invoked());
+    CHECK_FALSE(b->is_start_send_invoked());
+  }
+
+
+  SECTION("on_client_received: client to peer forwarding")
+  {
+    constexpr test_lib::endpoint peer_src = 44;
+    test_lib::session *session = nullptr;
+    {
+      uint64_t data[] = { a_id };
+      relay.on_client_received(a_src, data);
+      session = test_lib::session::last_created();
+      REQUIRE(session != nullptr);
+    }
+    uint64_t client_data[] = { a_id, 100 };
+
+    // peer endpoint not known yet
+    CHECK(client.is_start_recv_invoked());
+    CHECK_FALSE(relay.on_client_received(a_src, client_data));
+    CHECK_FALSE(peer.is_start_send_invoked());
+    CHECK(client.is_start_recv_invoked());
+
+    // learned from first peer packet
+    {
+      uint64_t data[] = { a_id, 100 };
+      REQUIRE(relay.on_peer_received(peer_src, data, 0));
+      relay.on_session_sent(*session, data);
+    }
+
+    CHECK(relay.on_client_received(a_src, client_data));
+    CHECK(peer.is_start_send_invoked());
+    CHECK(peer.send_dst == peer_src);
+    CHECK(peer.send_port_index == 0);
+
+    // new receive is started only after peer start_send has finished
+    CHECK_FALSE(client.is_start_recv_invoked());
+    relay.on_peer_sent(client_data);
+    CHECK(client.is_start_recv_invoked());
+
+    // peer endpoint is not changed by later packets
+    {
+      uint64_t data[] = { a_id, 100 };
+      REQUIRE(relay.on_peer_received(peer_src + 1, data, 0));
+      relay.on_session_sent(*session, data);
+    }
+    CHECK(relay.on_client_received(a_src, client_data));
+    CHECK(peer.is_start_send_invoked());
+    CHECK(peer.send_dst == peer_src);
+    relay.on_peer_sent(client_data);
+
+    // unregistered client endpoint
+    CHECK_FALSE(relay.on_client_received(b_src, client_data));
+    CHECK_FALSE(peer.is_start_send_invoked());
+  }
+
+
+  SECTION("ChannelData")
+  {
+    relay.set_channel_data(2);
+    constexpr test_lib::endpoint p1 = 44, p2 = 45, p3 = 46;
+
+    test_lib::session *session = nullptr;
+    {
+      uint64_t data[] = { a_id };
+      relay.on_client_received(a_src, data);
+      session = test_lib::session::last_created();
+      REQUIRE(session != nullptr);
+    }
+
+    SECTION("peer to client")
+    {
+      // session id tail is rewritten into header: channel + length
+      uint64_t data[] = { a_id, 100 };
+      REQUIRE(relay.on_peer_received(p1, data, 1));
+      CHECK(session->is_start_send_invoked());
+      auto bytes = reinterpret_cast<const uint8_t *>(data);
+      CHECK(session->sent_data == reinterpret_cast<const std::byte *>(bytes + 4));
+      CHECK(session->sent_size == 4 + sizeof(uint64_t));
+      CHECK(bytes[4] == 0x40);
+      CHECK(bytes[5] == 0x00);
+      CHECK(bytes[6] == 0x00);
+      CHECK(bytes[7] == sizeof(uint64_t));
+      CHECK(data[1] == 100);
+      relay.on_session_sent(*session, data);
+
+      // next peer is bound to next channel
+      uint64_t p2_data[] = { a_id, 200 };
+      REQUIRE(relay.on_peer_received(p2, p2_data, 1));
+      CHECK(session->is_start_send_invoked());
+      bytes = reinterpret_cast<const uint8_t *>(p2_data);
+      CHECK(bytes[4] == 0x40);
+      CHECK(bytes[5] == 0x01);
+      relay.on_session_sent(*session, p2_data);
+
+      // same peer keeps channel
+      uint64_t p1_data[] = { a_id, 300 };
+      REQUIRE(relay.on_peer_received(p1, p1_data, 1));
+      CHECK(session->is_start_send_invoked());
+      bytes = reinterpret_cast<const uint8_t *>(p1_data);
+      CHECK(bytes[5] == 0x00);
+      relay.on_session_sent(*session, p1_data);
+
+      // channel table full
+      CHECK(peer.is_start_recv_invoked());
+      uint64_t p3_data[] = { a_id, 400 };
+      CHECK_FALSE(relay.on_peer_received(p3, p3_data, 1));
+      CHECK_FALSE(session->is_start_send_invoked());
+      CHECK(peer.is_start_recv_invoked());
+    }
+
+    SECTION("client to peer")
+    {
+      for (auto src: { p1, p2 })
+      {
+        uint64_t data[] = { a_id, 100 };
+        REQUIRE(relay.on_peer_received(src, data, 1));
+        relay.on_session_sent(*session, data);
+      }
+
+      // channel 0x4001, 5B payload + padding
+      uint8_t data[] = { 0x40, 0x01, 0x00, 0x05, 'h', 'e', 'l', 'l', 'o', 0, 0, 0 };
+      CHECK(relay.on_client_received(a_src, data));
+      CHECK(peer.is_start_send_invoked());
+      CHECK(peer.send_dst == p2);
+      CHECK(peer.send_port_index == 1);
+      CHECK(peer.send_data == reinterpret_cast<const std::byte *>(data + 4));
+      CHECK(peer.send_size == 5);
+      relay.on_peer_sent(data);
+
+      SECTION("unbound channel")
+      {
+        data[1] = 0x05;
+        CHECK_FALSE(relay.on_client_received(a_src, data));
+      }
+
+      SECTION("invalid length")
+      {
+        data[3] = 9;
+        CHECK_FALSE(relay.on_client_received(a_src, data));
+      }
+
+      SECTION("not ChannelData")
+      {
+        data[0] = 0x80;
+        CHECK_FALSE(relay.on_client_received(a_src, data));
+      }
+
+      CHECK_FALSE(peer.is_start_send_invoked());
+    }
+
+    SECTION("client to peer: 4B payload")
+    {
+      uint64_t peer_data[] = { a_id, 100 };
+      REQUIRE(relay.on_peer_received(p1, peer_data, 1));
+      relay.on_session_sent(*session, peer_data);
+
+      // same size as registration, but bound channel
+      uint8_t data[] = { 0x40, 0x00, 0x00, 0x04, 'p', 'i', 'n', 'g' };
+      static_assert(sizeof(data) == sizeof(uint64_t));
+      CHECK(relay.on_client_received(a_src, data));
+      CHECK(peer.is_start_send_invoked());
+      CHECK(peer.send_dst == p1);
+      CHECK(peer.send_data == reinterpret_cast<const std::byte *>(data + 4));
+      CHECK(peer.send_size == 4);
+      relay.on_peer_sent(data);
+      CHECK(test_lib::session::last_created() == nullptr);
+
+      // unbound channel: registration
+      data[1] = 0x01;
+      CHECK_FALSE(relay.on_client_received(b_src, data));
+      CHECK_FALSE(peer.is_start_send_invoked());
+      CHECK(test_lib::session::last_created() != nullptr);
+    }
+  }
+
+
   SECTION("on_peer_received: no cross-forwarding")
   {
     // register a
@@ -274,6 +1090,164 @@ TEMPLATE_TEST_CASE("relay", "",
       CHECK(peer.is_start_recv_invoked());
     }
   }
+
+
+  SECTION("on_peer_received: session rate limit")
+  {
+    // 16B packets, burst of 2
+    relay.set_session_rate_limit(16'000, 32);
+    relay.on_clock_tick(std::chrono::milliseconds{1000});
+
+    test_lib::session *session = nullptr;
+    {
+      uint64_t data[] = { a_id };
+      relay.on_client_received(a_src, data);
+      CHECK(peer.is_start_recv_invoked());
+      session = test_lib::session::last_created();
+      REQUIRE(session != nullptr);
+    }
+
+    uint64_t data[] = { a_id, 100 };
+    for (auto i = 0;  i != 2;  ++i)
+    {
+      CHECK(relay.on_peer_received(a_src, data));
+      CHECK(session->is_start_send_invoked());
+      relay.on_session_sent(*session, data);
+      CHECK(peer.is_start_recv_invoked());
+    }
+
+    // over limit: dropped before start_send, receive restarted
+    CHECK_FALSE(relay.on_peer_received(a_src, data));
+    CHECK_FALSE(session->is_start_send_invoked());
+    CHECK(peer.is_start_recv_invoked());
+
+    // 1ms later, single packet worth of tokens is refilled
+    relay.on_clock_tick(std::chrono::milliseconds{1001});
+    CHECK(relay.on_peer_received(a_src, data));
+    CHECK(session->is_start_send_invoked());
+    relay.on_session_sent(*session, data);
+    CHECK_FALSE(relay.on_peer_received(a_src, data));
+  }
+}
+
+
+TEST_CASE("relay: allocator")
+{
+  // everything relay allocates comes from fixed buffer (upstream throws)
+  std::array<std::byte, 256 * 1024> buffer{};
+  std::pmr::monotonic_buffer_resource resource{
+    buffer.data(),
+    buffer.size(),
+    std::pmr::null_memory_resource()
+  };
+
+  pool_allocated::client_type client{};
+  pool_allocated::peer_type peer{};
+
+  // Catch assertions allocate, check only after measuring
+  urn::alloc_tracking::scope allocs;
+  {
+    pool_allocated relay{2, client, peer, 2, &resource};
+    relay.set_registration_limit(100, 0);
+    relay.set_session_budget(16);
+    relay.set_fan_out(2);
+    relay.set_channel_data(4);
+    relay.on_thread_start(0);
+
+    uint64_t registration[] = { 1 };
+    relay.on_client_received(11, registration);
+    auto a = test_lib::session::last_created();
+    relay.on_client_received(22, registration);
+    auto b = test_lib::session::last_created();
+    registration[0] = 2;
+    relay.on_client_received(33, registration);
+
+    // binds channel
+    uint64_t data[] = { 2, 100 };
+    if (relay.on_peer_received(44, data))
+    {
+      relay.on_session_sent(*relay.find_session(2), data);
+    }
+
+    // fanned out to both endpoints
+    uint64_t fan_out_data[] = { 1, 100 };
+    if (a && b && relay.on_peer_received(44, fan_out_data))
+    {
+      relay.on_session_sent(*a, fan_out_data);
+      relay.on_session_sent(*b, fan_out_data);
+    }
+  }
+  const auto allocations = allocs.allocations();
+
+  CHECK(allocations == 0);
+}
+
+
+TEST_CASE("relay: allocator exhausted")
+{
+  // construction fails with allocator's exception, not std::terminate()
+  std::array<std::byte, 64> buffer{};
+  std::pmr::monotonic_buffer_resource resource{
+    buffer.data(),
+    buffer.size(),
+    std::pmr::null_memory_resource()
+  };
+
+  pool_allocated::client_type client{};
+  pool_allocated::peer_type peer{};
+  CHECK_THROWS_AS((pool_allocated{16, client, peer, 16, &resource}),
+    std::bad_alloc
+  );
+}
+
+
+TEST_CASE("relay: session_memory_size")
+{
+  // bytes allocated per session, measured through allocator
+  struct counting_resource: std::pmr::memory_resource
+  {
+    size_t allocated = 0;
+
+    void *do_allocate (size_t bytes, size_t alignment) override
+    {
+      allocated += bytes;
+      return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+
+    void do_deallocate (void *p, size_t bytes, size_t alignment) override
+    {
+      allocated -= bytes;
+      std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+    }
+
+    bool do_is_equal (const std::pmr::memory_resource &that) const noexcept
+      override
+    {
+      return this == &that;
+    }
+  } resource;
+
+  constexpr size_t session_count = 1024;
+  pool_allocated::client_type client{};
+  pool_allocated::peer_type peer{};
+  pool_allocated relay{1, client, peer, 1, &resource};
+  relay.set_channel_data(2);
+  relay.on_thread_start(0);
+  const auto empty = resource.allocated;
+
+  relay.set_session_budget(session_count);
+  for (uint64_t id = 1;  id <= session_count;  ++id)
+  {
+    uint64_t registration[] = { id }, data[] = { id, 100 };
+    relay.on_client_received(id, registration);
+    REQUIRE(relay.on_peer_received(id, data));
+    relay.on_session_sent(*relay.find_session(id), data);
+  }
+  const auto measured = (resource.allocated - empty) / session_count;
+
+  // estimate does not know standard library's node layout
+  CHECK(relay.session_memory_size() <= measured * 5 / 4);
+  CHECK(relay.session_memory_size() >= measured * 3 / 4);
 }
 
 
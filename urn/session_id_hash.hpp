@@ -0,0 +1,69 @@
+#pragma once
+
+/**
+ * \file urn/session_id_hash.hpp
+ * Session id hash policies for urn::relay session table
+ *
+ * Session ids are chosen by clients. With identity hash (std::hash<uint64_t>
+ * in libstdc++ and libc++), ids that are multiples of table's bucket count
+ * land in same bucket and every lookup walks that chain.
+ */
+
+#include <urn/__bits/lib.hpp>
+#include <urn/__bits/mix.hpp>
+
+
+__urn_begin
+
+
+/**
+ * Default: splitmix64 finalizer of id mixed with per-instance random seed.
+ * Colliding ids can't be chosen without knowing seed.
+ */
+class seeded_session_id_hash
+{
+public:
+
+  // random seed
+  seeded_session_id_hash () noexcept
+    : seed_{random_seed()}
+  { }
+
+
+  explicit seeded_session_id_hash (uint64_t seed) noexcept
+    : seed_{seed}
+  { }
+
+
+  size_t operator() (uint64_t id) const noexcept
+  {
+    return static_cast<size_t>(mix(id, seed_));
+  }
+
+
+  uint64_t seed () const noexcept
+  {
+    return seed_;
+  }
+
+
+private:
+
+  uint64_t seed_;
+};
+
+
+/**
+ * Id as is: cheapest, for trusted deployments where clients can't pick
+ * session ids (e.g. ids assigned by own signalling)
+ */
+struct identity_session_id_hash
+{
+  size_t operator() (uint64_t id) const noexcept
+  {
+    return static_cast<size_t>(id);
+  }
+};
+
+
+__urn_end
@@ -0,0 +1,93 @@
+#include <urn/session_id_hash.hpp>
+#include <urn/common.test.hpp>
+#include <algorithm>
+#include <unordered_set>
+
+
+namespace {
+
+
+// multiples of this collide in identity hashed table reserved for \a count
+size_t reserved_bucket_count (size_t count)
+{
+  std::unordered_set<uint64_t, urn::identity_session_id_hash> set;
+  set.reserve(count);
+  return set.bucket_count();
+}
+
+
+template <typename Hash>
+size_t longest_chain (const Hash &hash, size_t count)
+{
+  const auto bucket_count = reserved_bucket_count(count);
+  std::unordered_set<uint64_t, Hash> set{0, hash};
+  set.reserve(count);
+  REQUIRE(set.bucket_count() == bucket_count);
+
+  for (uint64_t i = 1;  i <= count;  ++i)
+  {
+    set.insert(i * bucket_count);
+  }
+
+  size_t result = 0;
+  for (size_t bucket = 0;  bucket != set.bucket_count();  ++bucket)
+  {
+    result = (std::max)(result, set.bucket_size(bucket));
+  }
+  return result;
+}
+
+
+TEST_CASE("session_id_hash: identity")
+{
+  urn::identity_session_id_hash hash;
+  CHECK(hash(0) == 0);
+  CHECK(hash(12345) == 12345);
+
+  // all adversarial ids in single bucket
+  CHECK(longest_chain(hash, 1000) == 1000);
+}
+
+
+TEST_CASE("session_id_hash: seeded")
+{
+  urn::seeded_session_id_hash a{1}, b{2};
+  CHECK(a.seed() == 1);
+  CHECK(b.seed() == 2);
+
+
+  SECTION("deterministic")
+  {
+    urn::seeded_session_id_hash c{1};
+    for (uint64_t id = 0;  id != 100;  ++id)
+    {
+      CHECK(a(id) == c(id));
+    }
+  }
+
+
+  SECTION("seed changes hash")
+  {
+    for (uint64_t id = 0;  id != 100;  ++id)
+    {
+      CHECK(a(id) != b(id));
+    }
+  }
+
+
+  SECTION("random seed")
+  {
+    urn::seeded_session_id_hash c, d;
+    CHECK(c.seed() != d.seed());
+  }
+
+
+  SECTION("adversarial ids are spread")
+  {
+    CHECK(longest_chain(a, 1000) < 10);
+    CHECK(longest_chain(urn::seeded_session_id_hash{}, 1000) < 10);
+  }
+}
+
+
+} // namespace
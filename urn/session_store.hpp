@@ -0,0 +1,571 @@
+#pragma once
+
+/**
+ * \file urn/session_store.hpp
+ * Fixed-layout session id to endpoint table over caller-provided memory
+ */
+
+#include <urn/__bits/lib.hpp>
+#include <urn/__bits/mix.hpp>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+
+
+__urn_begin
+
+
+/**
+ * Open-addressing (linear probing) hash table of session id -> \a Endpoint
+ * in single memory block: header followed by power of 2 slots. Layout has
+ * no pointers and is identical between processes of same build, so block
+ * can be memory-mapped file that outlives process: restarted process
+ * attaches with open() in O(1) and looks sessions up directly from
+ * mapping.
+ *
+ * Header carries magic, layout version, slot size, hash seed and caller's
+ * tag, open() rejects block created with other layout or tag (e.g. caller
+ * configuration that \a Endpoint values refer to has changed).
+ *
+ * Concurrency:
+ *  - find() is lock-free, each slot is seqlock (odd sequence while slot is
+ *    being written), all fields are atomics so that torn reads are only
+ *    retried, never undefined
+ *  - insert() and erase() serialize on spinlock in header, i.e. writers may
+ *    be in different processes sharing mapping. Lock word holds writer id
+ *    of its holder, lock left by crashed process is released with
+ *    release_writer_lock(). Writer gives up after max_lock_retries: if
+ *    liveness check (see set_writer_liveness_check()) reports holder dead,
+ *    lock is taken over, otherwise insert() or erase() fails
+ *  - generation() changes whenever entry is erased or replaced with other
+ *    endpoint, i.e. process caching entries revalidates them only when it
+ *    changes
+ *
+ * Erased slots are left as tombstones (probing continues past them) and
+ * reused by insert(). insert() places entry at most max_probe_length slots
+ * from its home slot and header records largest such displacement: find()
+ * and erase() probe no further, so miss costs O(max_displacement()) even
+ * when churn has turned every empty slot into tombstone.
+ * Store is sized by caller, there is no rehash.
+ */
+template <typename Endpoint>
+class session_store
+{
+  static_assert(std::is_trivially_copyable_v<Endpoint>,
+    "Endpoint must be trivially copyable"
+  );
+  static_assert(std::atomic<uint64_t>::is_always_lock_free,
+    "shared mapping needs address-free atomics"
+  );
+
+public:
+
+  // "urn-sess"
+  static constexpr uint64_t magic = 0x7373'6573'2d6e'7275;
+  static constexpr uint32_t version = 4;
+
+  // insert() gives up if there is no free slot this close to home slot
+  static constexpr size_t max_probe_length = 128;
+
+  // find() gives up on slot that stays locked (writer died mid-write)
+  static constexpr size_t max_read_retries = 1024;
+
+  // insert() and erase() give up on writer lock held by other writer
+  static constexpr size_t max_lock_retries = 16 * 1024;
+
+  // returns false if writer with given id is known to be gone
+  using writer_liveness_check = bool (*)(uint32_t writer_id) noexcept;
+
+
+  session_store (const session_store &) = default;
+  session_store &operator= (const session_store &) = default;
+
+
+  /**
+   * Bytes needed for store of \a capacity slots
+   */
+  static constexpr size_t memory_size (size_t capacity) noexcept
+  {
+    return sizeof(header) + capacity * sizeof(slot);
+  }
+
+
+  /**
+   * Format \a memory (at least memory_size(\a capacity) bytes, aligned for
+   * uint64_t) as empty store. \a capacity must be power of 2, \a seed
+   * randomizes slot placement, \a tag is checked by open(). Throws
+   * std::runtime_error on invalid capacity.
+   */
+  static session_store create (void *memory,
+    size_t capacity,
+    uint64_t seed,
+    uint64_t tag = 0)
+  {
+    if (!capacity || (capacity & (capacity - 1)))
+    {
+      throw std::runtime_error("session_store: capacity must be power of 2");
+    }
+
+    auto h = new(memory) header{};
+    h->version = version;
+    h->slot_size = sizeof(slot);
+    h->capacity = capacity;
+    h->seed = seed;
+    h->tag = tag;
+
+    auto slots = reinterpret_cast<slot *>(h + 1);
+    for (size_t i = 0;  i != capacity;  ++i)
+    {
+      new(slots + i) slot{};
+    }
+
+    // published last: partially formatted block is never opened
+    h->magic.store(magic, std::memory_order_release);
+    return session_store{h};
+  }
+
+
+  /**
+   * Attach to store previously created in \a memory of \a size bytes with
+   * \a tag. Throws std::runtime_error if header does not match this build's
+   * layout or \a tag. No process may be writing into store: writer lock
+   * left by crashed process is released.
+   */
+  static session_store open (void *memory, size_t size, uint64_t tag = 0)
+  {
+    if (size < sizeof(header))
+    {
+      throw std::runtime_error("session_store: truncated header");
+    }
+
+    auto h = static_cast<header *>(memory);
+    if (h->magic.load(std::memory_order_acquire) != magic)
+    {
+      throw std::runtime_error("session_store: invalid magic");
+    }
+    if (h->version != version || h->slot_size != sizeof(slot))
+    {
+      throw std::runtime_error("session_store: layout version mismatch");
+    }
+    if (h->tag != tag)
+    {
+      throw std::runtime_error("session_store: tag mismatch");
+    }
+    if (!h->capacity
+      || (h->capacity & (h->capacity - 1))
+      || memory_size(h->capacity) > size)
+    {
+      throw std::runtime_error("session_store: invalid capacity");
+    }
+    if (h->max_displacement.load(std::memory_order_relaxed) >= h->capacity)
+    {
+      throw std::runtime_error("session_store: invalid displacement");
+    }
+
+    h->writer.store(0, std::memory_order_release);
+    return session_store{h};
+  }
+
+
+  /**
+   * Insert or replace \a id endpoint. Returns false if store is full, i.e.
+   * there is no free slot within max_probe_length slots of \a id home slot,
+   * or writer lock was not acquired.
+   */
+  bool insert (uint64_t id, const Endpoint &endpoint) noexcept
+  {
+    writer_lock lock{*header_, writer_id_, writer_liveness_check_};
+    if (!lock)
+    {
+      return false;
+    }
+
+    // existing id is within max_displacement, free slot may be beyond it
+    const auto max_displacement = this->max_displacement();
+    const auto probe_limit = (std::min)(header_->capacity, uint64_t{max_probe_length});
+
+    slot *target = nullptr;
+    size_t target_displacement = 0;
+    for (size_t i = 0, index = home(id);  i != probe_limit;  ++i, index = next(index))
+    {
+      auto &s = slot_for_write(index);
+      auto state = s.state.load(std::memory_order_relaxed);
+      if (state == used)
+      {
+        if (s.id.load(std::memory_order_relaxed) == id)
+        {
+          auto words = to_words(endpoint);
+          if (!equal(s.endpoint, words))
+          {
+            write(s, id, used, words);
+            next_generation();
+          }
+          return true;
+        }
+      }
+      else if (!target)
+      {
+        target = &s;
+        target_displacement = i;
+      }
+
+      if (state == empty || (target && i >= max_displacement))
+      {
+        break;
+      }
+    }
+
+    if (!target)
+    {
+      return false;
+    }
+    if (target_displacement > max_displacement)
+    {
+      header_->max_displacement.store(target_displacement, std::memory_order_relaxed);
+    }
+    write(*target, id, used, to_words(endpoint));
+    header_->size.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+
+
+  /**
+   * Remove \a id. Returns false if not found or writer lock was not
+   * acquired.
+   */
+  bool erase (uint64_t id) noexcept
+  {
+    writer_lock lock{*header_, writer_id_, writer_liveness_check_};
+    if (!lock)
+    {
+      return false;
+    }
+
+    for (size_t i = 0, index = home(id);  i != probe_limit();  ++i, index = next(index))
+    {
+      auto &s = slot_for_write(index);
+      auto state = s.state.load(std::memory_order_relaxed);
+      if (state == empty)
+      {
+        break;
+      }
+      if (state == used && s.id.load(std::memory_order_relaxed) == id)
+      {
+        write(s, id, deleted, {});
+        header_->size.fetch_sub(1, std::memory_order_relaxed);
+        next_generation();
+        return true;
+      }
+    }
+    return false;
+  }
+
+
+  /**
+   * Copy \a id endpoint into \a endpoint. Returns false if not found.
+   */
+  bool find (uint64_t id, Endpoint &endpoint) const noexcept
+  {
+    for (size_t i = 0, index = home(id), limit = probe_limit();  i != limit;  ++i, index = next(index))
+    {
+      snapshot s;
+      if (!read(slots_[index], s) || s.state == empty)
+      {
+        return false;
+      }
+      if (s.state == used && s.id == id)
+      {
+        std::memcpy(&endpoint, s.endpoint.data(), sizeof(endpoint));
+        return true;
+      }
+    }
+    return false;
+  }
+
+
+  /**
+   * Set writer lock owner id of this handle (non-zero, default 1). Processes
+   * sharing store use distinct ids (e.g. pid).
+   */
+  void set_writer_id (uint32_t id) noexcept
+  {
+    writer_id_ = id;
+  }
+
+
+  /**
+   * Use \a check to find out if writer holding lock past max_lock_retries
+   * is still alive (e.g. kill(pid, 0) for pid writer ids). Null (default)
+   * assumes it is.
+   */
+  void set_writer_liveness_check (writer_liveness_check check) noexcept
+  {
+    writer_liveness_check_ = check;
+  }
+
+
+  /**
+   * Release writer lock if it is held by \a id (owner died while holding
+   * it). Returns true if lock was released.
+   */
+  bool release_writer_lock (uint32_t id) noexcept
+  {
+    return header_->writer.compare_exchange_strong(id, 0,
+      std::memory_order_release,
+      std::memory_order_relaxed
+    );
+  }
+
+
+  size_t size () const noexcept
+  {
+    return header_->size.load(std::memory_order_relaxed);
+  }
+
+
+  size_t capacity () const noexcept
+  {
+    return header_->capacity;
+  }
+
+
+  uint64_t seed () const noexcept
+  {
+    return header_->seed;
+  }
+
+
+  /**
+   * Counter incremented after each erase() or replacing insert()
+   */
+  uint64_t generation () const noexcept
+  {
+    return header_->generation.load(std::memory_order_acquire);
+  }
+
+
+  /**
+   * Largest distance of inserted entry from its home slot since create(),
+   * at most max_probe_length - 1
+   */
+  size_t max_displacement () const noexcept
+  {
+    return header_->max_displacement.load(std::memory_order_relaxed);
+  }
+
+
+private:
+
+  enum : uint32_t { empty, used, deleted };
+
+  static constexpr size_t endpoint_words = (sizeof(Endpoint) + 7) / 8;
+
+  struct header
+  {
+    std::atomic<uint64_t> magic{};
+    uint32_t version{}, slot_size{};
+    uint64_t capacity{}, seed{};
+    std::atomic<uint64_t> size{};
+    std::atomic<uint32_t> writer{};
+    std::atomic<uint64_t> max_displacement{};
+    std::atomic<uint64_t> generation{};
+    uint64_t tag{};
+  };
+
+  struct slot
+  {
+    std::atomic<uint32_t> sequence{}, state{};
+    std::atomic<uint64_t> id{};
+    std::array<std::atomic<uint64_t>, endpoint_words> endpoint{};
+  };
+
+  struct snapshot
+  {
+    uint32_t state;
+    uint64_t id;
+    std::array<uint64_t, endpoint_words> endpoint;
+  };
+
+  struct writer_lock
+  {
+    header *h = nullptr;
+
+    writer_lock (header &owner, uint32_t id, writer_liveness_check is_alive)
+      noexcept
+    {
+      uint32_t expected = 0;
+      for (size_t retry = 0;  retry != max_lock_retries;  ++retry)
+      {
+        if (owner.writer.compare_exchange_weak(expected, id,
+          std::memory_order_acquire,
+          std::memory_order_relaxed))
+        {
+          h = &owner;
+          return;
+        }
+        expected = 0;
+        std::this_thread::yield();
+      }
+
+      // holder died without release_writer_lock() (yet): take over, slots
+      // it left mid-write are repaired by slot_for_write()
+      expected = owner.writer.load(std::memory_order_relaxed);
+      if (is_alive
+        && expected
+        && !is_alive(expected)
+        && owner.writer.compare_exchange_strong(expected, id,
+          std::memory_order_acquire,
+          std::memory_order_relaxed))
+      {
+        h = &owner;
+      }
+    }
+
+    ~writer_lock () noexcept
+    {
+      if (h)
+      {
+        h->writer.store(0, std::memory_order_release);
+      }
+    }
+
+    explicit operator bool () const noexcept
+    {
+      return h != nullptr;
+    }
+
+    writer_lock (const writer_lock &) = delete;
+    writer_lock &operator= (const writer_lock &) = delete;
+  };
+
+  header *header_;
+  slot *slots_;
+  uint32_t writer_id_ = 1;
+  writer_liveness_check writer_liveness_check_ = nullptr;
+
+
+  session_store (header *h) noexcept
+    : header_{h}
+    , slots_{reinterpret_cast<slot *>(h + 1)}
+  { }
+
+
+  size_t home (uint64_t id) const noexcept
+  {
+    return static_cast<size_t>(mix(id, header_->seed)) & (header_->capacity - 1);
+  }
+
+
+  size_t next (size_t index) const noexcept
+  {
+    return (index + 1) & (header_->capacity - 1);
+  }
+
+
+  size_t probe_limit () const noexcept
+  {
+    return max_displacement() + 1;
+  }
+
+
+  void next_generation () noexcept
+  {
+    // after slot write: reader seeing new generation sees new slot
+    header_->generation.fetch_add(1, std::memory_order_release);
+  }
+
+
+  slot &slot_for_write (size_t index) noexcept
+  {
+    // under writer lock odd sequence is left only by writer that died
+    // mid-write: slot content is unknown, turn it into tombstone
+    auto &s = slots_[index];
+    if (auto sequence = s.sequence.load(std::memory_order_relaxed);  sequence & 1)
+    {
+      s.state.store(s.state.load(std::memory_order_relaxed) == empty ? empty : deleted,
+        std::memory_order_relaxed
+      );
+      s.sequence.store(sequence + 1, std::memory_order_release);
+    }
+    return s;
+  }
+
+
+  using endpoint_bits = std::array<uint64_t, endpoint_words>;
+
+
+  static endpoint_bits to_words (const Endpoint &endpoint) noexcept
+  {
+    endpoint_bits words{};
+    std::memcpy(words.data(), &endpoint, sizeof(endpoint));
+    return words;
+  }
+
+
+  static bool equal (const std::array<std::atomic<uint64_t>, endpoint_words> &a,
+    const endpoint_bits &b) noexcept
+  {
+    for (size_t i = 0;  i != endpoint_words;  ++i)
+    {
+      if (a[i].load(std::memory_order_relaxed) != b[i])
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+
+  static void write (slot &s, uint64_t id, uint32_t state,
+    const endpoint_bits &words) noexcept
+  {
+    auto sequence = s.sequence.load(std::memory_order_relaxed);
+    s.sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    s.id.store(id, std::memory_order_relaxed);
+    s.state.store(state, std::memory_order_relaxed);
+    for (size_t i = 0;  i != endpoint_words;  ++i)
+    {
+      s.endpoint[i].store(words[i], std::memory_order_relaxed);
+    }
+
+    s.sequence.store(sequence + 2, std::memory_order_release);
+  }
+
+
+  static bool read (const slot &s, snapshot &result) noexcept
+  {
+    for (size_t retry = 0;  retry != max_read_retries;  ++retry)
+    {
+      auto sequence = s.sequence.load(std::memory_order_acquire);
+      if (sequence & 1)
+      {
+        std::this_thread::yield();
+        continue;
+      }
+
+      result.state = s.state.load(std::memory_order_relaxed);
+      result.id = s.id.load(std::memory_order_relaxed);
+      for (size_t i = 0;  i != endpoint_words;  ++i)
+      {
+        result.endpoint[i] = s.endpoint[i].load(std::memory_order_relaxed);
+      }
+
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (s.sequence.load(std::memory_order_relaxed) == sequence)
+      {
+        return true;
+      }
+    }
+    return false;
+  }
+};
+
+
+__urn_end
@@ -0,0 +1,275 @@
+#include <urn/session_store.hpp>
+#include <urn/common.test.hpp>
+#include <cstdint>
+#include <vector>
+
+
+namespace {
+
+
+using store_type = urn::session_store<uint64_t>;
+
+
+TEST_CASE("session_store")
+{
+  constexpr size_t capacity = 8;
+  std::vector<uint64_t> memory(store_type::memory_size(capacity) / sizeof(uint64_t) + 1);
+  auto store = store_type::create(memory.data(), capacity, 12345);
+  CHECK(store.capacity() == capacity);
+  CHECK(store.seed() == 12345);
+  CHECK(store.size() == 0);
+
+  uint64_t endpoint = 0;
+
+
+  SECTION("insert")
+  {
+    CHECK(store.insert(1, 11));
+    CHECK(store.size() == 1);
+    REQUIRE(store.find(1, endpoint));
+    CHECK(endpoint == 11);
+    CHECK_FALSE(store.find(2, endpoint));
+  }
+
+
+  SECTION("insert replaces")
+  {
+    CHECK(store.insert(1, 11));
+    CHECK(store.insert(1, 12));
+    CHECK(store.size() == 1);
+    REQUIRE(store.find(1, endpoint));
+    CHECK(endpoint == 12);
+  }
+
+
+  SECTION("erase")
+  {
+    CHECK(store.insert(1, 11));
+    CHECK(store.insert(2, 22));
+    CHECK(store.erase(1));
+    CHECK(store.size() == 1);
+    CHECK_FALSE(store.find(1, endpoint));
+    CHECK_FALSE(store.erase(1));
+
+    REQUIRE(store.find(2, endpoint));
+    CHECK(endpoint == 22);
+  }
+
+
+  SECTION("full")
+  {
+    for (uint64_t id = 1;  id <= capacity;  ++id)
+    {
+      CHECK(store.insert(id, id * 10));
+    }
+    CHECK(store.size() == capacity);
+    CHECK_FALSE(store.insert(capacity + 1, 0));
+
+    // probing passes tombstones, insert reuses them
+    for (uint64_t id = 1;  id <= capacity;  id += 2)
+    {
+      CHECK(store.erase(id));
+    }
+    for (uint64_t id = 2;  id <= capacity;  id += 2)
+    {
+      REQUIRE(store.find(id, endpoint));
+      CHECK(endpoint == id * 10);
+    }
+    CHECK(store.insert(capacity + 1, 1));
+    REQUIRE(store.find(capacity + 1, endpoint));
+    CHECK(endpoint == 1);
+  }
+
+
+  SECTION("open")
+  {
+    CHECK(store.insert(1, 11));
+    CHECK(store.insert(2, 22));
+
+    auto reopened = store_type::open(memory.data(), memory.size() * sizeof(uint64_t));
+    CHECK(reopened.size() == 2);
+    CHECK(reopened.capacity() == capacity);
+    CHECK(reopened.seed() == 12345);
+    REQUIRE(reopened.find(2, endpoint));
+    CHECK(endpoint == 22);
+
+    // writes visible through both
+    CHECK(reopened.erase(1));
+    CHECK_FALSE(store.find(1, endpoint));
+  }
+
+
+  SECTION("release_writer_lock")
+  {
+    auto other = store_type::open(memory.data(), memory.size() * sizeof(uint64_t));
+    other.set_writer_id(2);
+
+    // not held
+    CHECK_FALSE(store.release_writer_lock(2));
+
+    // other "crashed" while holding lock (header word 5: writer id)
+    memory[5] = 2;
+    CHECK_FALSE(store.release_writer_lock(1));
+    CHECK(store.release_writer_lock(2));
+    CHECK(store.insert(1, 11));
+  }
+
+
+  SECTION("writer lock held by live writer")
+  {
+    memory[5] = 2;
+    CHECK_FALSE(store.insert(1, 11));
+    CHECK_FALSE(store.erase(1));
+    CHECK(store.size() == 0);
+
+    store.set_writer_liveness_check([](uint32_t) noexcept { return true; });
+    CHECK_FALSE(store.insert(1, 11));
+  }
+
+
+  SECTION("writer lock held by dead writer")
+  {
+    memory[5] = 2;
+    store.set_writer_liveness_check([](uint32_t id) noexcept { return id != 2; });
+    CHECK(store.insert(1, 11));
+    CHECK(store.erase(1));
+    CHECK(memory[5] == 0);
+  }
+
+
+  SECTION("generation")
+  {
+    auto generation = store.generation();
+    CHECK(store.insert(1, 11));
+    CHECK(store.insert(1, 11));
+    CHECK(store.generation() == generation);
+
+    // replaced with other endpoint
+    CHECK(store.insert(1, 12));
+    CHECK(store.generation() == ++generation);
+
+    CHECK(store.erase(1));
+    CHECK(store.generation() == ++generation);
+    CHECK_FALSE(store.erase(1));
+    CHECK(store.generation() == generation);
+  }
+
+
+  SECTION("open: truncated")
+  {
+    CHECK_THROWS_AS(
+      store_type::open(memory.data(), store_type::memory_size(capacity) - 1),
+      std::runtime_error
+    );
+    CHECK_THROWS_AS(
+      store_type::open(memory.data(), 8),
+      std::runtime_error
+    );
+  }
+
+
+  SECTION("open: invalid magic")
+  {
+    memory[0] ^= 1;
+    CHECK_THROWS_AS(
+      store_type::open(memory.data(), memory.size() * sizeof(uint64_t)),
+      std::runtime_error
+    );
+  }
+
+
+  SECTION("open: tag mismatch")
+  {
+    store_type::create(memory.data(), capacity, 12345, 7);
+    CHECK_THROWS_AS(
+      store_type::open(memory.data(), memory.size() * sizeof(uint64_t)),
+      std::runtime_error
+    );
+    auto reopened = store_type::open(memory.data(), memory.size() * sizeof(uint64_t), 7);
+    CHECK(reopened.capacity() == capacity);
+  }
+
+
+  SECTION("open: layout mismatch")
+  {
+    // store of other endpoint type has different slot size
+    std::vector<uint64_t> other(
+      urn::session_store<std::array<uint64_t, 4>>::memory_size(capacity) / sizeof(uint64_t)
+    );
+    urn::session_store<std::array<uint64_t, 4>>::create(other.data(), capacity, 0);
+    CHECK_THROWS_AS(
+      store_type::open(other.data(), other.size() * sizeof(uint64_t)),
+      std::runtime_error
+    );
+  }
+}
+
+
+TEST_CASE("session_store: invalid capacity")
+{
+  std::vector<uint64_t> memory(store_type::memory_size(8) / sizeof(uint64_t));
+  CHECK_THROWS_AS(store_type::create(memory.data(), 0, 0), std::runtime_error);
+  CHECK_THROWS_AS(store_type::create(memory.data(), 6, 0), std::runtime_error);
+}
+
+
+TEST_CASE("session_store: seed")
+{
+  // same ids, different placement, both find everything
+  constexpr size_t capacity = 1024;
+  std::vector<uint64_t> a_memory(store_type::memory_size(capacity) / sizeof(uint64_t));
+  std::vector<uint64_t> b_memory(a_memory.size());
+  auto a = store_type::create(a_memory.data(), capacity, 1);
+  auto b = store_type::create(b_memory.data(), capacity, 2);
+
+  for (uint64_t id = 0;  id != capacity / 2;  ++id)
+  {
+    REQUIRE(a.insert(id, id));
+    REQUIRE(b.insert(id, id));
+  }
+  CHECK(a_memory != b_memory);
+
+  uint64_t endpoint = 0;
+  for (uint64_t id = 0;  id != capacity / 2;  ++id)
+  {
+    REQUIRE(a.find(id, endpoint));
+    CHECK(endpoint == id);
+    REQUIRE(b.find(id, endpoint));
+    CHECK(endpoint == id);
+  }
+}
+
+
+TEST_CASE("session_store: churn")
+{
+  // sessions come and go at half load: erased slots become tombstones
+  // until none are empty, misses still probe only max_displacement() slots
+  constexpr size_t capacity = 1024, live = capacity / 2;
+  std::vector<uint64_t> memory(store_type::memory_size(capacity) / sizeof(uint64_t));
+  auto store = store_type::create(memory.data(), capacity, 1);
+
+  uint64_t endpoint = 0;
+  for (uint64_t id = 1;  id <= 100 * capacity;  ++id)
+  {
+    REQUIRE(store.insert(id, id));
+    if (id > live)
+    {
+      REQUIRE(store.erase(id - live));
+    }
+  }
+  CHECK(store.size() == live);
+  CHECK(store.max_displacement() < 64);
+
+  for (uint64_t id = 1;  id <= capacity;  ++id)
+  {
+    CHECK_FALSE(store.find(id, endpoint));
+  }
+  for (uint64_t id = 100 * capacity - live + 1;  id <= 100 * capacity;  ++id)
+  {
+    REQUIRE(store.find(id, endpoint));
+    CHECK(endpoint == id);
+  }
+}
+
+
+} // namespace
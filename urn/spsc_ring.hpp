@@ -0,0 +1,129 @@
+#pragma once
+
+/**
+ * \file urn/spsc_ring.hpp
+ * Bounded lock-free single-producer/single-consumer queue
+ */
+
+#include <urn/__bits/lib.hpp>
+#include <array>
+#include <atomic>
+
+
+__urn_begin
+
+
+/**
+ * Fixed-capacity FIFO between exactly one producer and one consumer thread.
+ * try_push() may be invoked only from producer and try_pop() only from
+ * consumer thread. Neither blocks: they return false if ring is full/empty.
+ *
+ * Producer and consumer indexes are kept on separate cache lines, each side
+ * also caches last seen index of other side so that shared line is touched
+ * only when ring looks full/empty.
+ *
+ * Usage:
+ * \code
+ * urn::spsc_ring<int, 1024> ring;
+ *
+ * // producer thread
+ * while (!ring.try_push(1)) { }
+ *
+ * // consumer thread
+ * int value;
+ * if (ring.try_pop(value)) { ... }
+ * \endcode
+ */
+template <typename T, size_t Capacity>
+class spsc_ring
+{
+  static_assert(Capacity && (Capacity & (Capacity - 1)) == 0,
+    "Capacity must be power of 2"
+  );
+
+public:
+
+  using value_type = T;
+
+
+  spsc_ring () noexcept = default;
+  ~spsc_ring () noexcept = default;
+
+  spsc_ring (const spsc_ring &) = delete;
+  spsc_ring &operator= (const spsc_ring &) = delete;
+
+
+  bool try_push (const T &value) noexcept
+  {
+    auto tail = producer_.index.load(std::memory_order_relaxed);
+    if (tail - producer_.cached_other == Capacity)
+    {
+      producer_.cached_other = consumer_.index.load(std::memory_order_acquire);
+      if (tail - producer_.cached_other == Capacity)
+      {
+        return false;
+      }
+    }
+    items_[tail & (Capacity - 1)] = value;
+    producer_.index.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+
+  bool try_pop (T &value) noexcept
+  {
+    auto head = consumer_.index.load(std::memory_order_relaxed);
+    if (head == consumer_.cached_other)
+    {
+      consumer_.cached_other = producer_.index.load(std::memory_order_acquire);
+      if (head == consumer_.cached_other)
+      {
+        return false;
+      }
+    }
+    value = items_[head & (Capacity - 1)];
+    consumer_.index.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+
+  /**
+   * Approximate number of queued items (exact if invoked from producer or
+   * consumer while other side is idle).
+   */
+  size_t size () const noexcept
+  {
+    return producer_.index.load(std::memory_order_acquire)
+      - consumer_.index.load(std::memory_order_acquire);
+  }
+
+
+  bool empty () const noexcept
+  {
+    return size() == 0;
+  }
+
+
+  static constexpr size_t capacity () noexcept
+  {
+    return Capacity;
+  }
+
+
+private:
+
+  struct alignas(64) side
+  {
+    std::atomic<size_t> index{0};
+    size_t cached_other = 0;
+  };
+
+  // producer: index = tail, cached_other = last seen head
+  // consumer: index = head, cached_other = last seen tail
+  side producer_{}, consumer_{};
+
+  alignas(64) std::array<T, Capacity> items_{};
+};
+
+
+__urn_end
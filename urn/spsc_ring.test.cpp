@@ -0,0 +1,127 @@
+#include <urn/spsc_ring.hpp>
+#include <urn/common.test.hpp>
+#include <memory>
+#include <thread>
+
+
+namespace {
+
+
+TEST_CASE("spsc_ring")
+{
+  using ring_type = urn::spsc_ring<int, 4>;
+  auto ring = std::make_unique<ring_type>();
+  CHECK(ring->empty());
+  CHECK(ring->size() == 0);
+  CHECK(ring->capacity() == 4);
+
+  int value = -1;
+  CHECK_FALSE(ring->try_pop(value));
+  CHECK(value == -1);
+
+
+  SECTION("single_push_pop")
+  {
+    REQUIRE(ring->try_push(1));
+    CHECK_FALSE(ring->empty());
+    CHECK(ring->size() == 1);
+
+    REQUIRE(ring->try_pop(value));
+    CHECK(value == 1);
+    CHECK(ring->empty());
+    CHECK_FALSE(ring->try_pop(value));
+  }
+
+
+  SECTION("fifo")
+  {
+    REQUIRE(ring->try_push(1));
+    REQUIRE(ring->try_push(2));
+    REQUIRE(ring->try_push(3));
+
+    REQUIRE(ring->try_pop(value));
+    CHECK(value == 1);
+    REQUIRE(ring->try_pop(value));
+    CHECK(value == 2);
+    REQUIRE(ring->try_pop(value));
+    CHECK(value == 3);
+    CHECK(ring->empty());
+  }
+
+
+  SECTION("full")
+  {
+    for (int i = 0;  i != 4;  ++i)
+    {
+      REQUIRE(ring->try_push(i));
+    }
+    CHECK(ring->size() == 4);
+    CHECK_FALSE(ring->try_push(4));
+
+    // freeing single slot allows single push
+    REQUIRE(ring->try_pop(value));
+    CHECK(value == 0);
+    CHECK(ring->try_push(4));
+    CHECK_FALSE(ring->try_push(5));
+  }
+
+
+  SECTION("wrap")
+  {
+    for (int i = 0;  i != 10;  ++i)
+    {
+      REQUIRE(ring->try_push(2 * i));
+      REQUIRE(ring->try_push(2 * i + 1));
+      REQUIRE(ring->try_pop(value));
+      CHECK(value == 2 * i);
+      REQUIRE(ring->try_pop(value));
+      CHECK(value == 2 * i + 1);
+    }
+    CHECK(ring->empty());
+  }
+
+
+  SECTION("producer_consumer")
+  {
+    constexpr int count = 100'000;
+
+    std::thread producer{
+      [&]
+      {
+        for (int i = 0;  i != count;  /**/)
+        {
+          if (ring->try_push(i))
+          {
+            ++i;
+          }
+          else
+          {
+            std::this_thread::yield();
+          }
+        }
+      }
+    };
+
+    // values must arrive in order, without gaps
+    int received = 0, out_of_order = 0;
+    while (received != count)
+    {
+      if (ring->try_pop(value))
+      {
+        out_of_order += (value != received);
+        ++received;
+      }
+      else
+      {
+        std::this_thread::yield();
+      }
+    }
+    producer.join();
+
+    CHECK(out_of_order == 0);
+    CHECK(ring->empty());
+  }
+}
+
+
+} // namespace
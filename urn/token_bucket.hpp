@@ -0,0 +1,134 @@
+#pragma once
+
+/**
+ * \file urn/token_bucket.hpp
+ * Lazily refilled token bucket driven by coarse external clock
+ */
+
+#include <urn/__bits/lib.hpp>
+#include <algorithm>
+#include <atomic>
+
+
+__urn_begin
+
+
+/**
+ * Token bucket without own timer: tokens are added on try_consume() for time
+ * elapsed since previous refill. Time is caller-provided millisecond counter
+ * (may wrap, only differences are used).
+ *
+ * Bucket stores only state, rate and burst are passed to each call so that
+ * many buckets sharing same policy (i.e. per-session limiters) stay small.
+ *
+ * Tokens are kept in 1/1024 units, so rounding loss on refill is below one
+ * token per second even when refilled every millisecond. Caller's clock
+ * slightly behind last refill (lagging thread) refills nothing. Concurrent
+ * try_consume() from multiple threads is safe: refill for each time step is
+ * claimed by single caller and consumption never drives balance below zero.
+ */
+class token_bucket
+{
+public:
+
+  struct limit
+  {
+    // tokens per second (0 = unlimited)
+    uint32_t rate = 0;
+
+    // bucket capacity (max tokens consumed in burst)
+    uint32_t burst = 0;
+
+    explicit operator bool () const noexcept
+    {
+      return rate != 0;
+    }
+  };
+
+
+  // bucket starts full
+  token_bucket (const limit &limit, uint32_t now) noexcept
+    : last_refill_{now}
+    , tokens_{uint64_t{limit.burst} * unit}
+  { }
+
+
+  token_bucket (const token_bucket &) = delete;
+  token_bucket &operator= (const token_bucket &) = delete;
+
+
+  /**
+   * Refill for time passed since last call and take \a cost tokens. Returns
+   * false (and takes nothing) if there are not enough tokens.
+   */
+  bool try_consume (const limit &limit, uint32_t now, uint32_t cost) noexcept
+  {
+    refill(limit, now);
+
+    const auto need = uint64_t{cost} * unit;
+    auto tokens = tokens_.load(std::memory_order_relaxed);
+    do
+    {
+      if (tokens < need)
+      {
+        return false;
+      }
+    } while (!tokens_.compare_exchange_weak(tokens, tokens - need,
+        std::memory_order_relaxed
+      )
+    );
+    return true;
+  }
+
+
+  // approximate number of whole tokens currently in bucket
+  uint32_t tokens () const noexcept
+  {
+    return static_cast<uint32_t>(tokens_.load(std::memory_order_relaxed) / unit);
+  }
+
+
+private:
+
+  static constexpr uint64_t unit = 1024;
+
+  // elapsed times above this refill bucket to full (keeps math in 64 bits)
+  static constexpr uint32_t max_elapsed = 1 << 20;
+
+  std::atomic<uint32_t> last_refill_;
+  std::atomic<uint64_t> tokens_;
+
+
+  void refill (const limit &limit, uint32_t now) noexcept
+  {
+    // callers' clocks (i.e. per-thread event loop time) may lag behind last
+    // refill by other caller: small negative difference is lag (nothing to
+    // refill), not wrapped huge elapsed time (refill to full). Difference
+    // beyond max_elapsed either way is long idle.
+    auto last = last_refill_.load(std::memory_order_relaxed);
+    const auto delta = static_cast<int32_t>(now - last);
+    if (delta == 0
+      || (delta < 0 && delta > -static_cast<int32_t>(max_elapsed))
+      || !last_refill_.compare_exchange_strong(last, now,
+        std::memory_order_relaxed))
+    {
+      return;
+    }
+    const auto elapsed = static_cast<uint32_t>(delta);
+
+    const auto capacity = uint64_t{limit.burst} * unit;
+    const auto added = elapsed < max_elapsed
+      ? uint64_t{elapsed} * limit.rate * unit / 1000
+      : capacity
+    ;
+
+    auto tokens = tokens_.load(std::memory_order_relaxed);
+    while (!tokens_.compare_exchange_weak(tokens,
+        (std::min)(tokens + added, capacity),
+        std::memory_order_relaxed))
+    { }
+  }
+};
+
+
+__urn_end
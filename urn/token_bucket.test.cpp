@@ -0,0 +1,145 @@
+#include <urn/token_bucket.hpp>
+#include <urn/common.test.hpp>
+#include <thread>
+#include <vector>
+
+
+namespace {
+
+
+TEST_CASE("token_bucket")
+{
+  const urn::token_bucket::limit limit{1000, 100};
+  uint32_t now = 12345;
+  urn::token_bucket bucket{limit, now};
+  CHECK(bucket.tokens() == 100);
+
+
+  SECTION("burst")
+  {
+    for (auto i = 0;  i != 10;  ++i)
+    {
+      CHECK(bucket.try_consume(limit, now, 10));
+    }
+    CHECK(bucket.tokens() == 0);
+    CHECK_FALSE(bucket.try_consume(limit, now, 1));
+  }
+
+
+  SECTION("insufficient tokens are not taken")
+  {
+    CHECK_FALSE(bucket.try_consume(limit, now, 101));
+    CHECK(bucket.tokens() == 100);
+    CHECK(bucket.try_consume(limit, now, 100));
+  }
+
+
+  SECTION("refill")
+  {
+    REQUIRE(bucket.try_consume(limit, now, 100));
+
+    // 1000/s -> 1 per ms
+    CHECK_FALSE(bucket.try_consume(limit, now, 1));
+    CHECK(bucket.try_consume(limit, now + 5, 5));
+    CHECK_FALSE(bucket.try_consume(limit, now + 5, 1));
+
+    // capped at burst
+    CHECK(bucket.try_consume(limit, now + 10'000, 0));
+    CHECK(bucket.tokens() == 100);
+  }
+
+
+  SECTION("fractional rate")
+  {
+    const urn::token_bucket::limit slow{1500, 100};
+    REQUIRE(bucket.try_consume(slow, now, 100));
+
+    // 1.5 per ms, fractions must accumulate
+    for (auto i = 1;  i <= 10;  ++i)
+    {
+      bucket.try_consume(slow, now + i, 0);
+    }
+    CHECK(bucket.tokens() == 15);
+  }
+
+
+  SECTION("long idle")
+  {
+    REQUIRE(bucket.try_consume(limit, now, 100));
+    CHECK(bucket.try_consume(limit, now + (1u << 30), 100));
+  }
+
+
+  SECTION("clock wrap")
+  {
+    now = 0xffff'fff0;
+    urn::token_bucket wrapped{limit, now};
+    REQUIRE(wrapped.try_consume(limit, now, 100));
+    CHECK(wrapped.try_consume(limit, now + 20, 20));
+    CHECK_FALSE(wrapped.try_consume(limit, now + 20, 1));
+  }
+
+
+  SECTION("clock behind last refill")
+  {
+    // other thread's clock lags: no refill, bucket stays drained
+    REQUIRE(bucket.try_consume(limit, now, 100));
+    CHECK_FALSE(bucket.try_consume(limit, now - 1, 1));
+    CHECK_FALSE(bucket.try_consume(limit, now - 1000, 1));
+    CHECK(bucket.tokens() == 0);
+
+    // and does not move refill time back
+    CHECK(bucket.try_consume(limit, now + 5, 5));
+    CHECK_FALSE(bucket.try_consume(limit, now + 5, 1));
+  }
+
+
+  SECTION("clock behind last refill: wrap")
+  {
+    now = 2;
+    urn::token_bucket wrapped{limit, now};
+    REQUIRE(wrapped.try_consume(limit, now, 100));
+    CHECK_FALSE(wrapped.try_consume(limit, 0xffff'fff0, 1));
+    CHECK(wrapped.tokens() == 0);
+  }
+
+
+  SECTION("clock far behind last refill")
+  {
+    // more than max_elapsed: long idle (full refill), not lag
+    REQUIRE(bucket.try_consume(limit, now, 100));
+    CHECK(bucket.try_consume(limit, now - (1u << 30), 100));
+  }
+
+
+  SECTION("concurrent")
+  {
+    // no refill: exactly burst tokens must be handed out
+    std::atomic<int> consumed{0};
+    std::vector<std::thread> threads;
+    for (auto t = 0;  t != 4;  ++t)
+    {
+      threads.emplace_back(
+        [&]
+        {
+          for (auto i = 0;  i != 100;  ++i)
+          {
+            if (bucket.try_consume(limit, now, 1))
+            {
+              consumed++;
+            }
+          }
+        }
+      );
+    }
+    for (auto &thread: threads)
+    {
+      thread.join();
+    }
+    CHECK(consumed == 100);
+    CHECK(bucket.tokens() == 0);
+  }
+}
+
+
+} // namespace